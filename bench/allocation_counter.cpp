@@ -0,0 +1,93 @@
+#include "allocation_counter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// The replaced operators live in a translation unit of their own: inlined into their callers,
+// GCC would take them for the standard ones and warn that free gets a pointer from new.
+namespace {
+    std::atomic<unsigned long long> allocation_count(0);
+}
+
+unsigned long long GetAllocationCount()
+{
+    return allocation_count.load();
+}
+
+// Every replaceable form is defined, so no allocation gets past the count and every delete
+// matches its new.
+void* operator new(std::size_t size)
+{
+    ++allocation_count;
+    if (void* memory = std::malloc(size ? size : 1)) return memory;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    ++allocation_count;
+    const std::size_t align = (std::size_t)alignment;
+    // aligned_alloc wants a multiple of the alignment.
+    const std::size_t rounded = ((size ? size : 1) + align - 1) / align * align;
+#ifdef _WIN32
+    if (void* memory = _aligned_malloc(rounded, align)) return memory;
+#else
+    if (void* memory = std::aligned_alloc(align, rounded)) return memory;
+#endif
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    operator delete(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    operator delete(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept
+{
+    operator delete(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept
+{
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    std::free(memory);
+#endif
+}
+
+void operator delete[](void* memory, std::align_val_t alignment) noexcept
+{
+    operator delete(memory, alignment);
+}
+
+void operator delete(void* memory, std::size_t, std::align_val_t alignment) noexcept
+{
+    operator delete(memory, alignment);
+}
+
+void operator delete[](void* memory, std::size_t, std::align_val_t alignment) noexcept
+{
+    operator delete(memory, alignment);
+}
@@ -0,0 +1,7 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+// Number of calls to the global operator new, in any of its forms, since the start.
+unsigned long long GetAllocationCount();
+
+#endif // !ALLOCATION_COUNTER_H
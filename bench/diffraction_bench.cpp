@@ -0,0 +1,72 @@
+// Microbenchmark of the knife-edge diffraction kernel, the kernel alone: CalculateDiffraction
+// around it only adds the free space loss and the antenna gains. Every allocation is counted
+// through the global operator new; the kernel has to get through the whole run without a single one.
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "allocation_counter.hpp"
+#include "../src/diffraction.hpp"
+
+namespace {
+    constexpr unsigned int k_path_count = 4096;
+    constexpr unsigned int k_rounds = 64;
+    constexpr std::size_t k_max_record_edges = 6;
+    constexpr float k_frequency = 2.4e9f;
+
+    struct Case {
+        glm::vec3 tx_position;
+        glm::vec3 rx_position;
+        glm::vec3 edges[k_max_record_edges];
+        std::size_t edge_count;
+    };
+}
+
+int main()
+{
+    // Paths of a few hundred meters over rooftops, between one and six edges each.
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> ground(-300.0f, 300.0f);
+    std::uniform_real_distribution<float> antenna(1.5f, 30.0f);
+    std::uniform_real_distribution<float> along(0.05f, 0.95f);
+    std::uniform_real_distribution<float> roof(5.0f, 40.0f);
+    std::uniform_int_distribution<std::size_t> edge_count(1, k_max_record_edges);
+    std::vector<Case> cases(k_path_count);
+    for (auto& path : cases) {
+        path.tx_position = glm::vec3(ground(random), antenna(random), ground(random));
+        path.rx_position = glm::vec3(ground(random), antenna(random), ground(random));
+        path.edge_count = edge_count(random);
+        for (std::size_t i = 0; i < path.edge_count; ++i) {
+            const glm::vec3 point = path.tx_position + (path.rx_position - path.tx_position) * along(random);
+            path.edges[i] = glm::vec3(point.x, roof(random), point.z);
+        }
+    }
+
+    float checksum = 0.0f;
+    const unsigned long long allocations_before = GetAllocationCount();
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned int round = 0; round < k_rounds; ++round)
+        for (const auto& path : cases) {
+            DiffractionPath result;
+            if (DiffractionKernel::Evaluate(path.tx_position, path.rx_position, path.edges, path.edge_count,
+                                            k_frequency, DiffractionKernel::ThreeEdgeLoss::kSubPaths, result))
+                checksum += result.excess_loss;
+        }
+    const auto stop = std::chrono::steady_clock::now();
+    const unsigned long long allocations = GetAllocationCount() - allocations_before;
+
+    const double calls = (double)k_path_count * k_rounds;
+    const double nanoseconds = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+    std::printf("calls: %.0f\n", calls);
+    std::printf("allocations per call: %.3f\n", allocations / calls);
+    std::printf("ns per call: %.1f\n", nanoseconds / calls);
+    std::printf("checksum: %f\n", checksum);
+    if (allocations != 0) {
+        std::printf("FAIL: the kernel allocated %llu times\n", allocations);
+        return 1;
+    }
+    return 0;
+}
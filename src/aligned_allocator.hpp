@@ -0,0 +1,34 @@
+#ifndef ALIGNED_ALLOCATOR_H
+#define ALIGNED_ALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// Allocator handing out storage aligned to a cache line (or any power of two).
+template<typename T, std::size_t Alignment = 64>
+class AlignedAllocator {
+public:
+	using value_type = T;
+	template<typename U> struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+	AlignedAllocator() noexcept = default;
+	template<typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+	T* allocate(std::size_t n)
+	{
+		return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+	}
+	void deallocate(T* pointer, std::size_t) noexcept
+	{
+		::operator delete(pointer, std::align_val_t(Alignment));
+	}
+
+	template<typename U> bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+	template<typename U> bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+};
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+#endif // !ALIGNED_ALLOCATOR_H
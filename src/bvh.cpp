@@ -0,0 +1,382 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "intersection_kernel.hpp"
+#include "scene_file.hpp"
+
+namespace {
+    constexpr unsigned int k_bins = 16; // SAH candidate planes per axis
+    constexpr unsigned int k_min_leaf_size = 2;
+    constexpr unsigned int k_max_leaf_size = 8;
+    constexpr unsigned int k_max_depth = 60; // keeps the traversal stack bounded
+    constexpr unsigned int k_stack_size = 64;
+    constexpr float k_traversal_cost = 1.0f;
+    constexpr float k_intersection_cost = 1.0f;
+
+    float HalfArea(const glm::vec3& min_corner, const glm::vec3& max_corner)
+    {
+        const glm::vec3 extent = max_corner - min_corner;
+        return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+    }
+
+    struct Bin {
+        glm::vec3 min_corner = glm::vec3(std::numeric_limits<float>::max());
+        glm::vec3 max_corner = glm::vec3(-std::numeric_limits<float>::max());
+        unsigned int count = 0;
+    };
+}
+
+BVH::BVH() : triangles_(nullptr)
+{
+}
+
+BVH::BVH(TriangleBuffer& triangles) : triangles_(&triangles)
+{
+    std::vector<BuildTriangle> build_triangles;
+    build_triangles.reserve(triangles.Size());
+    indices_.reserve(triangles.Size());
+    for (TriangleIndex i = 0; i < triangles.Size(); ++i) {
+        const glm::vec3 point_0 = triangles.GetV0(i);
+        const glm::vec3 point_1 = point_0 + triangles.GetEdge1(i);
+        const glm::vec3 point_2 = point_0 + triangles.GetEdge2(i);
+        BuildTriangle build_triangle;
+        build_triangle.min_corner = glm::min(point_0, glm::min(point_1, point_2));
+        build_triangle.max_corner = glm::max(point_0, glm::max(point_1, point_2));
+        build_triangle.centroid = (point_0 + point_1 + point_2) / 3.0f;
+        build_triangles.push_back(build_triangle);
+        indices_.push_back(i);
+    }
+    Build(build_triangles);
+
+    // Pack the leaves so the intersection kernel reads each one as a few contiguous loads.
+    triangles.Reorder(indices_.data());
+}
+
+unsigned int BVH::GetNodeCount() const
+{
+    return nodes_.size();
+}
+
+TriangleIndex BVH::GetSourceIndex(const TriangleIndex triangle) const
+{
+    return indices_[triangle];
+}
+
+void BVH::Write(SceneWriter& writer) const
+{
+    writer.Write(nodes_);
+    writer.Write(indices_);
+}
+
+bool BVH::Read(SceneReader& reader, const TriangleBuffer& triangles)
+{
+    triangles_ = &triangles;
+    if (!reader.Read(nodes_) || !reader.Read(indices_) || triangles.Size() != indices_.size()) return false;
+    if (nodes_.empty()) return indices_.empty();
+
+    // Nothing from the file is trusted by the traversal: every leaf range lies in the triangles,
+    // children come after their parent, so it ends, and no path is deeper than its stack.
+    const BVHNode* nodes = nodes_.data(); // const, the borrowed nodes stay in the mapping
+    std::vector<unsigned char> depths(nodes_.size(), 0);
+    for (std::size_t index = 0; index < nodes_.size(); ++index) {
+        const BVHNode& node = nodes[index];
+        if (node.IsLeaf()) {
+            if ((std::uint64_t)node.left_first + node.count > indices_.size()) return false;
+            continue;
+        }
+        if (node.left_first <= index || (std::size_t)node.left_first + 1 >= nodes_.size() ||
+            depths[index] + 1u >= k_stack_size)
+            return false;
+        depths[node.left_first] = std::max<unsigned char>(depths[node.left_first], depths[index] + 1);
+        depths[node.left_first + 1] = std::max<unsigned char>(depths[node.left_first + 1], depths[index] + 1);
+    }
+    return true;
+}
+
+void BVH::Build(std::vector<BuildTriangle>& build_triangles)
+{
+    nodes_.clear();
+    if (indices_.empty()) return;
+    nodes_.reserve(2 * indices_.size());
+
+    BVHNode root;
+    root.left_first = 0;
+    root.count = indices_.size();
+    nodes_.push_back(root);
+    UpdateNodeBounds(0, build_triangles);
+    Subdivide(0, build_triangles, 0);
+    nodes_.shrink_to_fit();
+}
+
+void BVH::UpdateNodeBounds(unsigned int node_index, const std::vector<BuildTriangle>& build_triangles)
+{
+    BVHNode& node = nodes_[node_index];
+    node.min_corner = glm::vec3(std::numeric_limits<float>::max());
+    node.max_corner = glm::vec3(-std::numeric_limits<float>::max());
+    for (unsigned int i = node.left_first; i < node.left_first + node.count; ++i) {
+        node.min_corner = glm::min(node.min_corner, build_triangles[i].min_corner);
+        node.max_corner = glm::max(node.max_corner, build_triangles[i].max_corner);
+    }
+}
+
+float BVH::FindBestSplit(const BVHNode& node, const std::vector<BuildTriangle>& build_triangles,
+                         int& best_axis, float& best_position) const
+{
+    float best_cost = std::numeric_limits<float>::max();
+    const unsigned int first = node.left_first;
+    const unsigned int last = node.left_first + node.count;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        // Bin on the centroid bounds, the box bounds would waste bins on large triangles.
+        float centroid_min = std::numeric_limits<float>::max();
+        float centroid_max = -std::numeric_limits<float>::max();
+        for (unsigned int i = first; i < last; ++i) {
+            centroid_min = std::min(centroid_min, build_triangles[i].centroid[axis]);
+            centroid_max = std::max(centroid_max, build_triangles[i].centroid[axis]);
+        }
+        if (centroid_min == centroid_max) continue;
+
+        Bin bins[k_bins];
+        const float scale = k_bins / (centroid_max - centroid_min);
+        for (unsigned int i = first; i < last; ++i) {
+            const BuildTriangle& build_triangle = build_triangles[i];
+            unsigned int bin_index = std::min(k_bins - 1,
+                                              (unsigned int)((build_triangle.centroid[axis] - centroid_min) * scale));
+            bins[bin_index].count++;
+            bins[bin_index].min_corner = glm::min(bins[bin_index].min_corner, build_triangle.min_corner);
+            bins[bin_index].max_corner = glm::max(bins[bin_index].max_corner, build_triangle.max_corner);
+        }
+
+        // Sweep from both sides to get the area and count on each side of every plane.
+        float left_area[k_bins - 1], right_area[k_bins - 1];
+        unsigned int left_count[k_bins - 1], right_count[k_bins - 1];
+        Bin left_box, right_box;
+        unsigned int left_sum = 0, right_sum = 0;
+        for (unsigned int i = 0; i < k_bins - 1; ++i) {
+            left_sum += bins[i].count;
+            left_count[i] = left_sum;
+            left_box.min_corner = glm::min(left_box.min_corner, bins[i].min_corner);
+            left_box.max_corner = glm::max(left_box.max_corner, bins[i].max_corner);
+            left_area[i] = left_sum ? HalfArea(left_box.min_corner, left_box.max_corner) : 0.0f;
+
+            right_sum += bins[k_bins - 1 - i].count;
+            right_count[k_bins - 2 - i] = right_sum;
+            right_box.min_corner = glm::min(right_box.min_corner, bins[k_bins - 1 - i].min_corner);
+            right_box.max_corner = glm::max(right_box.max_corner, bins[k_bins - 1 - i].max_corner);
+            right_area[k_bins - 2 - i] = right_sum ? HalfArea(right_box.min_corner, right_box.max_corner) : 0.0f;
+        }
+
+        const float bin_width = (centroid_max - centroid_min) / k_bins;
+        for (unsigned int i = 0; i < k_bins - 1; ++i) {
+            if (left_count[i] == 0 || right_count[i] == 0) continue;
+            const float cost = left_count[i] * left_area[i] + right_count[i] * right_area[i];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_position = centroid_min + bin_width * (i + 1);
+            }
+        }
+    }
+    return best_cost;
+}
+
+void BVH::Subdivide(unsigned int node_index, std::vector<BuildTriangle>& build_triangles, unsigned int depth)
+{
+    const BVHNode node = nodes_[node_index];
+    if (node.count <= k_min_leaf_size || depth >= k_max_depth) return;
+
+    int axis = -1;
+    float position = 0.0f;
+    const float parent_area = HalfArea(node.min_corner, node.max_corner);
+    const float split_cost = k_traversal_cost + k_intersection_cost * FindBestSplit(node, build_triangles, axis, position) / parent_area;
+    const float leaf_cost = k_intersection_cost * node.count;
+    if (split_cost >= leaf_cost && node.count <= k_max_leaf_size) return;
+
+    // Partition the range in place, keeping the triangles and their build data in step.
+    unsigned int first = node.left_first;
+    unsigned int last = node.left_first + node.count;
+    unsigned int middle = first;
+    if (axis != -1) {
+        unsigned int i = first, j = last;
+        while (i < j) {
+            if (build_triangles[i].centroid[axis] < position) {
+                ++i;
+            } else {
+                --j;
+                std::swap(build_triangles[i], build_triangles[j]);
+                std::swap(indices_[i], indices_[j]);
+            }
+        }
+        middle = i;
+    }
+    // Coincident centroids or rounding at the plane: fall back to an object median.
+    if (middle == first || middle == last) middle = first + node.count / 2;
+
+    const unsigned int left_index = nodes_.size();
+    BVHNode left, right;
+    left.left_first = first;
+    left.count = middle - first;
+    right.left_first = middle;
+    right.count = last - middle;
+    nodes_.push_back(left);
+    nodes_.push_back(right);
+    nodes_[node_index].left_first = left_index;
+    nodes_[node_index].count = 0;
+
+    UpdateNodeBounds(left_index, build_triangles);
+    UpdateNodeBounds(left_index + 1, build_triangles);
+    Subdivide(left_index, build_triangles, depth + 1);
+    Subdivide(left_index + 1, build_triangles, depth + 1);
+}
+
+bool BVH::IsBoxHit(const BVHNode& node, const TracingRay& ray, float max_t, float& near_t)
+{
+    // The sign bits pick the entry and exit planes, so no min/max per axis. A ray parallel to a
+    // slab that starts on its plane gives NaN, the comparisons below then ignore that axis.
+    const float tx_near = ((ray.sign & 1u ? node.max_corner.x : node.min_corner.x) - ray.origin.x) * ray.inverse_direction.x;
+    const float tx_far = ((ray.sign & 1u ? node.min_corner.x : node.max_corner.x) - ray.origin.x) * ray.inverse_direction.x;
+    const float ty_near = ((ray.sign & 2u ? node.max_corner.y : node.min_corner.y) - ray.origin.y) * ray.inverse_direction.y;
+    const float ty_far = ((ray.sign & 2u ? node.min_corner.y : node.max_corner.y) - ray.origin.y) * ray.inverse_direction.y;
+    const float tz_near = ((ray.sign & 4u ? node.max_corner.z : node.min_corner.z) - ray.origin.z) * ray.inverse_direction.z;
+    const float tz_far = ((ray.sign & 4u ? node.min_corner.z : node.max_corner.z) - ray.origin.z) * ray.inverse_direction.z;
+
+    float t_min = ray.t_min;
+    float t_max = max_t;
+    if (tx_near > t_min) t_min = tx_near;
+    if (ty_near > t_min) t_min = ty_near;
+    if (tz_near > t_min) t_min = tz_near;
+    if (tx_far < t_max) t_max = tx_far;
+    if (ty_far < t_max) t_max = ty_far;
+    if (tz_far < t_max) t_max = tz_far;
+
+    near_t = t_min;
+    return t_min <= t_max;
+}
+
+bool BVH::IsClosestHit(const TracingRay& ray, float& t, TriangleIndex& hit_triangle) const
+{
+    if (nodes_.empty()) return false;
+
+    float closest_t = ray.t_max;
+    bool is_hit = false;
+    TriangleIndex closest_triangle = 0;
+
+    unsigned int stack[k_stack_size];
+    unsigned int stack_size = 0;
+    float near_t;
+    if (!IsBoxHit(nodes_[0], ray, closest_t, near_t)) return false;
+    const BVHNode* node = &nodes_[0];
+    while (true) {
+        if (node->IsLeaf()) {
+            TriangleIndex position;
+            if (IntersectionKernel::IsClosestHit(*triangles_, node->left_first, node->count, ray,
+                                                 closest_t, closest_t, position)) {
+                closest_triangle = position;
+                is_hit = true;
+            }
+            if (stack_size == 0) break;
+            node = &nodes_[stack[--stack_size]];
+            continue;
+        }
+        // Visit the nearer child first and skip any child beyond the closest hit so far.
+        unsigned int near_index = node->left_first;
+        unsigned int far_index = node->left_first + 1;
+        float near_child_t, far_child_t;
+        bool is_near_hit = IsBoxHit(nodes_[near_index], ray, closest_t, near_child_t);
+        bool is_far_hit = IsBoxHit(nodes_[far_index], ray, closest_t, far_child_t);
+        if (is_near_hit && is_far_hit && far_child_t < near_child_t) std::swap(near_index, far_index);
+        if (is_near_hit && is_far_hit) {
+            stack[stack_size++] = far_index;
+            node = &nodes_[near_index];
+        } else if (is_near_hit || is_far_hit) {
+            node = &nodes_[is_near_hit ? node->left_first : node->left_first + 1];
+        } else {
+            if (stack_size == 0) break;
+            node = &nodes_[stack[--stack_size]];
+        }
+    }
+    if (!is_hit) return false;
+    t = closest_t;
+    hit_triangle = closest_triangle;
+    return true;
+}
+
+bool BVH::IsAnyHit(const TracingRay& ray) const
+{
+    if (nodes_.empty()) return false;
+
+    unsigned int stack[k_stack_size];
+    unsigned int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size != 0) {
+        const BVHNode& node = nodes_[stack[--stack_size]];
+        float near_t;
+        if (!IsBoxHit(node, ray, ray.t_max, near_t)) continue;
+        if (node.IsLeaf()) {
+            if (IntersectionKernel::IsAnyHit(*triangles_, node.left_first, node.count, ray))
+                return true;
+        } else {
+            stack[stack_size++] = node.left_first + 1;
+            stack[stack_size++] = node.left_first;
+        }
+    }
+    return false;
+}
+
+bool BVH::IsHit(const TracingRay& ray, std::set<std::pair<float, TriangleIndex>>& hit_triangles) const
+{
+    if (nodes_.empty()) return false;
+
+    unsigned int stack[k_stack_size];
+    unsigned int stack_size = 0;
+    stack[stack_size++] = 0;
+    bool is_hit = false;
+    while (stack_size != 0) {
+        const BVHNode& node = nodes_[stack[--stack_size]];
+        float near_t;
+        if (!IsBoxHit(node, ray, ray.t_max, near_t)) continue;
+        if (node.IsLeaf()) {
+            for (unsigned int i = node.left_first; i < node.left_first + node.count; ++i) {
+                float temp_t;
+                if (triangles_->IsHit(i, ray, temp_t)) {
+                    hit_triangles.insert(std::pair{ temp_t, i });
+                    is_hit = true;
+                }
+            }
+        } else {
+            stack[stack_size++] = node.left_first + 1;
+            stack[stack_size++] = node.left_first;
+        }
+    }
+    return is_hit;
+}
+
+bool BVH::IsHit(const TracingRay& ray, std::unordered_map<TriangleIndex, float>& hit_triangles) const
+{
+    if (nodes_.empty()) return false;
+
+    unsigned int stack[k_stack_size];
+    unsigned int stack_size = 0;
+    stack[stack_size++] = 0;
+    bool is_hit = false;
+    while (stack_size != 0) {
+        const BVHNode& node = nodes_[stack[--stack_size]];
+        float near_t;
+        if (!IsBoxHit(node, ray, ray.t_max, near_t)) continue;
+        if (node.IsLeaf()) {
+            for (unsigned int i = node.left_first; i < node.left_first + node.count; ++i) {
+                float temp_t;
+                if (triangles_->IsHit(i, ray, temp_t)) {
+                    hit_triangles[i] = temp_t;
+                    is_hit = true;
+                }
+            }
+        } else {
+            stack[stack_size++] = node.left_first + 1;
+            stack[stack_size++] = node.left_first;
+        }
+    }
+    return is_hit;
+}
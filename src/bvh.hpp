@@ -0,0 +1,63 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+#include <glm/glm.hpp>
+
+#include "triangle_buffer.hpp"
+#include "tracing_ray.hpp"
+
+// Flat node of the hierarchy, 32 bytes so two nodes share a cache line.
+struct BVHNode {
+	glm::vec3 min_corner;
+	unsigned int left_first; // inner node: index of the left child (right = left + 1), leaf: first triangle
+	glm::vec3 max_corner;
+	unsigned int count; // number of triangles in the leaf, 0 for inner nodes
+
+	bool IsLeaf() const { return count != 0; }
+};
+
+// Built over the triangles of the mesh, which it puts in leaf order: a leaf is one SoA range of
+// the buffer, and the hit triangles are indices into that same buffer. GetSourceIndex gives the
+// index a triangle had before, so the owner can renumber whatever else it keeps per triangle.
+class BVH {
+public:
+	BVH(); // empty, to be read from a scene file
+	BVH(TriangleBuffer& triangles);
+
+	bool IsClosestHit(const TracingRay& ray, float& t, TriangleIndex& hit_triangle) const; // nearest hit triangle
+	bool IsHit(const TracingRay& ray, std::set<std::pair<float, TriangleIndex>>& hit_triangles) const; // all hit triangles
+	bool IsHit(const TracingRay& ray, std::unordered_map<TriangleIndex, float>& hit_triangles) const;
+	bool IsAnyHit(const TracingRay& ray) const; // occlusion, stops at the first hit inside the t range
+
+	unsigned int GetNodeCount() const;
+	TriangleIndex GetSourceIndex(TriangleIndex triangle) const; // index before the reordering
+
+	void Write(SceneWriter& writer) const;
+	// Borrows the nodes from the scene file; the triangles are the ones it was written with.
+	bool Read(SceneReader& reader, const TriangleBuffer& triangles);
+
+private:
+	struct BuildTriangle {
+		glm::vec3 min_corner;
+		glm::vec3 max_corner;
+		glm::vec3 centroid;
+	};
+
+	void Build(std::vector<BuildTriangle>& build_triangles);
+	void UpdateNodeBounds(unsigned int node_index, const std::vector<BuildTriangle>& build_triangles);
+	void Subdivide(unsigned int node_index, std::vector<BuildTriangle>& build_triangles, unsigned int depth);
+	float FindBestSplit(const BVHNode& node, const std::vector<BuildTriangle>& build_triangles,
+	                    int& best_axis, float& best_position) const;
+	static bool IsBoxHit(const BVHNode& node, const TracingRay& ray, float max_t, float& near_t);
+
+	const TriangleBuffer* triangles_; // in leaf order
+	MappableVector<BVHNode> nodes_;
+	MappableVector<TriangleIndex> indices_; // source index of every triangle, in leaf order
+};
+
+#endif // !BVH_H
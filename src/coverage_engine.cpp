@@ -0,0 +1,63 @@
+#include "coverage_engine.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+
+#include "coverage_raster.hpp"
+#include "thread_pool.hpp"
+
+CoverageEngine::CoverageEngine(ThreadPool& pool) : pool_(pool)
+{
+}
+
+void CoverageEngine::SetProgressFunction(ProgressFunction progress)
+{
+    progress_ = std::move(progress);
+}
+
+void CoverageEngine::Compute(const float height, const CellFunction& cell, CoverageRaster& raster) const
+{
+    if (raster.Empty()) return;
+    const unsigned int x_count = raster.GetWidth();
+    const unsigned int z_count = raster.GetHeight();
+
+    const unsigned int x_tiles = (x_count + k_tile_size - 1) / k_tile_size;
+    const unsigned int z_tiles = (z_count + k_tile_size - 1) / k_tile_size;
+    const unsigned int total_tiles = x_tiles * z_tiles;
+
+    std::atomic<unsigned int> done_tiles{ 0 };
+    std::mutex progress_mutex;
+
+    // One task per tile, each tile owns a disjoint block of the buffer.
+    TaskGroup tiles(pool_);
+    for (unsigned int tile = 0; tile < total_tiles; ++tile) {
+        tiles.Run([&, tile]() {
+            const unsigned int x_begin = (tile % x_tiles) * k_tile_size;
+            const unsigned int z_begin = (tile / x_tiles) * k_tile_size;
+            const unsigned int x_end = std::min(x_begin + k_tile_size, x_count);
+            const unsigned int z_end = std::min(z_begin + k_tile_size, z_count);
+            for (unsigned int z = z_begin; z < z_end; ++z) {
+                float* row = raster.GetRow(z);
+                for (unsigned int x = x_begin; x < x_end; ++x) {
+                    // Positions come from the indices, so there is no drift from summing steps.
+                    const glm::vec3 position{ raster.GetPositionX(x), height, raster.GetPositionZ(z) };
+                    row[x] = cell(position);
+                }
+            }
+            if (progress_) {
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                progress_(++done_tiles, total_tiles);
+            }
+        });
+    }
+    tiles.Wait();
+}
+
+unsigned int CoverageEngine::GetCellCount(const float start, const float end, const float step)
+{
+    if (!(step > 0.0f) || end < start) return 0;
+    // Small slack so an end that is a multiple of the step is not lost to rounding.
+    return (unsigned int)std::floor((end - start) / step + 1e-4f) + 1;
+}
@@ -0,0 +1,38 @@
+#ifndef COVERAGE_ENGINE_H
+#define COVERAGE_ENGINE_H
+
+#include <functional>
+
+#include <glm/glm.hpp>
+
+class ThreadPool;
+class CoverageRaster;
+
+// Evaluates a function on every cell of a CoverageRaster. The raster is cut into square tiles
+// which are forked on the thread pool, idle workers steal tiles from busy ones. Every cell
+// writes its value straight into its own slot of the raster, so the cells never share state
+// and the output does not depend on the thread count.
+class CoverageEngine {
+public:
+	typedef std::function<float(const glm::vec3& position)> CellFunction;
+	typedef std::function<void(unsigned int done_tiles, unsigned int total_tiles)> ProgressFunction;
+
+	static constexpr unsigned int k_tile_size = 8; // cells per tile side
+
+	explicit CoverageEngine(ThreadPool& pool);
+
+	// Called after every finished tile, from whichever thread finished it (never concurrently).
+	void SetProgressFunction(ProgressFunction progress);
+
+	// The cell function gets the cell position at the given height. A NaN marks the cell invalid.
+	void Compute(float height, const CellFunction& cell, CoverageRaster& raster) const;
+
+	// Number of steps from start to end, both included.
+	static unsigned int GetCellCount(float start, float end, float step);
+
+private:
+	ThreadPool& pool_;
+	ProgressFunction progress_;
+};
+
+#endif // !COVERAGE_ENGINE_H
@@ -0,0 +1,57 @@
+#include "coverage_raster.hpp"
+
+#include <algorithm>
+
+CoverageRaster::CoverageRaster() : origin_x_(0.0f), origin_z_(0.0f),
+                                   x_step_(0.0f), z_step_(0.0f),
+                                   width_(0), height_(0)
+{
+}
+
+CoverageRaster::CoverageRaster(const float origin_x, const float origin_z,
+                               const float x_step, const float z_step,
+                               const unsigned int width, const unsigned int height) :
+    origin_x_(origin_x), origin_z_(origin_z),
+    x_step_(x_step), z_step_(z_step),
+    width_(width), height_(height),
+    values_((std::size_t)width * height, k_invalid)
+{
+}
+
+bool CoverageRaster::GetCell(const float position_x, const float position_z, unsigned int& x, unsigned int& z) const
+{
+    if (Empty()) return false;
+    const float cell_x = std::round((position_x - origin_x_) / x_step_);
+    const float cell_z = std::round((position_z - origin_z_) / z_step_);
+    // Written so NaN fails as well.
+    if (!(cell_x >= 0.0f && cell_x < (float)width_ && cell_z >= 0.0f && cell_z < (float)height_)) return false;
+    x = (unsigned int)cell_x;
+    z = (unsigned int)cell_z;
+    return true;
+}
+
+void CoverageRaster::Fill(const float value)
+{
+    std::fill(values_.begin(), values_.end(), value);
+}
+
+CoverageRasterView CoverageRaster::GetRegion(const unsigned int x, const unsigned int z,
+                                             const unsigned int width, const unsigned int height) const
+{
+    return CoverageRasterView(*this, x, z, width, height);
+}
+
+CoverageRasterView CoverageRaster::GetView() const
+{
+    return CoverageRasterView(*this, 0, 0, width_, height_);
+}
+
+CoverageRasterView::CoverageRasterView(const CoverageRaster& raster, const unsigned int x, const unsigned int z,
+                                       const unsigned int width, const unsigned int height) :
+    raster_(&raster),
+    x_(std::min(x, raster.GetWidth())),
+    z_(std::min(z, raster.GetHeight())),
+    width_(std::min(width, raster.GetWidth() - x_)),
+    height_(std::min(height, raster.GetHeight() - z_))
+{
+}
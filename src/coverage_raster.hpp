@@ -0,0 +1,88 @@
+#ifndef COVERAGE_RASTER_H
+#define COVERAGE_RASTER_H
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+class CoverageRasterView;
+
+// Regular grid of coverage values in the x-z plane, stored row-major (one row per z) in one
+// contiguous buffer. Cell (x, z) is at origin + (x * x_step, z * z_step). Cells without a value
+// (e.g. inside a building) hold NaN.
+class CoverageRaster {
+public:
+	static constexpr float k_invalid = std::numeric_limits<float>::quiet_NaN();
+
+	CoverageRaster();
+	CoverageRaster(float origin_x, float origin_z, float x_step, float z_step,
+	               unsigned int width, unsigned int height); // all cells start invalid
+
+	unsigned int GetWidth() const { return width_; } // cells along x
+	unsigned int GetHeight() const { return height_; } // cells along z
+	std::size_t Size() const { return values_.size(); }
+	bool Empty() const { return values_.empty(); }
+	float GetOriginX() const { return origin_x_; }
+	float GetOriginZ() const { return origin_z_; }
+	float GetStepX() const { return x_step_; }
+	float GetStepZ() const { return z_step_; }
+
+	float& At(unsigned int x, unsigned int z) { return values_[(std::size_t)z * width_ + x]; }
+	float At(unsigned int x, unsigned int z) const { return values_[(std::size_t)z * width_ + x]; }
+	float* GetRow(unsigned int z) { return values_.data() + (std::size_t)z * width_; }
+	const float* GetRow(unsigned int z) const { return values_.data() + (std::size_t)z * width_; }
+	float* GetData() { return values_.data(); }
+	const float* GetData() const { return values_.data(); }
+
+	float GetPositionX(unsigned int x) const { return origin_x_ + (float)x * x_step_; }
+	float GetPositionZ(unsigned int z) const { return origin_z_ + (float)z * z_step_; }
+	// Cell nearest to the position, false when the position is off the raster.
+	bool GetCell(float position_x, float position_z, unsigned int& x, unsigned int& z) const;
+
+	bool IsValid(unsigned int x, unsigned int z) const { return IsValidValue(At(x, z)); }
+	static bool IsValidValue(float value) { return !std::isnan(value); }
+
+	void Fill(float value);
+	// Sub-rectangle sharing this raster's storage, clipped to the raster.
+	CoverageRasterView GetRegion(unsigned int x, unsigned int z, unsigned int width, unsigned int height) const;
+	CoverageRasterView GetView() const;
+
+private:
+	float origin_x_;
+	float origin_z_;
+	float x_step_;
+	float z_step_;
+	unsigned int width_;
+	unsigned int height_;
+	std::vector<float> values_;
+};
+
+// Read-only window into a CoverageRaster. Indices are relative to the corner of the region.
+// Only valid while the raster it came from is alive and not resized.
+class CoverageRasterView {
+public:
+	CoverageRasterView(const CoverageRaster& raster, unsigned int x, unsigned int z,
+	                   unsigned int width, unsigned int height);
+
+	unsigned int GetWidth() const { return width_; }
+	unsigned int GetHeight() const { return height_; }
+	bool Empty() const { return width_ == 0 || height_ == 0; }
+
+	float At(unsigned int x, unsigned int z) const { return raster_->At(x_ + x, z_ + z); }
+	const float* GetRow(unsigned int z) const { return raster_->GetRow(z_ + z) + x_; }
+	bool IsValid(unsigned int x, unsigned int z) const { return CoverageRaster::IsValidValue(At(x, z)); }
+	float GetPositionX(unsigned int x) const { return raster_->GetPositionX(x_ + x); }
+	float GetPositionZ(unsigned int z) const { return raster_->GetPositionZ(z_ + z); }
+
+private:
+	const CoverageRaster* raster_;
+	unsigned int x_;
+	unsigned int z_;
+	unsigned int width_;
+	unsigned int height_;
+};
+
+#endif // !COVERAGE_RASTER_H
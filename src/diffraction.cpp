@@ -0,0 +1,160 @@
+#include "diffraction.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/vector_angle.hpp>
+
+namespace {
+    float GetDistanceOnXZ(const glm::vec3& a, const glm::vec3& b)
+    {
+        return glm::distance(glm::vec2(a.x, a.z), glm::vec2(b.x, b.z));
+    }
+}
+
+bool DiffractionKernel::Evaluate(const glm::vec3& tx_position, const glm::vec3& rx_position,
+                                 const glm::vec3* edges, const std::size_t edge_count, const float frequency,
+                                 const ThreeEdgeLoss three_edge_loss, DiffractionPath& path)
+{
+    Edges selected;
+    SelectEdges(tx_position, rx_position, edges, edge_count, frequency, selected);
+    if (selected.Empty()) return false;
+
+    path.edge_count = (unsigned int)selected.Size();
+    path.tx_edge = selected[0];
+    path.rx_edge = selected.Back();
+    path.length = glm::distance(tx_position, selected[0]);
+    for (std::size_t i = 1; i < selected.Size(); ++i) path.length += glm::distance(selected[i - 1], selected[i]);
+    path.length += glm::distance(selected.Back(), rx_position);
+
+    if (selected.Size() == 1) {
+        path.excess_loss = CalculateLossByV(CalculateV(tx_position, selected[0], rx_position, frequency));
+    } else if (selected.Size() == 2) {
+        const float v1 = CalculateV(tx_position, selected[0], rx_position, frequency);
+        const float v2 = CalculateV(tx_position, selected[1], rx_position, frequency);
+        path.excess_loss = CalculateLossByV(std::max(v1, v2));
+    } else {
+        float c1, c2, c3;
+        if (edge_count == 3 && three_edge_loss == ThreeEdgeLoss::kDirectPath) {
+            c1 = CalculateLossByV(CalculateV(tx_position, selected[0], rx_position, frequency));
+            c2 = CalculateLossByV(CalculateV(tx_position, selected[1], rx_position, frequency));
+            c3 = CalculateLossByV(CalculateV(tx_position, selected[2], rx_position, frequency));
+        } else {
+            // The middle edge over the whole path, the outer ones over their half.
+            c1 = CalculateLossByV(CalculateV(tx_position, selected[0], selected[1], frequency));
+            c2 = CalculateLossByV(CalculateV(tx_position, selected[1], rx_position, frequency));
+            c3 = CalculateLossByV(CalculateV(selected[1], selected[2], rx_position, frequency));
+        }
+        float first_cosine = 0.0f, second_cosine = 0.0f;
+        CalculateCorrectionCosines(tx_position, edges, edge_count, rx_position, first_cosine, second_cosine);
+        const float c_1_cap = (6.0f - c2 + c1) * first_cosine;
+        const float c_2_cap = (6.0f - c2 + c3) * second_cosine;
+        path.excess_loss = c2 + c1 + c3 - c_1_cap - c_2_cap;
+    }
+    return true;
+}
+
+void DiffractionKernel::SelectEdges(const glm::vec3& tx_position, const glm::vec3& rx_position,
+                                    const glm::vec3* edges, const std::size_t edge_count, const float frequency,
+                                    Edges& selected)
+{
+    selected.Clear();
+    if (edge_count <= k_max_edges) {
+        for (std::size_t i = 0; i < edge_count; ++i) selected.PushBack(edges[i]);
+    } else {
+        // Keep the largest distinct v in descending order as the edges stream by, the later edge
+        // of an equal v replaces the earlier one.
+        FixedVector<float, k_max_edges> largest_v;
+        for (std::size_t i = 0; i < edge_count; ++i) {
+            const float v = CalculateV(tx_position, edges[i], rx_position, frequency);
+            std::size_t position = 0;
+            while (position < largest_v.Size() && largest_v[position] > v) ++position;
+            if (position < largest_v.Size() && largest_v[position] == v) {
+                selected[position] = edges[i];
+                continue;
+            }
+            largest_v.Insert(position, v);
+            selected.Insert(position, edges[i]);
+        }
+    }
+    OrderEdges(tx_position, selected);
+}
+
+void DiffractionKernel::OrderEdges(const glm::vec3& tx_position, Edges& edges)
+{
+    // Selection sort along the chain, there are at most k_max_edges. A repeated edge drops out.
+    Edges ordered;
+    glm::vec3 point = tx_position;
+    for (;;) {
+        const std::size_t nearest = FindNearestEdge(point, edges.begin(), edges.Size(), ordered.begin(), ordered.Size());
+        if (nearest == edges.Size()) break;
+        point = edges[nearest];
+        ordered.PushBack(point);
+    }
+    edges = ordered;
+}
+
+std::size_t DiffractionKernel::FindNearestEdge(const glm::vec3& point, const glm::vec3* edges, const std::size_t edge_count,
+                                               const glm::vec3* skipped, const std::size_t skipped_count)
+{
+    std::size_t nearest = edge_count;
+    float nearest_distance = 0.0f;
+    for (std::size_t i = 0; i < edge_count; ++i) {
+        if (std::find(skipped, skipped + skipped_count, edges[i]) != skipped + skipped_count) continue;
+        const float distance = GetDistanceOnXZ(point, edges[i]);
+        if (nearest == edge_count || distance <= nearest_distance) {
+            nearest = i;
+            nearest_distance = distance;
+        }
+    }
+    return nearest;
+}
+
+float DiffractionKernel::CalculateV(const glm::vec3& start_position, const glm::vec3& edge_position,
+                                    const glm::vec3& end_position, const float frequency)
+{
+    float wave_length = 3e8 / (frequency);
+    glm::vec3 start_to_end_direction = glm::normalize(end_position - start_position);
+
+    glm::vec3 start_to_edge_direction = glm::normalize(edge_position - start_position);
+    glm::vec3 end_to_edge_direction = glm::normalize(edge_position - end_position);
+
+    float angle_1 = glm::angle(start_to_edge_direction, start_to_end_direction);
+    float angle_2 = glm::angle(end_to_edge_direction, -start_to_end_direction);
+    float r1 = glm::distance(start_position, edge_position);
+    float r2 = glm::distance(end_position, edge_position);
+    float s1 = r1 * cos(angle_1);
+    float s2 = r2 * cos(angle_2);
+    float h = sin(angle_1) * r1;
+    float v = h * sqrt((2.0f / wave_length) * (s1 + s2) / (r1 * r2));
+
+    return v;
+}
+
+float DiffractionKernel::CalculateLossByV(const float v)
+{
+    return 6.9f + 20.0 * log10(sqrt(pow(v - 0.1, 2) + 1) + v - 0.1);
+}
+
+bool DiffractionKernel::CalculateCorrectionCosines(const glm::vec3& start_position, const glm::vec3* edges,
+                                                   const std::size_t edge_count, const glm::vec3& end_position,
+                                                   float& first_cosine, float& second_cosine)
+{
+    glm::vec3 chain[k_max_edges];
+    glm::vec3 point = start_position;
+    for (std::size_t i = 0; i < k_max_edges; ++i) {
+        const std::size_t nearest = FindNearestEdge(point, edges, edge_count, chain, i);
+        if (nearest == edge_count) return false;
+        point = chain[i] = edges[nearest];
+    }
+
+    const float d1 = GetDistanceOnXZ(start_position, chain[0]);
+    const float d2 = GetDistanceOnXZ(chain[0], chain[1]);
+    const float d3 = GetDistanceOnXZ(chain[1], chain[2]);
+    const float d4 = GetDistanceOnXZ(chain[2], end_position);
+
+    first_cosine = sqrt((d1 * (d3 + d4)) / ((d1 + d2) * (d2 + d3 + d4)));
+    second_cosine = sqrt((d4 * (d1 + d2)) / ((d3 + d4) * (d1 + d2 + d3)));
+    return true;
+}
@@ -0,0 +1,64 @@
+#ifndef DIFFRACTION_H
+#define DIFFRACTION_H
+
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+#include "fixed_vector.hpp"
+
+// Knife-edge diffraction over up to three edges, the edges seen from the antennas and the
+// unfolded length of the path.
+struct DiffractionPath {
+	float excess_loss; // dB on top of the free space loss over the direct distance
+	float length; // transmitter, edges, receiver
+	glm::vec3 tx_edge; // edge the transmitter sees
+	glm::vec3 rx_edge; // edge the receiver sees
+	unsigned int edge_count;
+};
+
+// Diffraction loss of a knife-edge record, evaluated without heap allocation. The formulas are
+// the ones RayTracer used on a std::vector of the edges:
+//   1 edge: J(v) of the edge.
+//   2 edges: J of the larger v, both taken over the direct path.
+//   3 edges: three-edge method (ITU-R P.526), the losses taken as the ThreeEdgeLoss says.
+//   4 or more: the three edges with the largest v, three-edge method over their sub-paths.
+// The correction cosines of the three-edge method come from all edges of the record.
+class DiffractionKernel {
+public:
+	static constexpr std::size_t k_max_edges = 3;
+	typedef FixedVector<glm::vec3, k_max_edges> Edges;
+
+	// How the three losses of a record with exactly three edges are taken: every edge over the
+	// direct path (RayTracer::CalculateDiffraction) or the outer edges over their half of the
+	// path (RayTracer::CalculatePathLossMap).
+	enum class ThreeEdgeLoss {
+		kDirectPath,
+		kSubPaths
+	};
+
+	static bool Evaluate(const glm::vec3& tx_position, const glm::vec3& rx_position,
+	                     const glm::vec3* edges, std::size_t edge_count, float frequency,
+	                     ThreeEdgeLoss three_edge_loss, DiffractionPath& path);
+
+	// Up to k_max_edges edges, those with the largest v when there are more, in path order.
+	static void SelectEdges(const glm::vec3& tx_position, const glm::vec3& rx_position,
+	                        const glm::vec3* edges, std::size_t edge_count, float frequency, Edges& selected);
+	// Path order: the edge nearest to tx_position first, then the one nearest to it and so on.
+	static void OrderEdges(const glm::vec3& tx_position, Edges& edges);
+	// Index of the edge nearest to point on the xz plane, edge_count when there is none. Edges
+	// equal to one of the skipped ones are passed over; on a tie the later edge wins.
+	static std::size_t FindNearestEdge(const glm::vec3& point, const glm::vec3* edges, std::size_t edge_count,
+	                                   const glm::vec3* skipped, std::size_t skipped_count);
+
+	static float CalculateV(const glm::vec3& start_position, const glm::vec3& edge_position,
+	                        const glm::vec3& end_position, float frequency);
+	static float CalculateLossByV(float v);
+	// Correction cosines of the three-edge method, over the first three edges of the nearest edge
+	// chain from start_position. False when there are fewer than three distinct edges.
+	static bool CalculateCorrectionCosines(const glm::vec3& start_position, const glm::vec3* edges,
+	                                       std::size_t edge_count, const glm::vec3& end_position,
+	                                       float& first_cosine, float& second_cosine);
+};
+
+#endif // !DIFFRACTION_H
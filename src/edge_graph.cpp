@@ -0,0 +1,281 @@
+#include "edge_graph.hpp"
+
+#include "scene_file.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+    constexpr TriangleIndex k_no_triangle = (TriangleIndex)-1;
+    constexpr float k_min_horizontal_length = 0.001f; // vertical edges never cross a vertical plane
+
+    struct MeshEdge {
+        TriangleIndex first;
+        TriangleIndex second;
+        glm::vec3 start;
+        glm::vec3 end;
+    };
+
+    // Twice the signed area of a, b, c in the profile plane; positive when c is left of a->b.
+    float GetTurn(const glm::vec2& a, const glm::vec2& b, const glm::vec2& c)
+    {
+        return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    }
+}
+
+EdgeGraph::EdgeGraph() : origin_x_(0.0f), origin_z_(0.0f), width_(0), height_(0)
+{
+}
+
+void EdgeGraph::Build(const TriangleBuffer& triangles, const std::vector<std::uint32_t>& vertex_indices,
+                      const FacetSet& facets)
+{
+    Clear();
+    const TriangleIndex count = triangles.Size();
+    if (count == 0 || vertex_indices.size() < (std::size_t)count * 3) return;
+
+    // Pair up the triangles on each side of every mesh edge, in the order the edges first appear.
+    std::vector<MeshEdge> mesh_edges;
+    std::unordered_map<std::uint64_t, std::size_t> edge_of_key;
+    edge_of_key.reserve((std::size_t)count * 3);
+    for (TriangleIndex triangle = 0; triangle < count; ++triangle) {
+        for (unsigned int corner = 0; corner < 3; ++corner) {
+            std::uint64_t a = vertex_indices[(std::size_t)triangle * 3 + corner];
+            std::uint64_t b = vertex_indices[(std::size_t)triangle * 3 + (corner + 1) % 3];
+            if (a > b) std::swap(a, b);
+            const auto [found, is_new] = edge_of_key.emplace((a << 32) | b, mesh_edges.size());
+            if (is_new) {
+                mesh_edges.push_back(MeshEdge{ triangle, k_no_triangle, triangles.GetVertex(triangle, corner),
+                                               triangles.GetVertex(triangle, (corner + 1) % 3) });
+            } else if (mesh_edges[found->second].second == k_no_triangle) {
+                mesh_edges[found->second].second = triangle;
+            }
+        }
+    }
+
+    // Keep the open edges and every edge between two planes. The normals of the map are not
+    // consistently oriented, so telling convex wedges from concave ones is left to the upper hull
+    // of the path profile: a concave edge sits below the rims around it and drops out there.
+    const float max_cosine = std::cos(glm::radians(k_min_wedge_angle));
+    for (const auto& edge : mesh_edges) {
+        const glm::vec3 direction = edge.end - edge.start;
+        if (std::sqrt(direction.x * direction.x + direction.z * direction.z) < k_min_horizontal_length) continue;
+        if (edge.second != k_no_triangle) {
+            if (!facets.Empty() && facets.GetFacet(edge.first) == facets.GetFacet(edge.second)) continue;
+            const glm::vec3 first_normal = glm::normalize(triangles.GetNormal(edge.first));
+            const glm::vec3 second_normal = glm::normalize(triangles.GetNormal(edge.second));
+            if (!(std::abs(glm::dot(first_normal, second_normal)) < max_cosine)) continue;
+        }
+        starts_.push_back(edge.start);
+        ends_.push_back(edge.end);
+    }
+    BuildGrid();
+}
+
+void EdgeGraph::Clear()
+{
+    starts_.clear();
+    ends_.clear();
+    origin_x_ = origin_z_ = 0.0f;
+    width_ = height_ = 0;
+    first_edge_.clear();
+    cell_edges_.clear();
+}
+
+EdgeIndex EdgeGraph::Size() const
+{
+    return (EdgeIndex)starts_.size();
+}
+
+bool EdgeGraph::Empty() const
+{
+    return starts_.empty();
+}
+
+glm::vec3 EdgeGraph::GetStart(const EdgeIndex edge) const
+{
+    return starts_[edge];
+}
+
+glm::vec3 EdgeGraph::GetEnd(const EdgeIndex edge) const
+{
+    return ends_[edge];
+}
+
+bool EdgeGraph::GetKnifeEdges(const glm::vec3& start_position, const glm::vec3& end_position,
+                              std::vector<glm::vec3>& edges_points) const
+{
+    const glm::vec3 along_xz(end_position.x - start_position.x, 0.0f, end_position.z - start_position.z);
+    const float path_length = glm::length(along_xz);
+    if (Empty() || path_length < k_min_horizontal_length) return false;
+    const glm::vec3 direction = along_xz / path_length;
+    const glm::vec3 plane_normal(-direction.z, 0.0f, direction.x);
+
+    // Path profile: distance along the ground and height of every edge crossing the plane.
+    std::vector<EdgeIndex> candidates;
+    GetCandidates(start_position, end_position, candidates);
+    std::vector<glm::vec2> profile;
+    profile.reserve(candidates.size() + 2);
+    profile.emplace_back(0.0f, start_position.y);
+    for (auto edge : candidates) {
+        const float start_distance = glm::dot(plane_normal, starts_[edge] - start_position);
+        const float end_distance = glm::dot(plane_normal, ends_[edge] - start_position);
+        if ((start_distance > 0.0f && end_distance > 0.0f) || (start_distance < 0.0f && end_distance < 0.0f)) continue;
+        if (start_distance == end_distance) continue; // lies in the plane
+        const glm::vec3 crossing = starts_[edge] + (ends_[edge] - starts_[edge]) * (start_distance / (start_distance - end_distance));
+        const float distance = glm::dot(crossing - start_position, direction);
+        if (distance <= 0.0f || distance >= path_length) continue;
+        profile.emplace_back(distance, crossing.y);
+    }
+    profile.emplace_back(path_length, end_position.y);
+    std::sort(profile.begin() + 1, profile.end() - 1,
+              [](const glm::vec2& a, const glm::vec2& b) { return a.x < b.x || (a.x == b.x && a.y > b.y); });
+
+    // Upper hull, monotone chain; its inner corners lie above the line from start to end.
+    std::vector<glm::vec2> hull;
+    for (const auto& point : profile) {
+        while (hull.size() >= 2 && GetTurn(hull[hull.size() - 2], hull.back(), point) >= 0.0f) hull.pop_back();
+        hull.push_back(point);
+    }
+
+    const std::size_t first_new = edges_points.size();
+    for (std::size_t i = 1; i + 1 < hull.size(); ++i) {
+        const glm::vec3 edge_position(start_position.x + direction.x * hull[i].x, hull[i].y,
+                                      start_position.z + direction.z * hull[i].x);
+        if (edges_points.size() > first_new && glm::distance(edges_points.back(), edge_position) <= k_min_edge_spacing) {
+            edges_points.back() = (edges_points.back() + edge_position) / 2.0f;
+            continue;
+        }
+        edges_points.push_back(edge_position);
+    }
+    return edges_points.size() > first_new;
+}
+
+void EdgeGraph::BuildGrid()
+{
+    if (Empty()) return;
+    float min_x = starts_[0].x, max_x = starts_[0].x;
+    float min_z = starts_[0].z, max_z = starts_[0].z;
+    for (EdgeIndex edge = 0; edge < Size(); ++edge) {
+        min_x = std::min({ min_x, starts_[edge].x, ends_[edge].x });
+        max_x = std::max({ max_x, starts_[edge].x, ends_[edge].x });
+        min_z = std::min({ min_z, starts_[edge].z, ends_[edge].z });
+        max_z = std::max({ max_z, starts_[edge].z, ends_[edge].z });
+    }
+    origin_x_ = min_x;
+    origin_z_ = min_z;
+    width_ = (int)std::floor((max_x - min_x) / k_cell_size) + 1;
+    height_ = (int)std::floor((max_z - min_z) / k_cell_size) + 1;
+
+    // Every edge goes into the cells of its box, counted first and then filled.
+    const auto for_each_cell = [this](EdgeIndex edge, auto&& body) {
+        const int x0 = std::clamp((int)std::floor((std::min(starts_[edge].x, ends_[edge].x) - origin_x_) / k_cell_size), 0, width_ - 1);
+        const int x1 = std::clamp((int)std::floor((std::max(starts_[edge].x, ends_[edge].x) - origin_x_) / k_cell_size), 0, width_ - 1);
+        const int z0 = std::clamp((int)std::floor((std::min(starts_[edge].z, ends_[edge].z) - origin_z_) / k_cell_size), 0, height_ - 1);
+        const int z1 = std::clamp((int)std::floor((std::max(starts_[edge].z, ends_[edge].z) - origin_z_) / k_cell_size), 0, height_ - 1);
+        for (int z = z0; z <= z1; ++z)
+            for (int x = x0; x <= x1; ++x) body((std::size_t)z * width_ + x);
+    };
+    first_edge_.assign((std::size_t)width_ * height_ + 1, 0);
+    for (EdgeIndex edge = 0; edge < Size(); ++edge)
+        for_each_cell(edge, [this](std::size_t cell) { ++first_edge_[cell + 1]; });
+    for (std::size_t cell = 0; cell + 1 < first_edge_.size(); ++cell) first_edge_[cell + 1] += first_edge_[cell];
+    cell_edges_.resize(first_edge_.back());
+    std::vector<std::uint32_t> next(first_edge_.begin(), first_edge_.end() - 1);
+    for (EdgeIndex edge = 0; edge < Size(); ++edge)
+        for_each_cell(edge, [this, &next, edge](std::size_t cell) { cell_edges_[next[cell]++] = edge; });
+}
+
+void EdgeGraph::GetCandidates(const glm::vec3& start_position, const glm::vec3& end_position,
+                              std::vector<EdgeIndex>& candidates) const
+{
+    candidates.clear();
+    if (width_ == 0 || height_ == 0) return;
+
+    // Segment in cell units, clipped to the grid.
+    glm::vec2 from((start_position.x - origin_x_) / k_cell_size, (start_position.z - origin_z_) / k_cell_size);
+    glm::vec2 to((end_position.x - origin_x_) / k_cell_size, (end_position.z - origin_z_) / k_cell_size);
+    const glm::vec2 delta = to - from;
+    float t_start = 0.0f, t_end = 1.0f;
+    const float limits[2] = { (float)width_, (float)height_ };
+    for (int axis = 0; axis < 2; ++axis) {
+        if (delta[axis] == 0.0f) {
+            if (from[axis] < 0.0f || from[axis] > limits[axis]) return;
+            continue;
+        }
+        float t0 = (0.0f - from[axis]) / delta[axis];
+        float t1 = (limits[axis] - from[axis]) / delta[axis];
+        if (t0 > t1) std::swap(t0, t1);
+        t_start = std::max(t_start, t0);
+        t_end = std::min(t_end, t1);
+        if (t_start > t_end) return;
+    }
+    to = from + delta * t_end;
+    from = from + delta * t_start;
+
+    // Walk the cells the segment passes through.
+    int x = std::clamp((int)std::floor(from.x), 0, width_ - 1);
+    int z = std::clamp((int)std::floor(from.y), 0, height_ - 1);
+    const int last_x = std::clamp((int)std::floor(to.x), 0, width_ - 1);
+    const int last_z = std::clamp((int)std::floor(to.y), 0, height_ - 1);
+    const int step_x = delta.x > 0.0f ? 1 : -1;
+    const int step_z = delta.y > 0.0f ? 1 : -1;
+    const glm::vec2 walk = to - from;
+    const float delta_x = walk.x != 0.0f ? std::abs(1.0f / walk.x) : INFINITY;
+    const float delta_z = walk.y != 0.0f ? std::abs(1.0f / walk.y) : INFINITY;
+    float next_x = walk.x > 0.0f ? (x + 1 - from.x) * delta_x : walk.x < 0.0f ? (from.x - x) * delta_x : INFINITY;
+    float next_z = walk.y > 0.0f ? (z + 1 - from.y) * delta_z : walk.y < 0.0f ? (from.y - z) * delta_z : INFINITY;
+    for (int steps = 0; steps <= width_ + height_; ++steps) {
+        const std::size_t cell = (std::size_t)z * width_ + x;
+        candidates.insert(candidates.end(), cell_edges_.begin() + first_edge_[cell], cell_edges_.begin() + first_edge_[cell + 1]);
+        if (x == last_x && z == last_z) break;
+        if (next_x < next_z) {
+            x += step_x;
+            next_x += delta_x;
+        } else {
+            z += step_z;
+            next_z += delta_z;
+        }
+        if (x < 0 || x >= width_ || z < 0 || z >= height_) break;
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+}
+
+void EdgeGraph::Write(SceneWriter& writer) const
+{
+    writer.Write(starts_);
+    writer.Write(ends_);
+    writer.WriteValue(origin_x_);
+    writer.WriteValue(origin_z_);
+    writer.WriteValue(width_);
+    writer.WriteValue(height_);
+    writer.Write(first_edge_);
+    writer.Write(cell_edges_);
+}
+
+bool EdgeGraph::Read(SceneReader& reader)
+{
+    if (!reader.Read(starts_) || !reader.Read(ends_) || !reader.ReadValue(origin_x_) || !reader.ReadValue(origin_z_) ||
+        !reader.ReadValue(width_) || !reader.ReadValue(height_) || !reader.Read(first_edge_) || !reader.Read(cell_edges_))
+        return false;
+    if (starts_.empty()) return ends_.empty();
+    if (ends_.size() != starts_.size() || width_ <= 0 || height_ <= 0 ||
+        first_edge_.size() != (std::size_t)width_ * height_ + 1)
+        return false;
+
+    // The cell ranges must be ordered and every edge id inside starts_, GetCandidates doesn't check them.
+    // Const access only: a non-const one would copy the borrowed array.
+    const std::uint32_t* first_edge = first_edge_.data();
+    const EdgeIndex* cell_edges = cell_edges_.data();
+    const std::size_t cell_count = first_edge_.size() - 1;
+    if (first_edge[0] != 0 || first_edge[cell_count] != cell_edges_.size()) return false;
+    for (std::size_t cell = 0; cell < cell_count; ++cell)
+        if (first_edge[cell + 1] < first_edge[cell]) return false;
+    const EdgeIndex edge_count = Size();
+    for (std::size_t index = 0; index < cell_edges_.size(); ++index)
+        if (cell_edges[index] >= edge_count) return false;
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef EDGE_GRAPH_H
+#define EDGE_GRAPH_H
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mappable_vector.hpp"
+#include "triangle_buffer.hpp"
+#include "facet_set.hpp"
+
+typedef std::uint32_t EdgeIndex;
+
+// The edges of the map that can diffract: wedges between two facets (roof ridges, the rim of a
+// flat roof, building corners) and open edges with a single triangle. Built once at
+// load time, with a grid over the ground plane so a path only looks at the edges near it.
+//
+// Knife edges between two points are found where these edges cross the vertical plane through
+// both points: of all crossings, the ones on the upper convex hull of the path profile are the
+// edges a stretched string from start to end would rest on.
+class EdgeGraph {
+public:
+	static constexpr float k_cell_size = 16.0f; // meters, grid on the x-z plane
+	static constexpr float k_min_wedge_angle = 1.0f; // degrees between the facet normals of a wedge
+	static constexpr float k_min_edge_spacing = 0.5f; // meters, closer knife edges are merged
+
+	EdgeGraph();
+
+	// vertex_indices holds three vertex ids per triangle, as for FacetSet::Build.
+	void Build(const TriangleBuffer& triangles, const std::vector<std::uint32_t>& vertex_indices,
+	           const FacetSet& facets);
+	void Clear();
+
+	EdgeIndex Size() const;
+	bool Empty() const;
+	glm::vec3 GetStart(EdgeIndex edge) const;
+	glm::vec3 GetEnd(EdgeIndex edge) const;
+
+	// Knife edges over the path, ordered from start_position; false when no edge rises above it.
+	bool GetKnifeEdges(const glm::vec3& start_position, const glm::vec3& end_position,
+	                   std::vector<glm::vec3>& edges_points) const;
+
+	void Write(SceneWriter& writer) const;
+	bool Read(SceneReader& reader); // borrows the arrays from the scene file
+
+private:
+	void BuildGrid();
+	// Edges listed in the grid cells the x-z segment passes through, sorted and unique.
+	void GetCandidates(const glm::vec3& start_position, const glm::vec3& end_position,
+	                   std::vector<EdgeIndex>& candidates) const;
+
+	MappableVector<glm::vec3> starts_;
+	MappableVector<glm::vec3> ends_;
+
+	// Grid cells in rows of constant z, each a range of cell_edges_.
+	float origin_x_, origin_z_;
+	int width_, height_;
+	MappableVector<std::uint32_t> first_edge_; // width_ * height_ + 1 entries
+	MappableVector<EdgeIndex> cell_edges_;
+};
+
+#endif // !EDGE_GRAPH_H
@@ -1,7 +1,7 @@
 #include "engine.hpp"
 
-#include <thread>
 #include <map>
+#include <charconv>
 #include <iostream>
 #include <utility>
 
@@ -26,6 +26,15 @@
 
 #include "printer.hpp"
 #include "record.hpp"
+#include "thread_pool.hpp"
+#include "coverage_engine.hpp"
+#include "coverage_raster.hpp"
+#include "image_source_table.hpp"
+
+namespace {
+    // What the map dump and the client use for a cell without coverage.
+    constexpr float k_no_coverage_value = -200.0f;
+}
 
 unsigned int Engine::global_engine_id_ = 0;
 
@@ -408,11 +417,14 @@ void Engine::ExecuteQuestion(ip::tcp::socket& socket, boost::system::error_code&
 				std::to_string(transmitters_[station_id]->GetReceivers().size()) + ".csv";
 			std::ofstream output_file{ "../assets/" + file_name };
 			if (output_file.is_open()) {
-				for (auto& [position, avg_pl] : q_map) {
-					output_file << position.first << ", "
-						<< position.second << ", "
-						<< std::scientific << avg_pl << "\n";
-				}
+				// Same x-major order and -200 marker as the transfer below.
+				for (unsigned int x = 0; x < q_map.GetWidth(); ++x)
+					for (unsigned int z = 0; z < q_map.GetHeight(); ++z) {
+						const float avg_pl = q_map.At(x, z);
+						output_file << q_map.GetPositionX(x) << ", "
+							<< q_map.GetPositionZ(z) << ", "
+							<< std::scientific << (CoverageRaster::IsValidValue(avg_pl) ? avg_pl : k_no_coverage_value) << "\n";
+					}
 				output_file.close();
 			}
 			else {
@@ -420,7 +432,7 @@ void Engine::ExecuteQuestion(ip::tcp::socket& socket, boost::system::error_code&
 			}
 		}
 
-        if (q_map.empty())
+        if (q_map.Empty())
             boost::asio::write(socket, boost::asio::buffer("fai"), ign_err);
         else
             boost::asio::write(socket, boost::asio::buffer("suc"), ign_err);
@@ -434,19 +446,22 @@ void Engine::ExecuteQuestion(ip::tcp::socket& socket, boost::system::error_code&
 		}
         // Send the head of information.
 
-		for (auto& [position, avg_pl] : q_map) {
-			std::stringstream data_stream;
-			data_stream << position.first << ","
-				<< position.second << ","
-				<< std::scientific << avg_pl;
-			boost::asio::write(socket, boost::asio::buffer(data_stream.str()), ign_err);
-			len = socket.read_some(boost::asio::buffer(data_buffer), ign_err);
-			rec_data = std::string(data_buffer.begin(), data_buffer.begin() + len);
-			if (rec_data != "ok") {
-				std::cout << "Communication Error.\n";
-				return;
+		// Cells go out x-major, invalid cells as -200 as the client expects.
+		for (unsigned int x = 0; x < q_map.GetWidth(); ++x)
+			for (unsigned int z = 0; z < q_map.GetHeight(); ++z) {
+				const float avg_pl = q_map.At(x, z);
+				std::stringstream data_stream;
+				data_stream << q_map.GetPositionX(x) << ","
+					<< q_map.GetPositionZ(z) << ","
+					<< std::scientific << (CoverageRaster::IsValidValue(avg_pl) ? avg_pl : k_no_coverage_value);
+				boost::asio::write(socket, boost::asio::buffer(data_stream.str()), ign_err);
+				len = socket.read_some(boost::asio::buffer(data_buffer), ign_err);
+				rec_data = std::string(data_buffer.begin(), data_buffer.begin() + len);
+				if (rec_data != "ok") {
+					std::cout << "Communication Error.\n";
+					return;
+				}
 			}
-		}
 
 		boost::asio::write(socket, boost::asio::buffer("end"), ign_err);
 
@@ -503,6 +518,23 @@ void Engine::ExecuteQuestion(ip::tcp::socket& socket, boost::system::error_code&
 		std::vector<std::string> split_inputs;
 		boost::split(split_inputs, question, boost::is_any_of(":"));
 
+		// Optional fourth field, after the two positions: the highest reflection order to look for, 1 up to RayTracer::k_max_reflection_order.
+		if (split_inputs.size() < 3) {
+			boost::asio::write(socket, boost::asio::buffer("fai"), ign_err);
+			break;
+		}
+		unsigned int max_reflection_order = 1;
+		if (split_inputs.size() > 3) {
+			const std::string& order_string = split_inputs[3];
+			const char* order_end = order_string.data() + order_string.size();
+			const auto [end, error] = std::from_chars(order_string.data(), order_end, max_reflection_order);
+			if (error != std::errc() || end != order_end || max_reflection_order < 1 ||
+				max_reflection_order > RayTracer::k_max_reflection_order) {
+				boost::asio::write(socket, boost::asio::buffer("fai"), ign_err);
+				break;
+			}
+		}
+
 		std::vector<std::string> split_data;
 		// Get location from input string
 		std::string location1_string = split_inputs[1];
@@ -517,7 +549,7 @@ void Engine::ExecuteQuestion(ip::tcp::socket& socket, boost::system::error_code&
 		glm::vec3 position2 = glm::vec3(std::stof(split_data[0]),
 			std::stof(split_data[1]),
 			std::stof(split_data[2]));
-		std::string answer = "a:" + GetPossiblePath(position1, position2);
+		std::string answer = "a:" + GetPossiblePath(position1, position2, max_reflection_order);
 		boost::asio::write(socket, boost::asio::buffer(answer), ign_err);
 		}
 		break;
@@ -717,7 +749,7 @@ void Engine::LoadComponents()
 
 void Engine::LoadMap()
 {
-	// Load the map from .obj file
+	// Load the map from .obj file, or from its compiled scene (WCSim compile) while that is up to date
 	map_ = new PolygonMesh("../assets/obj/poznan-best.obj", default_shader_, window_ != nullptr);
 }
 
@@ -1026,17 +1058,17 @@ void Engine::OnKeys()
 
 
 
-void Engine::ComputeMap( const glm::vec3  tx_position, const float tx_frequency,
-                       std::vector<glm::vec3> * rx_positions,
-						std::map<std::pair<float, float>, float>& map) const {
+float Engine::ComputeMap( const glm::vec3  tx_position, const float tx_frequency,
+                        const std::vector<ImageSourceTable> & rx_images) const {
     float avg_total_loss = 0.0f;
     int n_users = 0;
 
-    for(auto & rx_position: *rx_positions){
+    for(auto & rx_image: rx_images){
+        const glm::vec3 rx_position = rx_image.GetSource();
 		std::vector<Record> records;
 		Result result;
 
-        ray_tracer_->TraceMap(tx_position,  rx_position, records);
+        ray_tracer_->TraceMap(tx_position,  rx_image, records);
         if(ray_tracer_->CalculatePathLossMap(tx_position, tx_frequency,
                                              rx_position, records, result)){
             ++n_users;
@@ -1046,20 +1078,19 @@ void Engine::ComputeMap( const glm::vec3  tx_position, const float tx_frequency,
     // Summary
     if(n_users == 0){
         // In the case of base station is inside the building.
-		map.insert({ std::make_pair(tx_position.x, tx_position.z), -200.0f });
-	}
-	else {
-		// average the total loss and store to the map.
-		map.insert({ std::make_pair(tx_position.x, tx_position.z), avg_total_loss / (float)n_users });
+        return CoverageRaster::k_invalid;
     }
+    // average the total loss.
+    return avg_total_loss / (float)n_users;
 }
 
-std::string Engine::GetPossiblePath(glm::vec3 start_position, glm::vec3 end_position) const
+std::string Engine::GetPossiblePath(glm::vec3 start_position, glm::vec3 end_position,
+                                    unsigned int max_reflection_order) const
 {
 	std::stringstream result;
 	result.precision(8);
 	std::vector<Record> records;
-	ray_tracer_->Trace(start_position, end_position, records);
+	ray_tracer_->Trace(start_position, end_position, records, max_reflection_order);
 	for (Record& record : records) {
 		switch (record.type) {
 		case RecordType::kDirect: {
@@ -1074,6 +1105,16 @@ std::string Engine::GetPossiblePath(glm::vec3 start_position, glm::vec3 end_posi
 			}
 			result << ":";
 		} break;
+		case RecordType::kMultipleReflect: {
+			// Bounce points of one path, in order.
+			result << "mre";
+			for (glm::vec3 position : record.data) {
+				result << std::scientific << position.x << ","
+					<< std::scientific << position.y << ","
+					<< std::scientific << position.z;
+			}
+			result << ":";
+		} break;
 		case RecordType::kEdgeDiffraction: {
 			result << "dif";
 			for (glm::vec3 position : record.data) {
@@ -1088,10 +1129,8 @@ std::string Engine::GetPossiblePath(glm::vec3 start_position, glm::vec3 end_posi
 	return result.str();
 }
 
-std::map<std::pair<float, float>, float> Engine::GetStationMap(unsigned int station_id,
-                                                              float x_step, float z_step) {
-    std::map<std::pair<float, float>, float> q_map;
-    if (transmitters_.find(station_id) == transmitters_.end()) return q_map;
+CoverageRaster Engine::GetStationMap(unsigned int station_id, float x_step, float z_step) {
+    if (transmitters_.find(station_id) == transmitters_.end()) return CoverageRaster();
     Transmitter * tx = transmitters_.find(station_id)->second;
     float tx_frequency = tx->GetFrequency();
     float tx_height = tx->GetTransform().position.y;
@@ -1099,34 +1138,29 @@ std::map<std::pair<float, float>, float> Engine::GetStationMap(unsigned int stat
     /// Get the order for image.
     float x_start, z_start, x_end, z_end;
     ray_tracer_->GetMapBorder(x_start, x_end, z_start, z_end);
-    auto * rx_positions = new std::vector<glm::vec3>;
-    for(auto [id, rx]: tx->GetReceivers()) rx_positions->push_back(rx->GetPosition());
-
-    std::vector<std::thread> threads;
-    //unsigned int threads_limit = std::thread::hardware_concurrency()*100;
-
-	unsigned int threads_limit = 500;
-
-    for(float x = x_start; x <= x_end; x+=x_step) {
-        for (float z = z_start; z <= z_end; z += z_step) {
-            const glm::vec3 position{x, tx_height, z};
-            std::thread map_thread(&Engine::ComputeMap, this,
-                                   position, tx_frequency ,rx_positions,
-                                   std::ref(q_map));
-            threads.push_back(std::move(map_thread));
-
-            if(threads.size() == threads_limit){
-                for(auto & thread:threads) thread.join();
-                threads.clear();
-				std::cout << "Server: threads done" << std::endl;
-            }
-        }
-
+    // The receivers stay put while the station sweeps the map, so their images are built once.
+    std::vector<ImageSourceTable> rx_images;
+    for(auto [id, rx]: tx->GetReceivers()) {
+        rx_images.emplace_back();
+        ray_tracer_->ComputeImageSources(rx->GetPosition(), rx_images.back());
     }
-    // Join threads
-    for(auto & thread:threads) thread.join();
-    threads.clear();
-	std::cout << "Server: threads done" << std::endl;
+
+    CoverageRaster q_map(x_start, z_start, x_step, z_step,
+                         CoverageEngine::GetCellCount(x_start, x_end, x_step),
+                         CoverageEngine::GetCellCount(z_start, z_end, z_step));
+
+    // Tiles run on the thread pool, every cell writes its own slot of values.
+    CoverageEngine coverage(ThreadPool::GetInstance());
+    unsigned int reported_percent = 0;
+    coverage.SetProgressFunction([&reported_percent](unsigned int done_tiles, unsigned int total_tiles) {
+        const unsigned int percent = done_tiles * 100 / total_tiles;
+        if (percent / 10 == reported_percent / 10 && done_tiles != total_tiles) return;
+        reported_percent = percent;
+        std::cout << "Server: coverage " << percent << "% (" << done_tiles << "/" << total_tiles << " tiles)" << std::endl;
+    });
+    coverage.Compute(tx_height,
+                     [&](const glm::vec3 & position) { return ComputeMap(position, tx_frequency, rx_images); },
+                     q_map);
     return q_map;
 }
 
@@ -24,6 +24,8 @@ class RadiationPattern;
 class Communicator;
 class Recorder;
 class ConsoleController;
+class CoverageRaster;
+class ImageSourceTable;
 
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
@@ -67,11 +69,11 @@ class Engine{
         std::string GetTransmitterInfo(unsigned int transmitter_id);
         std::string GetReceiversList() const;
         std::string GetReceiverInfo(unsigned int receiver_id);
-        std::map<std::pair<float, float>, float>  GetStationMap(unsigned int station_id, float x_step, float z_step);
-        void ComputeMap(glm::vec3 tx_positions, float tx_frequency,
-                        std::vector<glm::vec3> * rx_positions,
-                        std::map<std::pair<float, float>, float> & map) const;
-        std::string GetPossiblePath(glm::vec3 start_position, glm::vec3 end_position) const;
+        CoverageRaster GetStationMap(unsigned int station_id, float x_step, float z_step);
+        float ComputeMap(glm::vec3 tx_positions, float tx_frequency,
+                         const std::vector<ImageSourceTable> & rx_images) const;
+        std::string GetPossiblePath(glm::vec3 start_position, glm::vec3 end_position,
+                                    unsigned int max_reflection_order = 1) const;
 
 
 
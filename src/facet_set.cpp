@@ -0,0 +1,248 @@
+#include "facet_set.hpp"
+
+#include "scene_file.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+    // Disjoint sets of triangles, union by size with path halving.
+    class UnionFind {
+    public:
+        explicit UnionFind(TriangleIndex count) : parent_(count), size_(count, 1)
+        {
+            for (TriangleIndex i = 0; i < count; ++i) parent_[i] = i;
+        }
+        TriangleIndex Find(TriangleIndex index)
+        {
+            while (parent_[index] != index) {
+                parent_[index] = parent_[parent_[index]];
+                index = parent_[index];
+            }
+            return index;
+        }
+        void Unite(TriangleIndex first, TriangleIndex second)
+        {
+            if (size_[first] < size_[second]) std::swap(first, second);
+            parent_[second] = first;
+            size_[first] += size_[second];
+        }
+    private:
+        std::vector<TriangleIndex> parent_;
+        std::vector<TriangleIndex> size_;
+    };
+
+    glm::vec3 GetGeometricNormal(const TriangleBuffer& triangles, TriangleIndex index)
+    {
+        return glm::normalize(glm::cross(triangles.GetEdge1(index), triangles.GetEdge2(index)));
+    }
+
+    float GetPlaneDistance(const glm::vec3& normal, const glm::vec3& origin, const glm::vec3& point)
+    {
+        return std::abs(glm::dot(normal, point - origin));
+    }
+
+    // The roots stand for their sets: the normals must agree and every corner of each triangle
+    // must lie on the plane of the other root. NaN normals (degenerate triangles) never merge.
+    bool IsCoplanar(const TriangleBuffer& triangles, TriangleIndex first, TriangleIndex second,
+                    TriangleIndex first_root, TriangleIndex second_root)
+    {
+        const float min_cosine = std::cos(glm::radians(FacetSet::k_max_normal_angle));
+        const glm::vec3 first_normal = GetGeometricNormal(triangles, first_root);
+        const glm::vec3 second_normal = GetGeometricNormal(triangles, second_root);
+        if (!(std::abs(glm::dot(first_normal, second_normal)) >= min_cosine)) return false;
+        const glm::vec3 first_origin = triangles.GetV0(first_root);
+        const glm::vec3 second_origin = triangles.GetV0(second_root);
+        for (unsigned int corner = 0; corner < 3; ++corner) {
+            if (!(GetPlaneDistance(first_normal, first_origin, triangles.GetVertex(second, corner)) <= FacetSet::k_max_plane_distance))
+                return false;
+            if (!(GetPlaneDistance(second_normal, second_origin, triangles.GetVertex(first, corner)) <= FacetSet::k_max_plane_distance))
+                return false;
+        }
+        return true;
+    }
+}
+
+FacetSet::FacetSet()
+{
+}
+
+void FacetSet::Build(const TriangleBuffer& triangles, const std::vector<std::uint32_t>& vertex_indices)
+{
+    Clear();
+    const TriangleIndex count = triangles.Size();
+    if (count == 0 || vertex_indices.size() < (std::size_t)count * 3) return;
+
+    // Join every pair of coplanar triangles that share an edge.
+    UnionFind sets(count);
+    std::unordered_map<std::uint64_t, TriangleIndex> edge_owners;
+    edge_owners.reserve((std::size_t)count * 3);
+    for (TriangleIndex triangle = 0; triangle < count; ++triangle) {
+        for (unsigned int corner = 0; corner < 3; ++corner) {
+            std::uint64_t a = vertex_indices[(std::size_t)triangle * 3 + corner];
+            std::uint64_t b = vertex_indices[(std::size_t)triangle * 3 + (corner + 1) % 3];
+            if (a > b) std::swap(a, b);
+            const auto [owner, is_new] = edge_owners.emplace((a << 32) | b, triangle);
+            if (is_new) continue;
+            const TriangleIndex neighbour = owner->second;
+            const TriangleIndex triangle_root = sets.Find(triangle);
+            const TriangleIndex neighbour_root = sets.Find(neighbour);
+            if (triangle_root == neighbour_root) continue;
+            if (IsCoplanar(triangles, triangle, neighbour, triangle_root, neighbour_root))
+                sets.Unite(triangle_root, neighbour_root);
+        }
+    }
+
+    // Number the facets in the order of their lowest triangle.
+    std::vector<FacetIndex> facet_of_root(count, (FacetIndex)-1);
+    facet_of_triangle_.resize(count);
+    FacetIndex facet_count = 0;
+    for (TriangleIndex triangle = 0; triangle < count; ++triangle) {
+        const TriangleIndex root = sets.Find(triangle);
+        if (facet_of_root[root] == (FacetIndex)-1) facet_of_root[root] = facet_count++;
+        facet_of_triangle_[triangle] = facet_of_root[root];
+    }
+
+    // Counting sort of the triangles by facet.
+    first_triangle_.assign((std::size_t)facet_count + 1, 0);
+    for (TriangleIndex triangle = 0; triangle < count; ++triangle) ++first_triangle_[facet_of_triangle_[triangle] + 1];
+    for (FacetIndex facet = 0; facet < facet_count; ++facet) first_triangle_[facet + 1] += first_triangle_[facet];
+    triangles_.resize(count);
+    std::vector<TriangleIndex> next(first_triangle_.begin(), first_triangle_.end() - 1);
+    for (TriangleIndex triangle = 0; triangle < count; ++triangle) triangles_[next[facet_of_triangle_[triangle]]++] = triangle;
+
+    // Plane of each facet: area-weighted normal, turned the way of its first triangle.
+    normals_.resize(facet_count);
+    plane_offsets_.resize(facet_count);
+    bounding_centers_.resize(facet_count);
+    bounding_radii_.resize(facet_count);
+    for (FacetIndex facet = 0; facet < facet_count; ++facet) {
+        const TriangleIndex* facet_triangles = GetTriangles(facet);
+        const glm::vec3 reference = glm::cross(triangles.GetEdge1(facet_triangles[0]), triangles.GetEdge2(facet_triangles[0]));
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+        glm::vec3 centroid(0.0f);
+        for (TriangleIndex i = 0; i < GetTriangleCount(facet); ++i) {
+            const glm::vec3 twice_area_normal = glm::cross(triangles.GetEdge1(facet_triangles[i]), triangles.GetEdge2(facet_triangles[i]));
+            const float triangle_area = glm::length(twice_area_normal);
+            normal += glm::dot(twice_area_normal, reference) < 0.0f ? -twice_area_normal : twice_area_normal;
+            centroid += triangles.GetCentroid(facet_triangles[i]) * triangle_area;
+            area += triangle_area;
+        }
+        normals_[facet] = glm::normalize(normal);
+        plane_offsets_[facet] = area > 0.0f ? glm::dot(normals_[facet], centroid / area)
+                                            : glm::dot(normals_[facet], triangles.GetV0(facet_triangles[0]));
+
+        // Bounding sphere around the middle of the corner box.
+        glm::vec3 min_corner = triangles.GetV0(facet_triangles[0]);
+        glm::vec3 max_corner = min_corner;
+        for (TriangleIndex i = 0; i < GetTriangleCount(facet); ++i)
+            for (unsigned int corner = 0; corner < 3; ++corner) {
+                min_corner = glm::min(min_corner, triangles.GetVertex(facet_triangles[i], corner));
+                max_corner = glm::max(max_corner, triangles.GetVertex(facet_triangles[i], corner));
+            }
+        bounding_centers_[facet] = (min_corner + max_corner) * 0.5f;
+        float radius = 0.0f;
+        for (TriangleIndex i = 0; i < GetTriangleCount(facet); ++i)
+            for (unsigned int corner = 0; corner < 3; ++corner)
+                radius = std::max(radius, glm::distance(bounding_centers_[facet], triangles.GetVertex(facet_triangles[i], corner)));
+        bounding_radii_[facet] = radius;
+    }
+}
+
+void FacetSet::Clear()
+{
+    facet_of_triangle_.clear();
+    first_triangle_.clear();
+    triangles_.clear();
+    normals_.clear();
+    plane_offsets_.clear();
+    bounding_centers_.clear();
+    bounding_radii_.clear();
+}
+
+FacetIndex FacetSet::Size() const
+{
+    return (FacetIndex)normals_.size();
+}
+
+bool FacetSet::Empty() const
+{
+    return normals_.empty();
+}
+
+FacetIndex FacetSet::GetFacet(const TriangleIndex triangle) const
+{
+    return facet_of_triangle_[triangle];
+}
+
+TriangleIndex FacetSet::GetTriangleCount(const FacetIndex facet) const
+{
+    return first_triangle_[facet + 1] - first_triangle_[facet];
+}
+
+const TriangleIndex* FacetSet::GetTriangles(const FacetIndex facet) const
+{
+    return triangles_.data() + first_triangle_[facet];
+}
+
+glm::vec3 FacetSet::GetNormal(const FacetIndex facet) const
+{
+    return normals_[facet];
+}
+
+float FacetSet::GetPlaneOffset(const FacetIndex facet) const
+{
+    return plane_offsets_[facet];
+}
+
+glm::vec3 FacetSet::GetBoundingCenter(const FacetIndex facet) const
+{
+    return bounding_centers_[facet];
+}
+
+float FacetSet::GetBoundingRadius(const FacetIndex facet) const
+{
+    return bounding_radii_[facet];
+}
+
+void FacetSet::Write(SceneWriter& writer) const
+{
+    writer.Write(facet_of_triangle_);
+    writer.Write(first_triangle_);
+    writer.Write(triangles_);
+    writer.Write(normals_);
+    writer.Write(plane_offsets_);
+    writer.Write(bounding_centers_);
+    writer.Write(bounding_radii_);
+}
+
+bool FacetSet::Read(SceneReader& reader, const TriangleIndex triangle_count)
+{
+    if (!reader.Read(facet_of_triangle_) || !reader.Read(first_triangle_) || !reader.Read(triangles_) ||
+        !reader.Read(normals_) || !reader.Read(plane_offsets_) || !reader.Read(bounding_centers_) ||
+        !reader.Read(bounding_radii_))
+        return false;
+    const std::size_t facet_count = normals_.size();
+    if (facet_count == 0)
+        return facet_of_triangle_.empty() && first_triangle_.empty() && triangles_.empty() &&
+               plane_offsets_.empty() && bounding_centers_.empty() && bounding_radii_.empty();
+    if (facet_of_triangle_.size() != triangle_count || triangles_.size() != triangle_count ||
+        first_triangle_.size() != facet_count + 1 || plane_offsets_.size() != facet_count ||
+        bounding_centers_.size() != facet_count || bounding_radii_.size() != facet_count)
+        return false;
+
+    // Every id must stay inside its array, the lookups don't check them.
+    // Const access only: a non-const one would copy the borrowed array.
+    const FacetIndex* facet_of_triangle = facet_of_triangle_.data();
+    const TriangleIndex* first_triangle = first_triangle_.data();
+    const TriangleIndex* triangles = triangles_.data();
+    for (TriangleIndex triangle = 0; triangle < triangle_count; ++triangle)
+        if (facet_of_triangle[triangle] >= facet_count || triangles[triangle] >= triangle_count) return false;
+    if (first_triangle[0] != 0 || first_triangle[facet_count] != triangle_count) return false;
+    for (std::size_t facet = 0; facet < facet_count; ++facet)
+        if (first_triangle[facet + 1] < first_triangle[facet]) return false;
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef FACET_SET_H
+#define FACET_SET_H
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mappable_vector.hpp"
+#include "triangle_buffer.hpp"
+
+typedef std::uint32_t FacetIndex;
+
+// Groups of coplanar, edge-connected triangles of the map, e.g. the two or more triangles a
+// building wall is exported as. A facet acts as one mirror: a specular point lies in exactly
+// one of its triangles, so tracing per facet gives one reflection per wall instead of one per
+// triangle. Built once at load time with a union-find over the shared edges.
+class FacetSet {
+public:
+	static constexpr float k_max_normal_angle = 0.5f; // degrees between merged triangles
+	static constexpr float k_max_plane_distance = 0.01f; // meters from the plane of the facet
+
+	FacetSet();
+
+	// vertex_indices holds three vertex ids per triangle; edges are matched on these ids.
+	void Build(const TriangleBuffer& triangles, const std::vector<std::uint32_t>& vertex_indices);
+	void Clear();
+
+	FacetIndex Size() const;
+	bool Empty() const;
+	FacetIndex GetFacet(TriangleIndex triangle) const;
+	TriangleIndex GetTriangleCount(FacetIndex facet) const;
+	const TriangleIndex* GetTriangles(FacetIndex facet) const; // in ascending order
+	glm::vec3 GetNormal(FacetIndex facet) const; // unit, area-weighted over the triangles
+	float GetPlaneOffset(FacetIndex facet) const; // n . x = offset
+	glm::vec3 GetBoundingCenter(FacetIndex facet) const; // sphere around all corners
+	float GetBoundingRadius(FacetIndex facet) const;
+
+	void Write(SceneWriter& writer) const;
+	bool Read(SceneReader& reader, TriangleIndex triangle_count); // borrows the arrays from the scene file
+
+private:
+	MappableVector<FacetIndex> facet_of_triangle_;
+	MappableVector<TriangleIndex> first_triangle_; // Size() + 1 entries into triangles_
+	MappableVector<TriangleIndex> triangles_;
+	MappableVector<glm::vec3> normals_;
+	MappableVector<float> plane_offsets_;
+	MappableVector<glm::vec3> bounding_centers_;
+	MappableVector<float> bounding_radii_;
+};
+
+#endif // !FACET_SET_H
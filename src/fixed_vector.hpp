@@ -0,0 +1,52 @@
+#ifndef FIXED_VECTOR_H
+#define FIXED_VECTOR_H
+
+#include <array>
+#include <cstddef>
+
+// Vector with its storage inline and a capacity fixed at compile time, for small per-call lists
+// in hot paths that must not touch the heap. Adding to a full vector is refused.
+template<typename T, std::size_t N>
+class FixedVector {
+public:
+	FixedVector() : size_(0) {}
+
+	std::size_t Size() const { return size_; }
+	bool Empty() const { return size_ == 0; }
+	bool IsFull() const { return size_ == N; }
+	static constexpr std::size_t Capacity() { return N; }
+
+	bool PushBack(const T& value)
+	{
+		if (size_ == N) return false;
+		data_[size_++] = value;
+		return true;
+	}
+	// Inserts before index; when full the last element falls off (or value, if it would be last).
+	void Insert(std::size_t index, const T& value)
+	{
+		if (index >= N) return;
+		const std::size_t last = size_ < N ? size_ : N - 1;
+		for (std::size_t i = last; i > index; --i) data_[i] = data_[i - 1];
+		data_[index] = value;
+		if (size_ < N) ++size_;
+	}
+	void PopBack() { if (size_ > 0) --size_; }
+	void Clear() { size_ = 0; }
+
+	T& operator[](std::size_t index) { return data_[index]; }
+	const T& operator[](std::size_t index) const { return data_[index]; }
+	T& Back() { return data_[size_ - 1]; }
+	const T& Back() const { return data_[size_ - 1]; }
+
+	T* begin() { return data_.data(); }
+	T* end() { return data_.data() + size_; }
+	const T* begin() const { return data_.data(); }
+	const T* end() const { return data_.data() + size_; }
+
+private:
+	std::array<T, N> data_;
+	std::size_t size_;
+};
+
+#endif // !FIXED_VECTOR_H
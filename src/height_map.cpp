@@ -0,0 +1,261 @@
+#include "height_map.hpp"
+
+#include "scene_file.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace {
+    constexpr float k_no_height = -FLT_MAX;
+
+    // Sutherland-Hodgman against one side of the cell; inside gives the signed distance into the cell.
+    template<typename Inside>
+    void ClipPolygon(std::vector<glm::vec3>& polygon, std::vector<glm::vec3>& clipped, Inside&& inside)
+    {
+        clipped.clear();
+        for (std::size_t i = 0; i < polygon.size(); ++i) {
+            const glm::vec3& current = polygon[i];
+            const glm::vec3& next = polygon[(i + 1) % polygon.size()];
+            const float current_inside = inside(current);
+            const float next_inside = inside(next);
+            if (current_inside >= 0.0f) clipped.push_back(current);
+            if ((current_inside >= 0.0f) != (next_inside >= 0.0f))
+                clipped.push_back(current + (next - current) * (current_inside / (current_inside - next_inside)));
+        }
+        polygon.swap(clipped);
+    }
+
+    // Twice the signed area of a, b, c in the profile plane; positive when c is left of a->b.
+    float GetTurn(const glm::vec2& a, const glm::vec2& b, const glm::vec2& c)
+    {
+        return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    }
+}
+
+HeightMap::HeightMap() : origin_x_(0.0f), origin_z_(0.0f), cell_size_(k_default_cell_size), width_(0), height_(0)
+{
+}
+
+void HeightMap::Build(const TriangleBuffer& triangles, const float cell_size)
+{
+    Clear();
+    if (triangles.Empty() || !(cell_size > 0.0f)) return;
+    cell_size_ = cell_size;
+
+    float min_x = FLT_MAX, max_x = -FLT_MAX, min_z = FLT_MAX, max_z = -FLT_MAX;
+    for (TriangleIndex triangle = 0; triangle < triangles.Size(); ++triangle)
+        for (unsigned int corner = 0; corner < 3; ++corner) {
+            const glm::vec3 vertex = triangles.GetVertex(triangle, corner);
+            min_x = std::min(min_x, vertex.x);
+            max_x = std::max(max_x, vertex.x);
+            min_z = std::min(min_z, vertex.z);
+            max_z = std::max(max_z, vertex.z);
+        }
+    origin_x_ = min_x;
+    origin_z_ = min_z;
+    width_ = (int)std::floor((max_x - min_x) / cell_size_) + 1;
+    height_ = (int)std::floor((max_z - min_z) / cell_size_) + 1;
+    heights_.assign((std::size_t)width_ * height_, k_no_height);
+
+    // The height is linear over a triangle, so the highest point of its part in a cell is a corner
+    // of the triangle clipped to the cell. Walls project to a line and still reach their top.
+    std::vector<glm::vec3> polygon, clipped;
+    for (TriangleIndex triangle = 0; triangle < triangles.Size(); ++triangle) {
+        const glm::vec3 corners[3] = { triangles.GetVertex(triangle, 0), triangles.GetVertex(triangle, 1),
+                                       triangles.GetVertex(triangle, 2) };
+        const int x0 = std::clamp((int)std::floor((std::min({ corners[0].x, corners[1].x, corners[2].x }) - origin_x_) / cell_size_), 0, width_ - 1);
+        const int x1 = std::clamp((int)std::floor((std::max({ corners[0].x, corners[1].x, corners[2].x }) - origin_x_) / cell_size_), 0, width_ - 1);
+        const int z0 = std::clamp((int)std::floor((std::min({ corners[0].z, corners[1].z, corners[2].z }) - origin_z_) / cell_size_), 0, height_ - 1);
+        const int z1 = std::clamp((int)std::floor((std::max({ corners[0].z, corners[1].z, corners[2].z }) - origin_z_) / cell_size_), 0, height_ - 1);
+        for (int z = z0; z <= z1; ++z) {
+            const float low_z = origin_z_ + z * cell_size_, high_z = low_z + cell_size_;
+            for (int x = x0; x <= x1; ++x) {
+                const float low_x = origin_x_ + x * cell_size_, high_x = low_x + cell_size_;
+                polygon.assign(corners, corners + 3);
+                ClipPolygon(polygon, clipped, [low_x](const glm::vec3& p) { return p.x - low_x; });
+                ClipPolygon(polygon, clipped, [high_x](const glm::vec3& p) { return high_x - p.x; });
+                ClipPolygon(polygon, clipped, [low_z](const glm::vec3& p) { return p.z - low_z; });
+                ClipPolygon(polygon, clipped, [high_z](const glm::vec3& p) { return high_z - p.z; });
+                float& cell_height = heights_[(std::size_t)z * width_ + x];
+                for (const auto& point : polygon) cell_height = std::max(cell_height, point.y);
+            }
+        }
+    }
+}
+
+void HeightMap::Clear()
+{
+    origin_x_ = origin_z_ = 0.0f;
+    width_ = height_ = 0;
+    heights_.clear();
+}
+
+bool HeightMap::Empty() const
+{
+    return heights_.empty();
+}
+
+float HeightMap::GetCellSize() const
+{
+    return cell_size_;
+}
+
+int HeightMap::GetWidth() const
+{
+    return width_;
+}
+
+int HeightMap::GetHeight() const
+{
+    return height_;
+}
+
+bool HeightMap::GetHeight(const float x, const float z, float& height) const
+{
+    const int cell_x = (int)std::floor((x - origin_x_) / cell_size_);
+    const int cell_z = (int)std::floor((z - origin_z_) / cell_size_);
+    if (cell_x < 0 || cell_x >= width_ || cell_z < 0 || cell_z >= height_) return false;
+    height = heights_[(std::size_t)cell_z * width_ + cell_x];
+    return height != k_no_height;
+}
+
+void HeightMap::GetProfile(const glm::vec3& start_position, const glm::vec3& end_position,
+                           std::vector<glm::vec2>& profile) const
+{
+    profile.clear();
+    if (Empty()) return;
+
+    // Segment in cell units, clipped to the grid.
+    const glm::vec2 from((start_position.x - origin_x_) / cell_size_, (start_position.z - origin_z_) / cell_size_);
+    const glm::vec2 to((end_position.x - origin_x_) / cell_size_, (end_position.z - origin_z_) / cell_size_);
+    const glm::vec2 delta = to - from;
+    const float path_length = glm::length(delta) * cell_size_;
+    float t_start = 0.0f, t_end = 1.0f;
+    const float limits[2] = { (float)width_, (float)height_ };
+    for (int axis = 0; axis < 2; ++axis) {
+        if (delta[axis] == 0.0f) {
+            if (from[axis] < 0.0f || from[axis] >= limits[axis]) return;
+            continue;
+        }
+        float t0 = (0.0f - from[axis]) / delta[axis];
+        float t1 = (limits[axis] - from[axis]) / delta[axis];
+        if (t0 > t1) std::swap(t0, t1);
+        t_start = std::max(t_start, t0);
+        t_end = std::min(t_end, t1);
+        if (t_start >= t_end) return;
+    }
+
+    // Walk the cells, one sample per cell in the middle of its stretch of the path.
+    const glm::vec2 entry = from + delta * t_start;
+    int x = std::clamp((int)std::floor(entry.x), 0, width_ - 1);
+    int z = std::clamp((int)std::floor(entry.y), 0, height_ - 1);
+    const int start_x = (int)std::floor(from.x), start_z = (int)std::floor(from.y);
+    const int end_x = (int)std::floor(to.x), end_z = (int)std::floor(to.y);
+    const int step_x = delta.x > 0.0f ? 1 : -1;
+    const int step_z = delta.y > 0.0f ? 1 : -1;
+    const float delta_x = delta.x != 0.0f ? std::abs(1.0f / delta.x) : INFINITY;
+    const float delta_z = delta.y != 0.0f ? std::abs(1.0f / delta.y) : INFINITY;
+    float next_x = delta.x > 0.0f ? (x + 1 - from.x) / delta.x : delta.x < 0.0f ? (x - from.x) / delta.x : INFINITY;
+    float next_z = delta.y > 0.0f ? (z + 1 - from.y) / delta.y : delta.y < 0.0f ? (z - from.y) / delta.y : INFINITY;
+    float t_enter = t_start;
+    while (true) {
+        const float t_exit = std::min({ next_x, next_z, t_end });
+        const bool is_end_cell = (x == start_x && z == start_z) || (x == end_x && z == end_z);
+        const float cell_height = heights_[(std::size_t)z * width_ + x];
+        if (!is_end_cell && cell_height != k_no_height)
+            profile.emplace_back(0.5f * (t_enter + t_exit) * path_length, cell_height);
+        if (t_exit >= t_end) break;
+        t_enter = t_exit;
+        if (next_x < next_z) {
+            x += step_x;
+            next_x += delta_x;
+        } else {
+            z += step_z;
+            next_z += delta_z;
+        }
+        if (x < 0 || x >= width_ || z < 0 || z >= height_) break;
+    }
+}
+
+bool HeightMap::GetKnifeEdges(const glm::vec3& start_position, const glm::vec3& end_position, const ProfileMethod method,
+                              std::vector<glm::vec3>& edges_points) const
+{
+    std::vector<glm::vec2> profile;
+    GetProfile(start_position, end_position, profile);
+    const glm::vec2 along(end_position.x - start_position.x, end_position.z - start_position.z);
+    const float path_length = glm::length(along);
+    if (profile.empty() || path_length == 0.0f) return false;
+    profile.insert(profile.begin(), glm::vec2(0.0f, start_position.y));
+    profile.emplace_back(path_length, end_position.y);
+
+    std::vector<std::size_t> selected;
+    if (method == ProfileMethod::kDeygout) {
+        SelectDeygoutEdges(profile, 0, profile.size() - 1, k_max_deygout_edges, selected);
+        std::sort(selected.begin(), selected.end());
+    } else {
+        // Upper hull, monotone chain; its inner corners lie above the line from start to end.
+        for (std::size_t i = 0; i < profile.size(); ++i) {
+            while (selected.size() >= 2 && GetTurn(profile[selected[selected.size() - 2]], profile[selected.back()], profile[i]) >= 0.0f)
+                selected.pop_back();
+            selected.push_back(i);
+        }
+        selected.erase(selected.begin());
+        selected.pop_back();
+    }
+
+    const glm::vec2 direction = along / path_length;
+    for (auto index : selected)
+        edges_points.emplace_back(start_position.x + direction.x * profile[index].x, profile[index].y,
+                                  start_position.z + direction.y * profile[index].x);
+    return !selected.empty();
+}
+
+void HeightMap::SelectDeygoutEdges(const std::vector<glm::vec2>& profile, const std::size_t first, const std::size_t last,
+                                   const unsigned int max_edges, std::vector<std::size_t>& selected)
+{
+    if (max_edges == 0 || last <= first + 1) return;
+    // v = h * sqrt(2 (d1 + d2) / (lambda d1 d2)); the wavelength does not change which is largest.
+    const glm::vec2& a = profile[first];
+    const glm::vec2& b = profile[last];
+    float max_v = 0.0f;
+    std::size_t main_edge = first;
+    for (std::size_t i = first + 1; i < last; ++i) {
+        const float d1 = profile[i].x - a.x;
+        const float d2 = b.x - profile[i].x;
+        if (d1 <= 0.0f || d2 <= 0.0f) continue;
+        const float clearance = profile[i].y - (a.y + (b.y - a.y) * d1 / (d1 + d2));
+        const float v = clearance * std::sqrt((d1 + d2) / (d1 * d2));
+        if (v > max_v) {
+            max_v = v;
+            main_edge = i;
+        }
+    }
+    if (main_edge == first) return; // line of sight over this stretch
+    selected.push_back(main_edge);
+    const unsigned int left_edges = max_edges / 2;
+    SelectDeygoutEdges(profile, first, main_edge, left_edges, selected);
+    SelectDeygoutEdges(profile, main_edge, last, max_edges - 1 - left_edges, selected);
+}
+
+void HeightMap::Write(SceneWriter& writer) const
+{
+    writer.WriteValue(origin_x_);
+    writer.WriteValue(origin_z_);
+    writer.WriteValue(cell_size_);
+    writer.WriteValue(width_);
+    writer.WriteValue(height_);
+    writer.Write(heights_);
+}
+
+bool HeightMap::Read(SceneReader& reader)
+{
+    if (!reader.ReadValue(origin_x_) || !reader.ReadValue(origin_z_) || !reader.ReadValue(cell_size_) ||
+        !reader.ReadValue(width_) || !reader.ReadValue(height_) || !reader.Read(heights_))
+        return false;
+    if (heights_.empty()) {
+        Clear();
+        return true;
+    }
+    return width_ > 0 && height_ > 0 && cell_size_ > 0.0f && heights_.size() == (std::size_t)width_ * height_;
+}
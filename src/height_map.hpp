@@ -0,0 +1,61 @@
+#ifndef HEIGHT_MAP_H
+#define HEIGHT_MAP_H
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mappable_vector.hpp"
+#include "triangle_buffer.hpp"
+
+// How the knife edges are picked from a path profile.
+enum class ProfileMethod : int {
+	kDeygout = 0, // main edge first, then the main edge of each side
+	kEpsteinPeterson // every edge of the upper hull, each seen from its neighbours
+};
+
+// Digital surface model of the map: the highest point of the mesh in every cell of a regular
+// grid on the x-z plane. The buildings of a city map are mostly extruded footprints, so the
+// vertical profile of a path is read from the cells it crosses instead of being traced through
+// the mesh. Accuracy is bounded by the cell size; the mesh stays the reference for exact work.
+class HeightMap {
+public:
+	static constexpr float k_default_cell_size = 1.0f; // meters
+	static constexpr unsigned int k_max_deygout_edges = 3;
+
+	HeightMap();
+
+	// Rasterizes every triangle, clipped to each cell it covers, keeping the highest point.
+	void Build(const TriangleBuffer& triangles, float cell_size = k_default_cell_size);
+	void Clear();
+	bool Empty() const;
+
+	float GetCellSize() const;
+	int GetWidth() const;
+	int GetHeight() const;
+	// Highest point of the cell under the position, false outside the map or over an empty cell.
+	bool GetHeight(float x, float z, float& height) const;
+
+	// Samples (distance along the ground from start, height) of the cells between the two
+	// positions, in order. The cells holding the end points are left out.
+	void GetProfile(const glm::vec3& start_position, const glm::vec3& end_position,
+	                std::vector<glm::vec2>& profile) const;
+	// Knife edges over the path, ordered from start_position; false when nothing rises above it.
+	bool GetKnifeEdges(const glm::vec3& start_position, const glm::vec3& end_position, ProfileMethod method,
+	                   std::vector<glm::vec3>& edges_points) const;
+
+	void Write(SceneWriter& writer) const;
+	bool Read(SceneReader& reader); // borrows the heights from the scene file
+
+private:
+	// Deygout: the sample with the largest clearance parameter between first and last, recursively.
+	static void SelectDeygoutEdges(const std::vector<glm::vec2>& profile, std::size_t first, std::size_t last,
+	                               unsigned int max_edges, std::vector<std::size_t>& selected);
+
+	float origin_x_, origin_z_;
+	float cell_size_;
+	int width_, height_;
+	MappableVector<float> heights_; // rows of constant z, -FLT_MAX where nothing was drawn
+};
+
+#endif // !HEIGHT_MAP_H
@@ -0,0 +1,82 @@
+#include "image_source_table.hpp"
+
+ImageSourceTable::ImageSourceTable() : is_built_(false), source_(0.0f)
+{
+}
+
+void ImageSourceTable::Build(const TriangleBuffer& triangles, const glm::vec3& source)
+{
+    const TriangleIndex count = triangles.Size();
+    image_x_.resize(count);
+    image_y_.resize(count);
+    image_z_.resize(count);
+
+    const float* normal_x = triangles.normal_x_.data();
+    const float* normal_y = triangles.normal_y_.data();
+    const float* normal_z = triangles.normal_z_.data();
+    const float* plane_offset = triangles.plane_offset_.data();
+    float* image_x = image_x_.data();
+    float* image_y = image_y_.data();
+    float* image_z = image_z_.data();
+
+    // Straight loop over the component arrays, the compiler vectorizes it.
+    for (TriangleIndex i = 0; i < count; ++i) {
+        const float nx = normal_x[i], ny = normal_y[i], nz = normal_z[i];
+        // signed distance to the plane n . x = b, in units of |n|^2
+        const float t = (plane_offset[i] - (source.x * nx + source.y * ny + source.z * nz)) / (nx * nx + ny * ny + nz * nz);
+        const float twice_t = 2 * t;
+        image_x[i] = source.x + twice_t * nx;
+        image_y[i] = source.y + twice_t * ny;
+        image_z[i] = source.z + twice_t * nz;
+    }
+    source_ = source;
+    is_built_ = true;
+}
+
+void ImageSourceTable::Clear()
+{
+    image_x_.clear();
+    image_y_.clear();
+    image_z_.clear();
+    is_built_ = false;
+}
+
+bool ImageSourceTable::IsBuilt() const
+{
+    return is_built_;
+}
+
+bool ImageSourceTable::IsBuiltFor(const glm::vec3& source) const
+{
+    return is_built_ && source_ == source;
+}
+
+const glm::vec3& ImageSourceTable::GetSource() const
+{
+    return source_;
+}
+
+TriangleIndex ImageSourceTable::Size() const
+{
+    return (TriangleIndex)image_x_.size();
+}
+
+glm::vec3 ImageSourceTable::GetImage(const TriangleIndex index) const
+{
+    return glm::vec3(image_x_[index], image_y_[index], image_z_[index]);
+}
+
+const float* ImageSourceTable::GetImagesX() const
+{
+    return image_x_.data();
+}
+
+const float* ImageSourceTable::GetImagesY() const
+{
+    return image_y_.data();
+}
+
+const float* ImageSourceTable::GetImagesZ() const
+{
+    return image_z_.data();
+}
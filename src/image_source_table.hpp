@@ -0,0 +1,35 @@
+#ifndef IMAGE_SOURCE_TABLE_H
+#define IMAGE_SOURCE_TABLE_H
+
+#include <glm/glm.hpp>
+
+#include "aligned_allocator.hpp"
+#include "triangle_buffer.hpp"
+
+// Mirror images of one source point in the plane of every map triangle. The images depend only
+// on the source and the map, so a table is built once per source pose and shared by every path
+// traced from that source (all receivers of a transmitter, or all cells of a coverage sweep).
+class ImageSourceTable {
+public:
+	ImageSourceTable();
+
+	// Same arithmetic as RayTracer::ReflectedPointOnTriangle, so the images are bit-identical to it.
+	void Build(const TriangleBuffer& triangles, const glm::vec3& source);
+	void Clear();
+
+	bool IsBuilt() const;
+	bool IsBuiltFor(const glm::vec3& source) const;
+	const glm::vec3& GetSource() const;
+	TriangleIndex Size() const;
+	glm::vec3 GetImage(TriangleIndex index) const;
+	const float* GetImagesX() const;
+	const float* GetImagesY() const;
+	const float* GetImagesZ() const;
+
+private:
+	bool is_built_;
+	glm::vec3 source_;
+	AlignedVector<float> image_x_, image_y_, image_z_;
+};
+
+#endif // !IMAGE_SOURCE_TABLE_H
@@ -0,0 +1,150 @@
+#include "image_tree.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "tracing_ray.hpp"
+
+namespace {
+    constexpr float k_min_plane_distance = 0.001f; // a source on the plane has no image
+    constexpr float k_surface_offset = 0.001f; // same as RayTracer::IsReflected
+}
+
+ImageTree::ImageTree(const TriangleBuffer& triangles, const FacetSet& facets) :
+    triangles_(triangles), facets_(facets), source_(0.0f), max_order_(0), pruned_count_(0)
+{
+}
+
+bool ImageTree::Build(const glm::vec3& source, const unsigned int max_order)
+{
+    source_ = source;
+    max_order_ = max_order;
+    nodes_.clear();
+    pruned_count_ = 0;
+    if (max_order == 0) return true;
+
+    const FacetIndex facet_count = facets_.Size();
+    for (FacetIndex facet = 0; facet < facet_count; ++facet) {
+        const float distance = glm::dot(facets_.GetNormal(facet), source) - facets_.GetPlaneOffset(facet);
+        if (std::abs(distance) < k_min_plane_distance) continue;
+        nodes_.push_back(Node{ Mirror(facets_, source, facet), facet, k_root, 1 });
+    }
+
+    // Grow one order at a time from the nodes of the previous one.
+    std::size_t level_begin = 0;
+    for (unsigned int order = 2; order <= max_order; ++order) {
+        const std::size_t level_end = nodes_.size();
+        for (std::size_t parent = level_begin; parent < level_end; ++parent) {
+            for (FacetIndex facet = 0; facet < facet_count; ++facet) {
+                if (facet == nodes_[parent].facet) continue;
+                if (!IsInBeam(nodes_[parent], facet)) {
+                    ++pruned_count_;
+                    continue;
+                }
+                const glm::vec3& parent_image = nodes_[parent].image;
+                const float distance = glm::dot(facets_.GetNormal(facet), parent_image) - facets_.GetPlaneOffset(facet);
+                if (std::abs(distance) < k_min_plane_distance) continue;
+                if (nodes_.size() == k_max_nodes) return false;
+                nodes_.push_back(Node{ Mirror(facets_, parent_image, facet), facet, (std::uint32_t)parent, order });
+            }
+        }
+        level_begin = level_end;
+    }
+    return true;
+}
+
+const glm::vec3& ImageTree::GetSource() const
+{
+    return source_;
+}
+
+unsigned int ImageTree::GetMaxOrder() const
+{
+    return max_order_;
+}
+
+const std::vector<ImageTree::Node>& ImageTree::GetNodes() const
+{
+    return nodes_;
+}
+
+std::size_t ImageTree::GetPrunedCount() const
+{
+    return pruned_count_;
+}
+
+bool ImageTree::GetPath(const std::uint32_t node, const glm::vec3& end_position, std::vector<glm::vec3>& points) const
+{
+    std::vector<FacetIndex> facet_sequence(nodes_[node].order);
+    std::uint32_t current = node;
+    for (unsigned int i = nodes_[node].order; i-- > 0; current = nodes_[current].parent)
+        facet_sequence[i] = nodes_[current].facet;
+    return SolvePath(triangles_, facets_, source_, facet_sequence, end_position, points);
+}
+
+bool ImageTree::SolvePath(const TriangleBuffer& triangles, const FacetSet& facets, const glm::vec3& source,
+                          const std::vector<FacetIndex>& facet_sequence, const glm::vec3& end_position,
+                          std::vector<glm::vec3>& points)
+{
+    const std::size_t order = facet_sequence.size();
+    points.resize(order);
+    if (order == 0) return true;
+
+    // Images of the source along the sequence.
+    std::vector<glm::vec3> images(order);
+    images[0] = Mirror(facets, source, facet_sequence[0]);
+    for (std::size_t i = 1; i < order; ++i) images[i] = Mirror(facets, images[i - 1], facet_sequence[i]);
+
+    // From the last bounce backwards: each bounce is where the line from its image to the next
+    // (exact) bounce point crosses its facet.
+    glm::vec3 target = end_position;
+    for (std::size_t i = order; i-- > 0;) {
+        const FacetIndex facet = facet_sequence[i];
+        const glm::vec3 direction = glm::normalize(target - images[i]);
+        const TracingRay ray{ images[i], direction, glm::distance(images[i], target) };
+        const TriangleIndex* facet_triangles = facets.GetTriangles(facet);
+        float t = 0.0f;
+        bool is_hit = false;
+        for (TriangleIndex j = 0; j < facets.GetTriangleCount(facet) && !is_hit; ++j)
+            is_hit = triangles.IsHit(facet_triangles[j], ray, t);
+        if (!is_hit) return false;
+        points[i] = ray.PointAtLength(t + k_surface_offset);
+        target = ray.PointAtLength(t);
+    }
+    return true;
+}
+
+glm::vec3 ImageTree::Mirror(const FacetSet& facets, const glm::vec3& point, const FacetIndex facet)
+{
+    const glm::vec3 normal = facets.GetNormal(facet);
+    const float distance = facets.GetPlaneOffset(facet) - glm::dot(normal, point);
+    return point + 2.0f * distance * normal;
+}
+
+bool ImageTree::IsInBeam(const Node& parent, const FacetIndex facet) const
+{
+    const glm::vec3 parent_normal = facets_.GetNormal(parent.facet);
+    const float parent_offset = facets_.GetPlaneOffset(parent.facet);
+    const glm::vec3 center = facets_.GetBoundingCenter(facet);
+    const float radius = facets_.GetBoundingRadius(facet);
+
+    // The reflected wave lives on the other side of the parent plane than the parent image.
+    const float image_side = glm::dot(parent_normal, parent.image) - parent_offset;
+    const float center_side = glm::dot(parent_normal, center) - parent_offset;
+    if (image_side * center_side > 0.0f && std::abs(center_side) > radius) return false;
+
+    // Cone from the parent image through the bounding sphere of the parent facet.
+    const glm::vec3 parent_center = facets_.GetBoundingCenter(parent.facet);
+    const float parent_radius = facets_.GetBoundingRadius(parent.facet);
+    const glm::vec3 axis = parent_center - parent.image;
+    const float axis_length = glm::length(axis);
+    if (axis_length <= parent_radius) return true;
+    const float beam_angle = std::asin(parent_radius / axis_length);
+
+    const glm::vec3 to_center = center - parent.image;
+    const float center_distance = glm::length(to_center);
+    if (center_distance <= radius) return true;
+    const float cosine = glm::dot(axis, to_center) / (axis_length * center_distance);
+    const float center_angle = std::acos(std::min(1.0f, std::max(-1.0f, cosine)));
+    return center_angle <= beam_angle + std::asin(radius / center_distance);
+}
@@ -0,0 +1,63 @@
+#ifndef IMAGE_TREE_H
+#define IMAGE_TREE_H
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "triangle_buffer.hpp"
+#include "facet_set.hpp"
+
+// Images of one source over chains of facets, up to a maximum reflection order. A node is the
+// image of its parent mirrored in the plane of its facet, so a path to an end position is found
+// by walking from a node back to the root (see GetPath).
+//
+// Children are pruned with the visibility beam of the parent: after bouncing off the parent facet
+// the wave leaves inside the cone from the parent image through the bounding sphere of that facet,
+// so only facets whose sphere meets the cone, and which reach into the half-space in front of the
+// parent facet, get a child. The test is conservative: it never drops a valid path.
+class ImageTree {
+public:
+	static constexpr std::uint32_t k_root = 0xffffffffu;
+	static constexpr std::size_t k_max_nodes = 1u << 21; // the tree stops growing at this size
+
+	struct Node {
+		glm::vec3 image;
+		FacetIndex facet;
+		std::uint32_t parent; // k_root for first order
+		unsigned int order;
+	};
+
+	ImageTree(const TriangleBuffer& triangles, const FacetSet& facets);
+
+	// False when the tree reached k_max_nodes: the paths of its last orders are incomplete.
+	bool Build(const glm::vec3& source, unsigned int max_order);
+
+	const glm::vec3& GetSource() const;
+	unsigned int GetMaxOrder() const;
+	const std::vector<Node>& GetNodes() const; // parents always come before their children
+	std::size_t GetPrunedCount() const; // children dropped by the beam test
+
+	// Bounce points from the source to end_position through the facets of the node, in path
+	// order. Every point is pushed 1 mm off its facet along the incoming ray, like the single
+	// reflections. False when a bounce misses its facet. Occlusion is not checked here.
+	bool GetPath(std::uint32_t node, const glm::vec3& end_position, std::vector<glm::vec3>& points) const;
+	// Same for an explicit sequence of facets from source to end_position.
+	static bool SolvePath(const TriangleBuffer& triangles, const FacetSet& facets, const glm::vec3& source,
+	                      const std::vector<FacetIndex>& facet_sequence, const glm::vec3& end_position,
+	                      std::vector<glm::vec3>& points);
+
+private:
+	static glm::vec3 Mirror(const FacetSet& facets, const glm::vec3& point, FacetIndex facet);
+	bool IsInBeam(const Node& parent, FacetIndex facet) const;
+
+	const TriangleBuffer& triangles_;
+	const FacetSet& facets_;
+	glm::vec3 source_;
+	unsigned int max_order_;
+	std::vector<Node> nodes_;
+	std::size_t pruned_count_;
+};
+
+#endif // !IMAGE_TREE_H
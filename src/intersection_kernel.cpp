@@ -0,0 +1,254 @@
+#include "intersection_kernel.hpp"
+
+#include <atomic>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define WCSIM_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define WCSIM_TARGET_SSE4
+#define WCSIM_TARGET_AVX2
+#else
+#define WCSIM_TARGET_SSE4 __attribute__((target("sse4.1")))
+#define WCSIM_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+    constexpr float k_min_t = 0.00000001f; // same as TriangleBuffer::IsHit
+    constexpr unsigned int k_components = 9; // v0, edge 1 and edge 2
+    constexpr unsigned int k_max_width = 8;
+
+    // Pointers to the nine component arrays of a batch. A short range is read in place when the
+    // whole batch lies inside the buffer (the extra lanes are masked off), only at the end of the
+    // buffer it is copied into zero padded storage. A zero triangle gives NaN for t and never hits.
+    struct Batch {
+        const float* components[k_components];
+        alignas(32) float padded[k_components][k_max_width];
+
+        Batch(const TriangleBuffer& triangles, TriangleIndex first, unsigned int lanes, unsigned int width)
+        {
+            const float* sources[k_components] = {
+                triangles.v0_x_.data(), triangles.v0_y_.data(), triangles.v0_z_.data(),
+                triangles.edge1_x_.data(), triangles.edge1_y_.data(), triangles.edge1_z_.data(),
+                triangles.edge2_x_.data(), triangles.edge2_y_.data(), triangles.edge2_z_.data()
+            };
+            const bool is_in_place = first + width <= triangles.Size();
+            for (unsigned int i = 0; i < k_components; ++i) {
+                if (is_in_place) {
+                    components[i] = sources[i] + first;
+                } else {
+                    std::memset(padded[i], 0, sizeof(padded[i]));
+                    std::memcpy(padded[i], sources[i] + first, lanes * sizeof(float));
+                    components[i] = padded[i];
+                }
+            }
+        }
+    };
+
+    unsigned int TestBatchScalar(const TriangleBuffer& triangles, TriangleIndex first, unsigned int lanes,
+                                 const TracingRay& ray, float min_t, float max_t, float* t)
+    {
+        unsigned int mask = 0;
+        for (unsigned int i = 0; i < lanes; ++i)
+            if (triangles.IsHit(first + i, ray.origin, ray.direction, t[i]) && t[i] > min_t && t[i] < max_t)
+                mask |= 1u << i;
+        return mask;
+    }
+
+#ifdef WCSIM_X86
+    WCSIM_TARGET_SSE4
+    unsigned int TestBatchSSE4(const TriangleBuffer& triangles, TriangleIndex first, unsigned int lanes,
+                               const TracingRay& ray, float min_t, float max_t, float* t)
+    {
+        const Batch batch(triangles, first, lanes, 4);
+        const float* const* c = batch.components;
+        const __m128 v0_x = _mm_loadu_ps(c[0]), v0_y = _mm_loadu_ps(c[1]), v0_z = _mm_loadu_ps(c[2]);
+        const __m128 e1_x = _mm_loadu_ps(c[3]), e1_y = _mm_loadu_ps(c[4]), e1_z = _mm_loadu_ps(c[5]);
+        const __m128 e2_x = _mm_loadu_ps(c[6]), e2_y = _mm_loadu_ps(c[7]), e2_z = _mm_loadu_ps(c[8]);
+        const __m128 d_x = _mm_set1_ps(ray.direction.x), d_y = _mm_set1_ps(ray.direction.y), d_z = _mm_set1_ps(ray.direction.z);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+
+        // h = cross(direction, edge_2), a = dot(edge_1, h)
+        const __m128 h_x = _mm_sub_ps(_mm_mul_ps(d_y, e2_z), _mm_mul_ps(e2_y, d_z));
+        const __m128 h_y = _mm_sub_ps(_mm_mul_ps(d_z, e2_x), _mm_mul_ps(e2_z, d_x));
+        const __m128 h_z = _mm_sub_ps(_mm_mul_ps(d_x, e2_y), _mm_mul_ps(e2_x, d_y));
+        const __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1_x, h_x), _mm_mul_ps(e1_y, h_y)), _mm_mul_ps(e1_z, h_z));
+        const __m128 f = _mm_div_ps(one, a);
+
+        // u = f * dot(s, h) with s = origin - v0
+        const __m128 s_x = _mm_sub_ps(_mm_set1_ps(ray.origin.x), v0_x);
+        const __m128 s_y = _mm_sub_ps(_mm_set1_ps(ray.origin.y), v0_y);
+        const __m128 s_z = _mm_sub_ps(_mm_set1_ps(ray.origin.z), v0_z);
+        const __m128 u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(s_x, h_x), _mm_mul_ps(s_y, h_y)), _mm_mul_ps(s_z, h_z)));
+
+        // q = cross(s, edge_1), v = f * dot(direction, q), t = f * dot(edge_2, q)
+        const __m128 q_x = _mm_sub_ps(_mm_mul_ps(s_y, e1_z), _mm_mul_ps(e1_y, s_z));
+        const __m128 q_y = _mm_sub_ps(_mm_mul_ps(s_z, e1_x), _mm_mul_ps(e1_z, s_x));
+        const __m128 q_z = _mm_sub_ps(_mm_mul_ps(s_x, e1_y), _mm_mul_ps(e1_x, s_y));
+        const __m128 v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(d_x, q_x), _mm_mul_ps(d_y, q_y)), _mm_mul_ps(d_z, q_z)));
+        const __m128 t_lanes = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2_x, q_x), _mm_mul_ps(e2_y, q_y)), _mm_mul_ps(e2_z, q_z)));
+
+        // Reject exactly like the scalar test, NaN passes the rejections and fails on t.
+        __m128 reject = _mm_or_ps(_mm_cmplt_ps(u, zero), _mm_cmpgt_ps(u, one));
+        reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(v, zero), _mm_cmpgt_ps(_mm_add_ps(u, v), one)));
+        const __m128 accept = _mm_and_ps(_mm_cmpgt_ps(t_lanes, _mm_set1_ps(min_t)),
+                                         _mm_cmplt_ps(t_lanes, _mm_set1_ps(max_t)));
+        _mm_storeu_ps(t, t_lanes);
+        return (unsigned int)_mm_movemask_ps(_mm_andnot_ps(reject, accept)) & ((1u << lanes) - 1);
+    }
+
+    WCSIM_TARGET_AVX2
+    unsigned int TestBatchAVX2(const TriangleBuffer& triangles, TriangleIndex first, unsigned int lanes,
+                               const TracingRay& ray, float min_t, float max_t, float* t)
+    {
+        const Batch batch(triangles, first, lanes, 8);
+        const float* const* c = batch.components;
+        const __m256 v0_x = _mm256_loadu_ps(c[0]), v0_y = _mm256_loadu_ps(c[1]), v0_z = _mm256_loadu_ps(c[2]);
+        const __m256 e1_x = _mm256_loadu_ps(c[3]), e1_y = _mm256_loadu_ps(c[4]), e1_z = _mm256_loadu_ps(c[5]);
+        const __m256 e2_x = _mm256_loadu_ps(c[6]), e2_y = _mm256_loadu_ps(c[7]), e2_z = _mm256_loadu_ps(c[8]);
+        const __m256 d_x = _mm256_set1_ps(ray.direction.x), d_y = _mm256_set1_ps(ray.direction.y), d_z = _mm256_set1_ps(ray.direction.z);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.0f);
+
+        const __m256 h_x = _mm256_sub_ps(_mm256_mul_ps(d_y, e2_z), _mm256_mul_ps(e2_y, d_z));
+        const __m256 h_y = _mm256_sub_ps(_mm256_mul_ps(d_z, e2_x), _mm256_mul_ps(e2_z, d_x));
+        const __m256 h_z = _mm256_sub_ps(_mm256_mul_ps(d_x, e2_y), _mm256_mul_ps(e2_x, d_y));
+        const __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1_x, h_x), _mm256_mul_ps(e1_y, h_y)), _mm256_mul_ps(e1_z, h_z));
+        const __m256 f = _mm256_div_ps(one, a);
+
+        const __m256 s_x = _mm256_sub_ps(_mm256_set1_ps(ray.origin.x), v0_x);
+        const __m256 s_y = _mm256_sub_ps(_mm256_set1_ps(ray.origin.y), v0_y);
+        const __m256 s_z = _mm256_sub_ps(_mm256_set1_ps(ray.origin.z), v0_z);
+        const __m256 u = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(s_x, h_x), _mm256_mul_ps(s_y, h_y)), _mm256_mul_ps(s_z, h_z)));
+
+        const __m256 q_x = _mm256_sub_ps(_mm256_mul_ps(s_y, e1_z), _mm256_mul_ps(e1_y, s_z));
+        const __m256 q_y = _mm256_sub_ps(_mm256_mul_ps(s_z, e1_x), _mm256_mul_ps(e1_z, s_x));
+        const __m256 q_z = _mm256_sub_ps(_mm256_mul_ps(s_x, e1_y), _mm256_mul_ps(e1_x, s_y));
+        const __m256 v = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d_x, q_x), _mm256_mul_ps(d_y, q_y)), _mm256_mul_ps(d_z, q_z)));
+        const __m256 t_lanes = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2_x, q_x), _mm256_mul_ps(e2_y, q_y)), _mm256_mul_ps(e2_z, q_z)));
+
+        __m256 reject = _mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_LT_OQ), _mm256_cmp_ps(u, one, _CMP_GT_OQ));
+        reject = _mm256_or_ps(reject, _mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ),
+                                                   _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_GT_OQ)));
+        const __m256 accept = _mm256_and_ps(_mm256_cmp_ps(t_lanes, _mm256_set1_ps(min_t), _CMP_GT_OQ),
+                                            _mm256_cmp_ps(t_lanes, _mm256_set1_ps(max_t), _CMP_LT_OQ));
+        _mm256_storeu_ps(t, t_lanes);
+        return (unsigned int)_mm256_movemask_ps(_mm256_andnot_ps(reject, accept)) & ((1u << lanes) - 1);
+    }
+#endif
+
+    InstructionSet DetectInstructionSet()
+    {
+#if defined(WCSIM_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        const int max_leaf = info[0];
+        __cpuid(info, 1);
+        const bool has_sse4 = (info[2] & (1 << 19)) != 0;
+        const bool has_os_avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 &&
+                                (_xgetbv(0) & 0x6) == 0x6;
+        bool has_avx2 = false;
+        if (max_leaf >= 7 && has_os_avx) {
+            __cpuidex(info, 7, 0);
+            has_avx2 = (info[1] & (1 << 5)) != 0;
+        }
+        if (has_avx2) return InstructionSet::kAVX2;
+        if (has_sse4) return InstructionSet::kSSE4;
+#elif defined(WCSIM_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return InstructionSet::kAVX2;
+        if (__builtin_cpu_supports("sse4.1")) return InstructionSet::kSSE4;
+#endif
+        return InstructionSet::kScalar;
+    }
+
+    std::atomic<InstructionSet>& ActiveInstructionSet()
+    {
+        static std::atomic<InstructionSet> active(IntersectionKernel::GetSupportedInstructionSet());
+        return active;
+    }
+
+    // Tests one batch of up to the dispatch width, writes t per lane and returns the hit lanes.
+    unsigned int TestBatch(InstructionSet instruction_set, const TriangleBuffer& triangles, TriangleIndex first,
+                           unsigned int lanes, const TracingRay& ray, float min_t, float max_t, float* t)
+    {
+        switch (instruction_set) {
+#ifdef WCSIM_X86
+        case InstructionSet::kAVX2: return TestBatchAVX2(triangles, first, lanes, ray, min_t, max_t, t);
+        case InstructionSet::kSSE4: return TestBatchSSE4(triangles, first, lanes, ray, min_t, max_t, t);
+#endif
+        default: return TestBatchScalar(triangles, first, lanes, ray, min_t, max_t, t);
+        }
+    }
+
+    unsigned int GetWidth(InstructionSet instruction_set)
+    {
+        switch (instruction_set) {
+        case InstructionSet::kAVX2: return 8;
+        case InstructionSet::kSSE4: return 4;
+        default: return k_max_width;
+        }
+    }
+}
+
+bool IntersectionKernel::IsClosestHit(const TriangleBuffer& triangles, TriangleIndex first, unsigned int count,
+                                      const TracingRay& ray, float max_t, float& t, TriangleIndex& position)
+{
+    const InstructionSet instruction_set = ActiveInstructionSet().load(std::memory_order_relaxed);
+    const unsigned int width = GetWidth(instruction_set);
+    const float min_t = ray.t_min > k_min_t ? ray.t_min : k_min_t;
+    float closest_t = max_t;
+    bool is_hit = false;
+    alignas(32) float lane_t[k_max_width];
+    for (unsigned int offset = 0; offset < count; offset += width) {
+        const unsigned int lanes = count - offset < width ? count - offset : width;
+        unsigned int mask = TestBatch(instruction_set, triangles, first + offset, lanes,
+                                      ray, min_t, closest_t, lane_t);
+        // Lowest lane wins a tie, the same as a scalar loop with a strict comparison.
+        for (unsigned int lane = 0; mask != 0; ++lane, mask >>= 1) {
+            if ((mask & 1u) && lane_t[lane] < closest_t) {
+                closest_t = lane_t[lane];
+                position = first + offset + lane;
+                is_hit = true;
+            }
+        }
+    }
+    if (is_hit) t = closest_t;
+    return is_hit;
+}
+
+bool IntersectionKernel::IsAnyHit(const TriangleBuffer& triangles, TriangleIndex first, unsigned int count,
+                                  const TracingRay& ray)
+{
+    const InstructionSet instruction_set = ActiveInstructionSet().load(std::memory_order_relaxed);
+    const unsigned int width = GetWidth(instruction_set);
+    const float min_t = ray.t_min > k_min_t ? ray.t_min : k_min_t;
+    alignas(32) float lane_t[k_max_width];
+    for (unsigned int offset = 0; offset < count; offset += width) {
+        const unsigned int lanes = count - offset < width ? count - offset : width;
+        if (TestBatch(instruction_set, triangles, first + offset, lanes, ray, min_t, ray.t_max, lane_t) != 0)
+            return true;
+    }
+    return false;
+}
+
+InstructionSet IntersectionKernel::GetSupportedInstructionSet()
+{
+    static const InstructionSet supported = DetectInstructionSet();
+    return supported;
+}
+
+InstructionSet IntersectionKernel::GetInstructionSet()
+{
+    return ActiveInstructionSet().load();
+}
+
+void IntersectionKernel::SetInstructionSet(InstructionSet instruction_set)
+{
+    if ((int)instruction_set > (int)GetSupportedInstructionSet()) instruction_set = GetSupportedInstructionSet();
+    ActiveInstructionSet().store(instruction_set);
+}
@@ -0,0 +1,39 @@
+#ifndef INTERSECTION_KERNEL_H
+#define INTERSECTION_KERNEL_H
+
+#include <glm/glm.hpp>
+
+#include "triangle_buffer.hpp"
+#include "tracing_ray.hpp"
+
+enum class InstructionSet : int {
+	kScalar = 0,
+	kSSE4, // 4 triangles per batch
+	kAVX2 // 8 triangles per batch
+};
+
+// Batched Moller-Trumbore test of one ray against a contiguous range of a TriangleBuffer,
+// e.g. the triangles of one BVH leaf. The widest instruction set the CPU supports is picked
+// at start up, ranges that do not fill a batch are padded inside the kernel.
+//
+// Every lane runs the operation sequence of TriangleBuffer::IsHit (true division, no fused
+// multiply-add), so hits and misses are the same as the scalar test and t agrees with it to
+// within k_tolerance (relative). In practice the results are bit-identical, the tolerance
+// covers builds that let the compiler contract the scalar code.
+class IntersectionKernel {
+public:
+	static constexpr float k_tolerance = 1e-6f;
+
+	// Nearest hit with ray.t_min < t < max_t. position is the index of the triangle in the buffer.
+	static bool IsClosestHit(const TriangleBuffer& triangles, TriangleIndex first, unsigned int count,
+	                         const TracingRay& ray, float max_t, float& t, TriangleIndex& position);
+	// Any hit inside the t range of the ray, stops at the first batch that has one.
+	static bool IsAnyHit(const TriangleBuffer& triangles, TriangleIndex first, unsigned int count,
+	                     const TracingRay& ray);
+
+	static InstructionSet GetSupportedInstructionSet();
+	static InstructionSet GetInstructionSet();
+	static void SetInstructionSet(InstructionSet instruction_set); // clamped to what the CPU supports
+};
+
+#endif // !INTERSECTION_KERNEL_H
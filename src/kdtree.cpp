@@ -1,208 +1,317 @@
 #include "kdtree.hpp"
 
-#include<iostream>
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
-#include "triangle.hpp"
-#include "ray.hpp"
 
+namespace {
+    constexpr unsigned int k_bins = 32; // SAH candidate planes per axis
+    constexpr unsigned int k_min_leaf_size = 2;
+    constexpr unsigned int k_max_depth_limit = 40;
+    constexpr unsigned int k_stack_size = 64;
+    constexpr float k_traversal_cost = 1.0f;
+    constexpr float k_intersection_cost = 1.5f;
+    constexpr float k_empty_bonus = 0.8f; // favour planes that cut off empty space
 
-KDTree::KDTree(const std::vector<const Triangle*>& objects)
+    float HalfArea(const glm::vec3& min_corner, const glm::vec3& max_corner)
+    {
+        const glm::vec3 extent = max_corner - min_corner;
+        return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+    }
+}
+
+KDTree::KDTree(const TriangleBuffer& triangles) : triangles_(triangles), max_depth_(0)
 {
-    root_ = Build(objects, 0);
+    bounds_.min_corner = glm::vec3(std::numeric_limits<float>::max());
+    bounds_.max_corner = glm::vec3(-std::numeric_limits<float>::max());
+    if (triangles_.Empty()) return;
+
+    std::vector<Bounds> triangle_bounds;
+    triangle_bounds.reserve(triangles_.Size());
+    std::vector<TriangleIndex> indices;
+    indices.reserve(triangles_.Size());
+    for (TriangleIndex i = 0; i < triangles_.Size(); ++i) {
+        const glm::vec3 point_0 = triangles_.GetV0(i);
+        const glm::vec3 point_1 = point_0 + triangles_.GetEdge1(i);
+        const glm::vec3 point_2 = point_0 + triangles_.GetEdge2(i);
+        Bounds bounds;
+        bounds.min_corner = glm::min(point_0, glm::min(point_1, point_2));
+        bounds.max_corner = glm::max(point_0, glm::max(point_1, point_2));
+        bounds_.min_corner = glm::min(bounds_.min_corner, bounds.min_corner);
+        bounds_.max_corner = glm::max(bounds_.max_corner, bounds.max_corner);
+        triangle_bounds.push_back(bounds);
+        indices.push_back(i);
+    }
+
+    // Usual depth bound for SAH kd-trees, capped so the traversal stack stays fixed.
+    max_depth_ = std::min(k_max_depth_limit,
+                          (unsigned int)(8.0f + 1.3f * std::log2((float)triangles_.Size())));
+    nodes_.push_back(KDNode{});
+    Build(0, indices, bounds_, triangle_bounds, 0);
+    nodes_.shrink_to_fit();
+    leaf_indices_.shrink_to_fit();
 }
 
 KDTree::~KDTree()
 {
-    delete root_;
 }
 
-bool KDTree::IsClosestHit(const Ray& ray, float & t) const
+unsigned int KDTree::GetNodeCount() const
 {
-    t = std::numeric_limits<float>::max(); // Initialize t before checking
-    return IsClosestHit(ray, root_, t, 0);
+    return nodes_.size();
 }
 
-bool KDTree::IsClosestHit(const Ray& ray, KDNode* node, float & t, int depth) const
+unsigned int KDTree::GetLeafReferenceCount() const
 {
-    glm::vec3 direction = ray.GetDirection();
-    glm::vec3 origin = ray.GetOrigin();
-    glm::vec3 point_1 = node->GetCorner(0);
-    glm::vec3 point_2 = node->GetCorner(1);
-
-    float distances[6] = {
-      direction.x ? (point_1.x - origin.x) / direction.x : 0,
-      direction.x ? (point_2.x - origin.x) / direction.x : 0,
-      direction.y ? (point_1.y - origin.y) / direction.y : 0,
-      direction.y ? (point_2.y - origin.y) / direction.y : 0,
-      direction.z ? (point_1.z - origin.z) / direction.z : 0,
-      direction.z ? (point_2.z - origin.z) / direction.z : 0
-    };
-    auto distance = std::numeric_limits<float>::max();
-    constexpr float k_epsilon = 0.000001f;
-    for (int i = 0; i < 6; ++i) {
-        if (distances[i] == 0) continue;
-        glm::vec3 point = origin + distances[i] * direction;
-        if (point.x < point_1.x - k_epsilon || point.x > point_2.x + k_epsilon) continue;
-        if (point.y < point_1.y - k_epsilon || point.y > point_2.y + k_epsilon) continue;
-        if (point.z < point_1.z - k_epsilon || point.z > point_2.z + k_epsilon) continue;
-
-        if (distances[i] < distance) distance = distances[i];
-        //std::cout << t  << std::endl;
-        if (distance >= t) return false;
-     
-        if (node->GetChildren(0) && node->GetChildren(1)) {
-            auto point = ray.GetOrigin() + ray.GetDirection() * t;
-            auto prefer = point[node->GetAxis()] <= node->GetPivot() ? 0 : 1;
-            for (auto i : { prefer, prefer ^ 1 }) {
-                float temp_t;
-                if (IsClosestHit(ray, node->GetChildren(i), temp_t, depth + 1) 
-                    && temp_t < t) 
-                    t = temp_t;
-            }
-        }
-        else {
-            for (auto& triangle : node->triangles_) {
-                float temp_t;
-                if (triangle->IsHit(ray, temp_t) 
-                    && temp_t < t) t = temp_t;
-            }
-        }
-    }
-    return true;
+    return leaf_indices_.size();
 }
 
-bool KDTree::IsSomeHit(const Ray& ray, std::set<std::pair<float, Triangle *>>& hit_triangles) const
+void KDTree::MakeLeaf(unsigned int node_index, const std::vector<TriangleIndex>& indices)
 {
-    return IsSomeHit(ray, root_, hit_triangles, 0);
+    KDNode& node = nodes_[node_index];
+    node.split = 0.0f;
+    node.axis = KDNode::k_leaf;
+    node.first = leaf_indices_.size();
+    node.count = indices.size();
+    leaf_indices_.insert(leaf_indices_.end(), indices.begin(), indices.end());
 }
 
-bool KDTree::IsSomeHit(const Ray& ray, KDNode* node, std::set<std::pair<float, Triangle*>> & hit_triangles, int depth) const
+bool KDTree::FindSplit(const std::vector<TriangleIndex>& indices, const Bounds& node_bounds,
+                       const std::vector<Bounds>& triangle_bounds, int& best_axis, float& best_split) const
 {
-    glm::vec3 direction = ray.GetDirection();
-    glm::vec3 origin = ray.GetOrigin();
-    glm::vec3 point_1 = node->GetCorner(0);
-    glm::vec3 point_2 = node->GetCorner(1);
-
-    float distances[6] = {
-      direction.x ? (point_1.x - origin.x) / direction.x : 0,
-      direction.x ? (point_2.x - origin.x) / direction.x : 0,
-      direction.y ? (point_1.y - origin.y) / direction.y : 0,
-      direction.y ? (point_2.y - origin.y) / direction.y : 0,
-      direction.z ? (point_1.z - origin.z) / direction.z : 0,
-      direction.z ? (point_2.z - origin.z) / direction.z : 0
-    };
-    constexpr float k_epsilon = 0.000001f;
-    for (int i = 0; i < 6; ++i) {
-        if (distances[i] == 0) continue;
-        glm::vec3 point = origin + distances[i] * direction;
-        if (point.x < point_1.x || point.x > point_2.x + k_epsilon) continue;
-        if (point.y < point_1.y || point.y > point_2.y + k_epsilon) continue;
-        if (point.z < point_1.z || point.z > point_2.z + k_epsilon) continue;
-
-
-        if (node->GetChildren(0) && node->GetChildren(1)) {
-            float t = (hit_triangles.empty())? 0.0f:(hit_triangles.end())->first;
-            auto point = ray.GetOrigin() + ray.GetDirection() * t;
-            auto prefer = point[node->GetAxis()] <= node->GetPivot() ? 0 : 1;
-            for (auto i : { prefer, prefer ^ 1 }) {
-                IsSomeHit(ray, node->GetChildren(i), hit_triangles, depth + 1);
-            }
+    const float node_area = HalfArea(node_bounds.min_corner, node_bounds.max_corner);
+    float best_cost = k_intersection_cost * indices.size(); // cost of not splitting
+    bool is_found = false;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        const float axis_min = node_bounds.min_corner[axis];
+        const float axis_max = node_bounds.max_corner[axis];
+        if (axis_max <= axis_min) continue;
+        const float bin_width = (axis_max - axis_min) / k_bins;
+
+        // Count the triangle bounds (clipped to the node) starting and ending in every bin.
+        unsigned int starts[k_bins] = {};
+        unsigned int ends[k_bins] = {};
+        for (auto index : indices) {
+            const float low = std::max(triangle_bounds[index].min_corner[axis], axis_min);
+            const float high = std::min(triangle_bounds[index].max_corner[axis], axis_max);
+            starts[std::min(k_bins - 1, (unsigned int)((low - axis_min) / bin_width))]++;
+            ends[std::min(k_bins - 1, (unsigned int)((high - axis_min) / bin_width))]++;
         }
-        else {
-            for (auto& triangle : node->triangles_) {
-                float temp_t;
-                Triangle* hit_triangle;
-                if (triangle->IsHit(ray, temp_t, hit_triangle))
-                {
-                    std::pair<float, Triangle*> hit_pair = { temp_t , hit_triangle };
-                    hit_triangles.insert(hit_pair);
-                }
+
+        unsigned int below_count = 0;
+        unsigned int above_count = indices.size();
+        for (unsigned int i = 0; i < k_bins - 1; ++i) {
+            below_count += starts[i];
+            above_count -= ends[i];
+            const float split = axis_min + bin_width * (i + 1);
+
+            glm::vec3 below_max = node_bounds.max_corner;
+            glm::vec3 above_min = node_bounds.min_corner;
+            below_max[axis] = split;
+            above_min[axis] = split;
+            const float below_area = HalfArea(node_bounds.min_corner, below_max);
+            const float above_area = HalfArea(above_min, node_bounds.max_corner);
+
+            float cost = k_traversal_cost + k_intersection_cost *
+                         (below_area * below_count + above_area * above_count) / node_area;
+            if (below_count == 0 || above_count == 0) cost *= k_empty_bonus;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = split;
+                is_found = true;
             }
         }
     }
-    return hit_triangles.size() != 0;
+    return is_found;
 }
 
-KDNode* KDTree::Build(const std::vector<const Triangle*>& objects, int depth) const
+void KDTree::Build(unsigned int node_index, std::vector<TriangleIndex>& indices, const Bounds& node_bounds,
+                   const std::vector<Bounds>& triangle_bounds, unsigned int depth)
 {
-    KDNode* node = new KDNode(depth % 3, objects);
-    if (objects.size() > 128 && depth < 8) {
-        std::vector<const Triangle*> left, right;
-        for (auto & object : objects) {
-            for (auto i = 0; i < 3; ++i) {
-                if (object->GetPoints()[i][node->GetAxis()] <= node->GetPivot()) {
-                    left.emplace_back(object);
-                    break;
-                }
-            }
-            for (auto i = 0; i < 3; ++i) {
-                if (object->GetPoints()[i][node->GetAxis()] <= node->GetPivot()) {
-                    right.emplace_back(object);
-                    break;
-                }
-            
-            }
-        }
-        auto common = left.size() + right.size() - objects.size();
-        if (common * 4 < objects.size()) {
-            node->SetChildren(0, Build(left, depth + 1));
-            node->SetChildren(1, Build(right, depth + 1));
-        }
+    int axis = -1;
+    float split = 0.0f;
+    if (indices.size() <= k_min_leaf_size || depth >= max_depth_ ||
+        !FindSplit(indices, node_bounds, triangle_bounds, axis, split)) {
+        MakeLeaf(node_index, indices);
+        return;
+    }
+
+    // Triangles straddling the plane are referenced from both sides, planar ones go below.
+    std::vector<TriangleIndex> below, above;
+    for (auto index : indices) {
+        const float low = triangle_bounds[index].min_corner[axis];
+        const float high = triangle_bounds[index].max_corner[axis];
+        if (low < split || (low == split && high == split)) below.push_back(index);
+        if (high > split) above.push_back(index);
+    }
+    if (below.size() == indices.size() && above.size() == indices.size()) {
+        MakeLeaf(node_index, indices);
+        return;
     }
-    return node;
+    indices.clear();
+    indices.shrink_to_fit();
+
+    Bounds below_bounds = node_bounds;
+    Bounds above_bounds = node_bounds;
+    below_bounds.max_corner[axis] = split;
+    above_bounds.min_corner[axis] = split;
+
+    nodes_[node_index].split = split;
+    nodes_[node_index].axis = axis;
+    nodes_[node_index].count = 0;
+
+    nodes_.push_back(KDNode{}); // lower child lives at node_index + 1
+    Build(node_index + 1, below, below_bounds, triangle_bounds, depth + 1);
+    const unsigned int upper_index = nodes_.size();
+    nodes_.push_back(KDNode{});
+    nodes_[node_index].first = upper_index;
+    Build(upper_index, above, above_bounds, triangle_bounds, depth + 1);
 }
 
-KDNode::KDNode(int axis, const std::vector<const Triangle*>& objects)
+bool KDTree::ClipToBounds(const TracingRay& ray, float& t_min, float& t_max) const
 {
-    axis_ = axis;
-    children_[0] = nullptr;
-    children_[1] = nullptr;
-    triangles_ = objects;
-    corners_ = {
-        std::numeric_limits<float>::max() * glm::vec3(1.0f,1.0f,1.0f),
-        std::numeric_limits<float>::min() * glm::vec3(1.0f,1.0f,1.0f)
+    t_min = ray.t_min;
+    t_max = ray.t_max;
+    for (int axis = 0; axis < 3; ++axis) {
+        float t_1 = (bounds_.min_corner[axis] - ray.origin[axis]) * ray.inverse_direction[axis];
+        float t_2 = (bounds_.max_corner[axis] - ray.origin[axis]) * ray.inverse_direction[axis];
+        if (t_1 > t_2) std::swap(t_1, t_2);
+        // A ray parallel to the slab gives NaN when it starts on the plane, treat it as inside.
+        if (t_1 == t_1) t_min = std::max(t_min, t_1);
+        if (t_2 == t_2) t_max = std::min(t_max, t_2);
+    }
+    return t_min <= t_max;
+}
+
+template<typename Visit>
+void KDTree::Traverse(const TracingRay& ray, Visit&& visit_leaf) const
+{
+    float t_min, t_max;
+    if (nodes_.empty() || !ClipToBounds(ray, t_min, t_max)) return;
+    const glm::vec3& origin = ray.origin;
+    const glm::vec3& direction = ray.direction;
+
+    struct StackEntry {
+        unsigned int node_index;
+        float t_min;
+        float t_max;
     };
-    pivot_ = 0.0f;
-    if (!triangles_.empty()) return;
-    // Determine corners
-    for (auto& triangle : triangles_) {
-        for (auto& vertex : triangle->GetPoints()) {
-            pivot_ += vertex[axis] / (objects.size() * 3);
-            for (auto i = 0; i < 3; ++i) {
-                if (vertex[i] < corners_[0][i]) corners_[0][i] = vertex[i];
-                if (vertex[i] > corners_[1][i]) corners_[1][i] = vertex[i];
+    StackEntry stack[k_stack_size];
+    unsigned int stack_size = 0;
+    unsigned int node_index = 0;
+    while (true) {
+        const KDNode* node = &nodes_[node_index];
+        while (!node->IsLeaf()) {
+            const unsigned int axis = node->axis;
+            const bool is_lower_first = origin[axis] < node->split ||
+                                        (origin[axis] == node->split && direction[axis] <= 0.0f);
+            const unsigned int near_index = is_lower_first ? node_index + 1 : node->first;
+            const unsigned int far_index = is_lower_first ? node->first : node_index + 1;
+
+            if (direction[axis] == 0.0f) {
+                node_index = near_index;
+            } else {
+                const float t_split = (node->split - origin[axis]) * ray.inverse_direction[axis];
+                if (t_split > t_max || t_split <= 0.0f) {
+                    node_index = near_index;
+                } else if (t_split < t_min) {
+                    node_index = far_index;
+                } else {
+                    stack[stack_size++] = StackEntry{ far_index, t_split, t_max };
+                    node_index = near_index;
+                    t_max = t_split;
+                }
             }
+            node = &nodes_[node_index];
         }
+        if (visit_leaf(*node, t_min, t_max)) return;
+        if (stack_size == 0) return;
+        const StackEntry& entry = stack[--stack_size];
+        node_index = entry.node_index;
+        t_min = entry.t_min;
+        t_max = entry.t_max;
     }
 }
 
-KDNode::~KDNode()
+bool KDTree::IsClosestHit(const TracingRay& ray, float& t) const
 {
-    delete children_[0];
-    delete children_[1];
+    TriangleIndex hit_triangle;
+    return IsClosestHit(ray, t, hit_triangle);
 }
 
-int KDNode::GetAxis()
+bool KDTree::IsClosestHit(const TracingRay& ray, float& t, TriangleIndex& hit_triangle) const
 {
-    return axis_;
+    float closest_t = ray.t_max;
+    bool is_hit = false;
+    TriangleIndex closest_triangle = 0;
+    Traverse(ray, [&](const KDNode& leaf, float, float t_max) {
+        for (unsigned int i = leaf.first; i < leaf.first + leaf.count; ++i) {
+            const TriangleIndex triangle = leaf_indices_[i];
+            float temp_t;
+            if (triangles_.IsHit(triangle, ray, temp_t) && temp_t < closest_t) {
+                closest_t = temp_t;
+                closest_triangle = triangle;
+                is_hit = true;
+            }
+        }
+        // Cells are visited front to back, a hit inside this cell cannot be beaten.
+        return closest_t <= t_max;
+    });
+    if (!is_hit) return false;
+    t = closest_t;
+    hit_triangle = closest_triangle;
+    return true;
 }
 
-KDNode* KDNode::GetChildren(unsigned int i)
+bool KDTree::IsSomeHit(const TracingRay& ray, std::set<std::pair<float, TriangleIndex>>& hit_triangles) const
 {
-    return children_[i];
+    bool is_hit = false;
+    Traverse(ray, [&](const KDNode& leaf, float, float) {
+        for (unsigned int i = leaf.first; i < leaf.first + leaf.count; ++i) {
+            const TriangleIndex triangle = leaf_indices_[i];
+            float temp_t;
+            if (triangles_.IsHit(triangle, ray, temp_t)) {
+                hit_triangles.insert(std::pair{ temp_t, triangle });
+                is_hit = true;
+            }
+        }
+        return false;
+    });
+    return is_hit;
 }
 
-void KDNode::SetChildren(unsigned int index, KDNode * node)
+bool KDTree::IsSomeHit(const TracingRay& ray, std::unordered_map<TriangleIndex, float>& hit_triangles) const
 {
-    children_[index] = node;
+    bool is_hit = false;
+    Traverse(ray, [&](const KDNode& leaf, float, float) {
+        for (unsigned int i = leaf.first; i < leaf.first + leaf.count; ++i) {
+            const TriangleIndex triangle = leaf_indices_[i];
+            float temp_t;
+            if (triangles_.IsHit(triangle, ray, temp_t)) {
+                hit_triangles[triangle] = temp_t;
+                is_hit = true;
+            }
+        }
+        return false;
+    });
+    return is_hit;
 }
 
-glm::vec3 KDNode::GetCorner(unsigned int index)
+bool KDTree::IsAnyHit(const TracingRay& ray) const
 {
-    return glm::vec3(corners_[index]);
+    bool is_hit = false;
+    Traverse(ray, [&](const KDNode& leaf, float, float) {
+        for (unsigned int i = leaf.first; i < leaf.first + leaf.count; ++i) {
+            float temp_t;
+            if (triangles_.IsHit(leaf_indices_[i], ray, temp_t)) {
+                is_hit = true;
+                return true;
+            }
+        }
+        return false;
+    });
+    return is_hit;
 }
-
-float KDNode::GetPivot()
-{
-    return pivot_;
-}
\ No newline at end of file
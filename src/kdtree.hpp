@@ -3,55 +3,59 @@
 
 #include <vector>
 #include <set>
+#include <unordered_map>
+#include <utility>
 
 #include <glm/glm.hpp>
 
-class Triangle;
-class Ray;
-class HitRecord;
+#include "triangle_buffer.hpp"
+#include "tracing_ray.hpp"
 
-class KDNode {
-public:
-	KDNode(int axis, const std::vector<const Triangle*>& objects);
-	~KDNode();
-
-	int GetAxis();
-	KDNode* GetChildren(unsigned int index);
-	void SetChildren(unsigned int index, KDNode * node);
-	float GetPivot();
-	glm::vec3 GetCorner(unsigned int index);
-
-	std::vector<const Triangle*> triangles_;
-
-private:
-	int axis_;
-	KDNode* children_[2];
-	std::vector<glm::vec3> corners_;
-	float pivot_;
+// Flat node of the tree, the lower child of an inner node is always stored right after it.
+struct KDNode {
+	float split; // position of the split plane
+	unsigned int axis; // 0, 1, 2 for the split axis, k_leaf for leaves
+	unsigned int first; // inner node: index of the upper child, leaf: first entry in the leaf index list
+	unsigned int count; // number of triangles in the leaf
 
+	static constexpr unsigned int k_leaf = 3;
+	bool IsLeaf() const { return axis == k_leaf; }
 };
 
 class KDTree {
 
 public:
-	KDTree(const std::vector<const Triangle*>& objects);
+	KDTree(const TriangleBuffer& triangles);
 	~KDTree();
-	bool IsClosestHit(const Ray & ray, float & t) const;
-	bool IsSomeHit(const Ray& ray, std::set<std::pair<float, Triangle*>>& hit_triangles) const;
+	bool IsClosestHit(const TracingRay & ray, float & t) const;
+	bool IsClosestHit(const TracingRay& ray, float& t, TriangleIndex& hit_triangle) const;
+	bool IsSomeHit(const TracingRay& ray, std::set<std::pair<float, TriangleIndex>>& hit_triangles) const;
+	bool IsSomeHit(const TracingRay& ray, std::unordered_map<TriangleIndex, float>& hit_triangles) const;
+	bool IsAnyHit(const TracingRay& ray) const; // occlusion, stops at the first hit inside the t range
+
+	unsigned int GetNodeCount() const;
+	unsigned int GetLeafReferenceCount() const;
 private:
-	KDNode * root_;
-	KDNode* Build(const std::vector<const Triangle*>& objects, int depth) const;
-	bool IsClosestHit(const Ray& ray, KDNode * node, float & t, int depth) const;
-	bool IsSomeHit(const Ray& ray, KDNode* node, std::set<std::pair<float, Triangle*>>& hit_triangles, int depth) const;
+	struct Bounds {
+		glm::vec3 min_corner;
+		glm::vec3 max_corner;
+	};
+
+	void Build(unsigned int node_index, std::vector<TriangleIndex>& indices, const Bounds& node_bounds,
+	           const std::vector<Bounds>& triangle_bounds, unsigned int depth);
+	void MakeLeaf(unsigned int node_index, const std::vector<TriangleIndex>& indices);
+	bool FindSplit(const std::vector<TriangleIndex>& indices, const Bounds& node_bounds,
+	               const std::vector<Bounds>& triangle_bounds, int& best_axis, float& best_split) const;
+	bool ClipToBounds(const TracingRay& ray, float& t_min, float& t_max) const;
+
+	template<typename Visit>
+	void Traverse(const TracingRay& ray, Visit&& visit_leaf) const;
+
+	std::vector<KDNode> nodes_;
+	std::vector<TriangleIndex> leaf_indices_; // triangle indices of all leaves, one contiguous range per leaf
+	const TriangleBuffer& triangles_;
+	Bounds bounds_;
+	unsigned int max_depth_;
 };
 
-/*class Intersection {
-public:
-	float hit_distance;
-	glm::vec3 position;
-	const Triangle * surface;
-
-	static const Intersection MISS;
-};*/
-//const Intersection::MISS = { hit_distance = std::numberic_limit<float>::max() };
-#endif // !KDTREE_H
\ No newline at end of file
+#endif // !KDTREE_H
@@ -1,10 +1,12 @@
 #include<iostream>
 #include <string>
+#include <filesystem>
 
 #define GLM_FORCE_CUDA
 
 #include "window.hpp"
 #include "engine.hpp"
+#include "polygon_mesh.hpp"
 #include <glm/gtx/string_cast.hpp>
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
@@ -77,7 +79,40 @@ static void TCPServer(Engine * engine){
     }
 }
 
+// Builds everything the engine needs from the map once and stores it next to the map, where
+// PolygonMesh finds it until the map changes.
+static int CompileScene(int argc, char *argv[]){
+    if (argc < 3) {
+        std::cout << "Usage: WCSim compile <map.obj>\n";
+        return 1;
+    }
+    const std::string input = argv[2];
+    const std::string output = PolygonMesh::GetScenePath(input);
+    // Stamped before reading, so a map changed meanwhile makes the scene out of date.
+    std::error_code error;
+    const std::uint64_t source_size = std::filesystem::file_size(input, error);
+    const std::int64_t source_time = error ? 0 : std::filesystem::last_write_time(input, error).time_since_epoch().count();
+    if (error) {
+        std::cout << "Couldn't open the map: " << input << std::endl;
+        return 1;
+    }
+    PolygonMesh map(input, nullptr, false);
+    if (map.IsCompiled()) {
+        std::cout << output << " is up to date" << std::endl;
+        return 0;
+    }
+    if (map.GetTriangles().Empty()) return 1;
+    map.BuildHeightMap();
+    if (!map.SaveScene(output, source_size, source_time)) {
+        std::cout << "Couldn't write the scene: " << output << std::endl;
+        return 1;
+    }
+    std::cout << "Compiled " << input << " to " << output << std::endl;
+    return 0;
+}
+
 int main(int argc, char *argv[]){
+    if (argc >= 2 && std::string(argv[1]) == "compile") return CompileScene(argc, argv);
     std::cout << "Welcome to WCSim, the Wireless Communication Simulator\n";
     
     // Question 1: Turn on TCP Server?
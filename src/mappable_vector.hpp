@@ -0,0 +1,75 @@
+#ifndef MAPPABLE_VECTOR_H
+#define MAPPABLE_VECTOR_H
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "aligned_allocator.hpp"
+
+// Array that either owns its elements, like a std::vector, or views elements it does not own,
+// e.g. a section of a memory mapped scene file. A borrowed array is read in place; the first
+// change copies it into owned storage. Only const access is given to the raw data, so nothing
+// writes through into a read-only mapping.
+template<typename T, typename Allocator = std::allocator<T>>
+class MappableVector {
+public:
+	typedef T value_type;
+
+	MappableVector() : view_(nullptr), view_size_(0) {}
+
+	// The memory has to outlive the array or the next Borrow, Clear or change.
+	void Borrow(const T* data, std::size_t size)
+	{
+		std::vector<T, Allocator>().swap(elements_);
+		view_ = data;
+		view_size_ = size;
+	}
+	bool IsBorrowed() const { return view_ != nullptr; }
+
+	std::size_t size() const { return view_ != nullptr ? view_size_ : elements_.size(); }
+	bool empty() const { return size() == 0; }
+	const T* data() const { return view_ != nullptr ? view_ : elements_.data(); }
+
+	const T& operator[](std::size_t index) const { return data()[index]; }
+	T& operator[](std::size_t index) { MakeOwned(); return elements_[index]; }
+	const T& back() const { return data()[size() - 1]; }
+	T& back() { MakeOwned(); return elements_.back(); }
+	const T* begin() const { return data(); }
+	const T* end() const { return data() + size(); }
+	T* begin() { MakeOwned(); return elements_.data(); }
+	T* end() { MakeOwned(); return elements_.data() + elements_.size(); }
+
+	void push_back(const T& value) { MakeOwned(); elements_.push_back(value); }
+	template<typename... Arguments>
+	void emplace_back(Arguments&&... arguments) { MakeOwned(); elements_.emplace_back(std::forward<Arguments>(arguments)...); }
+	void reserve(std::size_t count) { MakeOwned(); elements_.reserve(count); }
+	void resize(std::size_t count) { MakeOwned(); elements_.resize(count); }
+	void resize(std::size_t count, const T& value) { MakeOwned(); elements_.resize(count, value); }
+	void assign(std::size_t count, const T& value) { Drop(); elements_.assign(count, value); }
+	void clear() { Drop(); elements_.clear(); }
+	void shrink_to_fit() { MakeOwned(); elements_.shrink_to_fit(); }
+
+private:
+	void MakeOwned()
+	{
+		if (view_ == nullptr) return;
+		elements_.assign(view_, view_ + view_size_);
+		Drop();
+	}
+	void Drop()
+	{
+		view_ = nullptr;
+		view_size_ = 0;
+	}
+
+	std::vector<T, Allocator> elements_;
+	const T* view_;
+	std::size_t view_size_;
+};
+
+template<typename T>
+using AlignedMappableVector = MappableVector<T, AlignedAllocator<T>>;
+
+#endif // !MAPPABLE_VECTOR_H
@@ -0,0 +1,121 @@
+#include "mapped_file.hpp"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile() : data_(nullptr), size_(0), is_open_(false), file_(nullptr), mapping_(nullptr)
+{
+}
+#else
+MappedFile::MappedFile() : data_(nullptr), size_(0), is_open_(false)
+{
+}
+#endif
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+    file_ = file;
+    size_ = (std::size_t)size.QuadPart;
+    is_open_ = true;
+    if (size_ == 0) return true;
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* data = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (data == nullptr) {
+        if (mapping != nullptr) CloseHandle(mapping);
+        Close();
+        return false;
+    }
+    mapping_ = mapping;
+    data_ = static_cast<const char*>(data);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data_ != nullptr) UnmapViewOfFile(data_);
+    if (mapping_ != nullptr) CloseHandle((HANDLE)mapping_);
+    if (file_ != nullptr) CloseHandle((HANDLE)file_);
+    data_ = nullptr;
+    mapping_ = file_ = nullptr;
+    size_ = 0;
+    is_open_ = false;
+}
+#else
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) return false;
+    struct stat status;
+    if (fstat(file, &status) != 0) {
+        close(file);
+        return false;
+    }
+    size_ = (std::size_t)status.st_size;
+    if (size_ > 0) {
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file, 0);
+        if (data == MAP_FAILED) {
+            close(file);
+            size_ = 0;
+            return false;
+        }
+        data_ = static_cast<const char*>(data);
+    }
+    // The mapping keeps the file alive.
+    close(file);
+    is_open_ = true;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data_ != nullptr) munmap(const_cast<char*>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+    is_open_ = false;
+}
+#endif
+
+bool MappedFile::IsOpen() const
+{
+    return is_open_;
+}
+
+const char* MappedFile::GetData() const
+{
+    return data_;
+}
+
+std::size_t MappedFile::GetSize() const
+{
+    return size_;
+}
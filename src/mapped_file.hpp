@@ -0,0 +1,34 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only view of a whole file mapped into memory (mmap, or a file mapping on Windows).
+// The pages are loaded by the OS on first touch and shared with its file cache.
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Replaces any file already open; an empty file opens with no data.
+	bool Open(const std::string& path);
+	void Close();
+	bool IsOpen() const;
+
+	const char* GetData() const;
+	std::size_t GetSize() const;
+
+private:
+	const char* data_;
+	std::size_t size_;
+	bool is_open_;
+#ifdef _WIN32
+	void* file_;
+	void* mapping_;
+#endif
+};
+
+#endif // !MAPPED_FILE_H
@@ -0,0 +1,294 @@
+#include "obj_loader.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <climits>
+#include <cstring>
+#include <unordered_map>
+
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
+
+namespace {
+    constexpr std::int32_t k_missing = INT32_MIN;
+
+    // Corner of a face as written in its chunk. A relative (negative) index is kept as an index
+    // into the chunk's own vertices, which can be negative, until the chunk offsets are known.
+    struct Corner {
+        std::int32_t index[3]; // position, uv, normal
+        std::uint8_t relative; // bit per component
+    };
+
+    struct Chunk {
+        const char* begin;
+        const char* end;
+
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec2> uvs;
+        std::vector<glm::vec3> normals;
+        std::vector<Corner> corners; // three per triangle
+        std::vector<std::int32_t> materials; // per triangle into names, -1 for the material the chunk starts with
+        std::vector<std::string> names;
+        std::int32_t last_material = -1;
+
+        // Set while stitching.
+        std::size_t position_offset = 0, uv_offset = 0, normal_offset = 0, triangle_offset = 0;
+        std::uint32_t start_material = 0;
+        std::vector<std::uint32_t> material_ids; // names to ObjMesh::material_names
+    };
+
+    bool IsBlank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    const char* SkipBlanks(const char* p, const char* end)
+    {
+        while (p < end && IsBlank(*p)) ++p;
+        return p;
+    }
+
+    // Up to count numbers, the ones missing or unreadable are left as they are.
+    void ParseFloats(const char* p, const char* end, float* values, unsigned int count)
+    {
+        for (unsigned int i = 0; i < count; ++i) {
+            p = SkipBlanks(p, end);
+            if (p < end && *p == '+') ++p;
+            const auto result = std::from_chars(p, end, values[i]);
+            if (result.ec != std::errc()) return;
+            p = result.ptr;
+        }
+    }
+
+    // One corner token, p is left at its end. False for a token that is not a corner.
+    bool ParseCorner(const char*& p, const char* end, const std::size_t counts[3], Corner& corner)
+    {
+        corner.index[0] = corner.index[1] = corner.index[2] = k_missing;
+        corner.relative = 0;
+        bool is_valid = true;
+        for (unsigned int component = 0; component < 3; ++component) {
+            if (component > 0) {
+                if (p >= end || *p != '/') break;
+                ++p;
+            }
+            long long value = 0;
+            const auto result = std::from_chars(p, end, value);
+            if (result.ec != std::errc()) {
+                if (component == 0) is_valid = false; // v//vn leaves only the uv empty
+                continue;
+            }
+            p = result.ptr;
+            if (value > 0 && value <= INT32_MAX) {
+                corner.index[component] = (std::int32_t)(value - 1);
+            } else if (value < 0 && (long long)counts[component] + value > INT32_MIN &&
+                       (long long)counts[component] + value <= INT32_MAX) {
+                corner.index[component] = (std::int32_t)((long long)counts[component] + value);
+                corner.relative |= 1u << component;
+            } else {
+                is_valid = false;
+            }
+        }
+        // Anything else glued to the token makes it unreadable.
+        if (p < end && !IsBlank(*p)) {
+            is_valid = false;
+            while (p < end && !IsBlank(*p)) ++p;
+        }
+        return is_valid;
+    }
+
+    void ParseFace(const char* p, const char* end, Chunk& chunk, std::vector<Corner>& polygon)
+    {
+        const std::size_t counts[3] = { chunk.positions.size(), chunk.uvs.size(), chunk.normals.size() };
+        polygon.clear();
+        bool is_valid = true;
+        for (p = SkipBlanks(p, end); p < end; p = SkipBlanks(p, end)) {
+            Corner corner;
+            if (!ParseCorner(p, end, counts, corner)) is_valid = false;
+            polygon.push_back(corner);
+        }
+        if (!is_valid || polygon.size() < 3) return;
+        for (std::size_t i = 1; i + 1 < polygon.size(); ++i) {
+            chunk.corners.push_back(polygon[0]);
+            chunk.corners.push_back(polygon[i]);
+            chunk.corners.push_back(polygon[i + 1]);
+            chunk.materials.push_back(chunk.last_material);
+        }
+    }
+
+    void ParseChunk(Chunk& chunk)
+    {
+        std::vector<Corner> polygon;
+        const char* line = chunk.begin;
+        while (line < chunk.end) {
+            const char* line_end = static_cast<const char*>(std::memchr(line, '\n', chunk.end - line));
+            if (line_end == nullptr) line_end = chunk.end;
+            const char* p = SkipBlanks(line, line_end);
+            const std::size_t length = line_end - p;
+            if (length >= 2 && p[0] == 'v' && IsBlank(p[1])) {
+                glm::vec3 position(0.0f);
+                ParseFloats(p + 2, line_end, &position.x, 3);
+                chunk.positions.push_back(position);
+            } else if (length >= 3 && p[0] == 'v' && p[1] == 't' && IsBlank(p[2])) {
+                glm::vec2 uv(0.0f);
+                ParseFloats(p + 3, line_end, &uv.x, 2);
+                chunk.uvs.push_back(uv);
+            } else if (length >= 3 && p[0] == 'v' && p[1] == 'n' && IsBlank(p[2])) {
+                glm::vec3 normal(0.0f);
+                ParseFloats(p + 3, line_end, &normal.x, 3);
+                chunk.normals.push_back(normal);
+            } else if (length >= 2 && p[0] == 'f' && IsBlank(p[1])) {
+                ParseFace(p + 2, line_end, chunk, polygon);
+            } else if (length >= 7 && std::memcmp(p, "usemtl", 6) == 0 && IsBlank(p[6])) {
+                const char* name = SkipBlanks(p + 7, line_end);
+                const char* name_end = line_end;
+                while (name_end > name && IsBlank(name_end[-1])) --name_end;
+                const std::string material(name, name_end);
+                const auto found = std::find(chunk.names.begin(), chunk.names.end(), material);
+                chunk.last_material = (std::int32_t)(found - chunk.names.begin());
+                if (found == chunk.names.end()) chunk.names.push_back(material);
+            }
+            line = line_end + 1;
+        }
+    }
+
+    // Index of a corner component in the whole file, k_no_index when missing or out of range.
+    std::uint32_t Resolve(const Corner& corner, unsigned int component, std::size_t offset, std::size_t count)
+    {
+        if (corner.index[component] == k_missing) return ObjMesh::k_no_index;
+        long long index = corner.index[component];
+        if (corner.relative & (1u << component)) index += (long long)offset;
+        if (index < 0 || index >= (long long)count) return ObjMesh::k_no_index;
+        return (std::uint32_t)index;
+    }
+}
+
+std::size_t ObjMesh::GetTriangleCount() const
+{
+    return position_indices.size() / 3;
+}
+
+void ObjMesh::Clear()
+{
+    positions.clear();
+    uvs.clear();
+    normals.clear();
+    position_indices.clear();
+    uv_indices.clear();
+    normal_indices.clear();
+    materials.clear();
+    material_names.clear();
+}
+
+bool ObjLoader::Load(const std::string& path, ObjMesh& mesh)
+{
+    MappedFile file;
+    if (!file.Open(path)) return false;
+    return Parse(file.GetData(), file.GetSize(), mesh);
+}
+
+bool ObjLoader::Parse(const char* data, std::size_t size, ObjMesh& mesh)
+{
+    mesh.Clear();
+    mesh.material_names.push_back("");
+    if (size == 0) return true;
+
+    // Chunks end after a line break, a line longer than a chunk leaves the next ones empty.
+    const std::size_t chunk_count = (size + k_chunk_size - 1) / k_chunk_size;
+    std::vector<Chunk> chunks(chunk_count);
+    const char* const end = data + size;
+    const char* begin = data;
+    for (std::size_t i = 0; i < chunk_count; ++i) {
+        const char* chunk_end = end;
+        if (i + 1 < chunk_count) {
+            const char* nominal = std::max(begin, data + (i + 1) * k_chunk_size);
+            const char* line_break = nominal < end ? static_cast<const char*>(std::memchr(nominal, '\n', end - nominal)) : nullptr;
+            chunk_end = line_break != nullptr ? line_break + 1 : end;
+        }
+        chunks[i].begin = begin;
+        chunks[i].end = chunk_end;
+        begin = chunk_end;
+    }
+
+    ThreadPool& pool = ThreadPool::GetInstance();
+    pool.ParallelFor(0, chunk_count, 1, [&chunks](std::size_t i) { ParseChunk(chunks[i]); });
+
+    // Offsets of every chunk and the materials it starts with, in file order.
+    std::size_t position_count = 0, uv_count = 0, normal_count = 0, triangle_count = 0;
+    std::unordered_map<std::string, std::uint32_t> material_ids = { { "", 0 } };
+    std::uint32_t current_material = 0;
+    for (auto& chunk : chunks) {
+        chunk.position_offset = position_count;
+        chunk.uv_offset = uv_count;
+        chunk.normal_offset = normal_count;
+        chunk.triangle_offset = triangle_count;
+        position_count += chunk.positions.size();
+        uv_count += chunk.uvs.size();
+        normal_count += chunk.normals.size();
+        triangle_count += chunk.materials.size();
+
+        chunk.start_material = current_material;
+        for (const auto& name : chunk.names) {
+            const auto inserted = material_ids.insert({ name, (std::uint32_t)mesh.material_names.size() });
+            if (inserted.second) mesh.material_names.push_back(name);
+            chunk.material_ids.push_back(inserted.first->second);
+        }
+        if (chunk.last_material >= 0) current_material = chunk.material_ids[chunk.last_material];
+    }
+
+    mesh.positions.resize(position_count);
+    mesh.uvs.resize(uv_count);
+    mesh.normals.resize(normal_count);
+    mesh.position_indices.resize(triangle_count * 3);
+    mesh.uv_indices.resize(triangle_count * 3);
+    mesh.normal_indices.resize(triangle_count * 3);
+    mesh.materials.resize(triangle_count);
+
+    std::atomic<std::size_t> dropped_count(0);
+    pool.ParallelFor(0, chunk_count, 1, [&](std::size_t i) {
+        Chunk& chunk = chunks[i];
+        std::copy(chunk.positions.begin(), chunk.positions.end(), mesh.positions.begin() + chunk.position_offset);
+        std::copy(chunk.uvs.begin(), chunk.uvs.end(), mesh.uvs.begin() + chunk.uv_offset);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), mesh.normals.begin() + chunk.normal_offset);
+        std::size_t dropped = 0;
+        for (std::size_t triangle = 0; triangle < chunk.materials.size(); ++triangle) {
+            const std::size_t target = chunk.triangle_offset + triangle;
+            bool is_valid = true;
+            for (unsigned int corner = 0; corner < 3; ++corner) {
+                const Corner& source = chunk.corners[triangle * 3 + corner];
+                const std::uint32_t position = Resolve(source, 0, chunk.position_offset, position_count);
+                is_valid = is_valid && position != ObjMesh::k_no_index;
+                mesh.position_indices[target * 3 + corner] = position;
+                mesh.uv_indices[target * 3 + corner] = Resolve(source, 1, chunk.uv_offset, uv_count);
+                mesh.normal_indices[target * 3 + corner] = Resolve(source, 2, chunk.normal_offset, normal_count);
+            }
+            if (!is_valid) ++dropped;
+            const std::int32_t material = chunk.materials[triangle];
+            mesh.materials[target] = material < 0 ? chunk.start_material : chunk.material_ids[material];
+        }
+        dropped_count += dropped;
+    });
+
+    // Faces pointing outside the vertices are dropped, keeping the order of the others.
+    if (dropped_count.load() > 0) {
+        std::size_t kept = 0;
+        for (std::size_t triangle = 0; triangle < triangle_count; ++triangle) {
+            const std::uint32_t* corners = &mesh.position_indices[triangle * 3];
+            if (corners[0] == ObjMesh::k_no_index || corners[1] == ObjMesh::k_no_index ||
+                corners[2] == ObjMesh::k_no_index)
+                continue;
+            for (unsigned int corner = 0; corner < 3; ++corner) {
+                mesh.position_indices[kept * 3 + corner] = mesh.position_indices[triangle * 3 + corner];
+                mesh.uv_indices[kept * 3 + corner] = mesh.uv_indices[triangle * 3 + corner];
+                mesh.normal_indices[kept * 3 + corner] = mesh.normal_indices[triangle * 3 + corner];
+            }
+            mesh.materials[kept] = mesh.materials[triangle];
+            ++kept;
+        }
+        mesh.position_indices.resize(kept * 3);
+        mesh.uv_indices.resize(kept * 3);
+        mesh.normal_indices.resize(kept * 3);
+        mesh.materials.resize(kept);
+    }
+    return true;
+}
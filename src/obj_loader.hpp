@@ -0,0 +1,43 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Triangulated geometry of an OBJ file, three corners per triangle in every index array.
+struct ObjMesh {
+	static constexpr std::uint32_t k_no_index = 0xffffffffu;
+
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	std::vector<std::uint32_t> position_indices;
+	std::vector<std::uint32_t> uv_indices; // k_no_index where the face gives none
+	std::vector<std::uint32_t> normal_indices; // k_no_index where the face gives none
+	std::vector<std::uint32_t> materials; // per triangle, into material_names
+	std::vector<std::string> material_names; // [0] is the unnamed material before any usemtl
+
+	std::size_t GetTriangleCount() const;
+	void Clear();
+};
+
+// OBJ reader for large maps. The file is memory mapped and cut into chunks at line ends, the
+// chunks are parsed on the ThreadPool and stitched together in order, so the result does not
+// depend on the thread count.
+//
+// Reads v, vt, vn, usemtl and f with any of the corner forms v, v/vt, v//vn and v/vt/vn, negative
+// (relative) indices included. Polygons are split into a fan of triangles around their first
+// corner. Other statements are skipped, faces with a missing or out of range position are dropped.
+class ObjLoader {
+public:
+	static constexpr std::size_t k_chunk_size = 4 << 20; // bytes per parse task
+
+	static bool Load(const std::string& path, ObjMesh& mesh);
+	static bool Parse(const char* data, std::size_t size, ObjMesh& mesh);
+};
+
+#endif // !OBJ_LOADER_H
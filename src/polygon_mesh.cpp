@@ -5,6 +5,7 @@
 #include<iostream>
 #include<set>
 #include<limits>
+#include<filesystem>
 
 #include<glad/glad.h>
 #include<GLFW/glfw3.h>
@@ -15,21 +16,24 @@
 #include <glm/gtx/string_cast.hpp>
 
 #include "kdtree.hpp"
-#include "ray.hpp"
+#include "bvh.hpp"
+#include "obj_loader.hpp"
+#include "scene_file.hpp"
+#include "thread_pool.hpp"
 
-#include "triangle.hpp"
 #include "shader.hpp"
 #include "camera.hpp"
 #include "radiation_pattern.hpp"
 
 
-PolygonMesh::PolygonMesh(const RadiationPattern & radiation_pattern)
+PolygonMesh::PolygonMesh(const RadiationPattern & radiation_pattern) : tree_(nullptr),
+                                                                         bvh_(nullptr),
+                                                                         acceleration_(AccelerationStructure::kBruteForce)
 {
     shader_ = Object::default_shader_;
     model_ = glm::mat4(1.0f);
 
     /// Adding pattern to vertices
-    auto pattern = radiation_pattern.pattern_;
 
     // For Normalization of Pattern
     bool is_dB = false;
@@ -48,10 +52,10 @@ PolygonMesh::PolygonMesh(const RadiationPattern & radiation_pattern)
             float r_phi = phi % 180;
             float r_phi_s = (phi + step) % 360;
 
-            float gain_1 = pattern[r_theta][r_phi];
-            float gain_2 = pattern[t_theta_s][r_phi];
-            float gain_3 = pattern[t_theta_s][r_phi_s];
-            float gain_4 = pattern[r_theta][r_phi_s];
+            float gain_1 = radiation_pattern.GetGain(glm::radians(r_theta), glm::radians(r_phi));
+            float gain_2 = radiation_pattern.GetGain(glm::radians(t_theta_s), glm::radians(r_phi));
+            float gain_3 = radiation_pattern.GetGain(glm::radians(t_theta_s), glm::radians(r_phi_s));
+            float gain_4 = radiation_pattern.GetGain(glm::radians(r_theta), glm::radians(r_phi_s));
             
             if (is_dB) {
                 gain_1 = (gain_1 + abs(min_dB)) / range;
@@ -92,6 +96,8 @@ PolygonMesh::PolygonMesh(const RadiationPattern & radiation_pattern)
 } 
 
 PolygonMesh::PolygonMesh(const std::string& path, Shader * shader, bool is_window_on) : tree_(nullptr),
+                                                                     bvh_(nullptr),
+                                                                     acceleration_(AccelerationStructure::kBVH),
                                                                      vao_(0),
                                                                      vbo_(0)
 {
@@ -105,11 +111,26 @@ PolygonMesh::PolygonMesh(const std::string& path, Shader * shader, bool is_windo
     shader_ = shader;
     model_ = glm::mat4(1.0f);
 
-    LoadObj(path); // Create vertices, uv, normal
-    tree_ = new KDTree(objects_);
+    // Everything comes prebuilt with the compiled scene, except the KD tree.
+    std::error_code error;
+    const std::uint64_t source_size = std::filesystem::file_size(path, error);
+    const std::int64_t source_time = error ? 0 : std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    const std::string scene_path = GetScenePath(path);
+    if (error || !std::filesystem::exists(scene_path, error) || !LoadScene(scene_path, source_size, source_time)) {
+        LoadObj(path); // Create vertices, uv, normal and the BVH
+        tree_ = new KDTree(triangles_);
+    }
+    // Nothing loaded: the tests run over the (empty) triangles directly.
+    acceleration_ = bvh_ != nullptr ? AccelerationStructure::kBVH : AccelerationStructure::kBruteForce;
     if(is_window_on) SetupMesh();
 }
 
+PolygonMesh::~PolygonMesh()
+{
+    delete tree_;
+    delete bvh_;
+}
+
 bool PolygonMesh::LoadObj(const std::string& path)
 {
     // Load the obj file to triangles and vertices for visualisation
@@ -119,58 +140,159 @@ bool PolygonMesh::LoadObj(const std::string& path)
     } 
     else
     {
-        std::ifstream input_file_stream(path, std::ios::in);
-
-        std::vector<glm::vec3> vertices, normals;
-        std::vector<glm::vec2> uvs;
-        std::vector<unsigned int> vertex_indices, uv_indices, normal_indices;
-
-        for (std::string buffer; input_file_stream >> buffer;) {
-            if (buffer == "v") {
-                float x, y, z;
-                input_file_stream >> x >> y >> z;
-                if(x > max_x_) max_x_ = x;
-                if(x < min_x_) min_x_ = x;
-                if(z > max_z_) max_z_ = z;
-                if(z < min_z_) min_z_ = z;
-                vertices.push_back(glm::vec3(x, y, z));
-            }
-            else if (buffer == "vn") {
-                float x, y, z;
-                input_file_stream >> x >> y >> z;
-                normals.push_back(glm::vec3(x, y, z));
-            }
-            else if (buffer == "vt") {
-                float x, y;
-                input_file_stream >> x >> y;
-                uvs.push_back(glm::vec2(x, y));
-            }
-            else if (buffer == "f") {
-                unsigned int vertex_index[3], uv_index[3], normal_index[3];
-                for (auto i = 0; i < 3; ++i) {
-                    char trash_char;
-                    input_file_stream >> vertex_index[i] >> trash_char
-                        >> uv_index[i] >> trash_char
-                        >> normal_index[i];
-                    --vertex_index[i];
-                    --uv_index[i];
-                    --normal_index[i];
-
-                    vertices_.push_back({ vertices[vertex_index[i]], uvs[uv_index[i]], normals[normal_index[i]] });
-                }
-
-                // Build triangles for ray tracer
-                const std::vector<glm::vec3> points = { vertices[vertex_index[0]], vertices[vertex_index[1]], vertices[vertex_index[2]] };
-                objects_.push_back(new Triangle(points, normals[normal_index[0]]));
-            }
+        ObjMesh mesh;
+        if (!ObjLoader::Load(path, mesh)) {
+            std::cout << "Couldn't open the map: " << path << std::endl;
+            return false;
         }
-        input_file_stream.close();
+        for (const auto& position : mesh.positions) {
+            if (position.x > max_x_) max_x_ = position.x;
+            if (position.x < min_x_) min_x_ = position.x;
+            if (position.z > max_z_) max_z_ = position.z;
+            if (position.z < min_z_) min_z_ = position.z;
+        }
+
+        const auto get_points = [&mesh](std::size_t face, glm::vec3* points, glm::vec3& face_normal) {
+            for (unsigned int corner = 0; corner < 3; ++corner)
+                points[corner] = mesh.positions[mesh.position_indices[face * 3 + corner]];
+            face_normal = glm::cross(points[1] - points[0], points[2] - points[0]);
+            face_normal = glm::length(face_normal) > 0.0f ? glm::normalize(face_normal) : glm::vec3(0.0f);
+        };
+
+        // Triangles for the ray tracer in file order, written in place.
+        const std::size_t triangle_count = mesh.GetTriangleCount();
+        triangles_.Resize(triangle_count);
+        ThreadPool::GetInstance().ParallelFor(0, triangle_count, 4096, [this, &mesh, &get_points](std::size_t face) {
+            glm::vec3 points[3], face_normal;
+            get_points(face, points, face_normal);
+            // The normal of the first corner, the face normal when the file has none.
+            const std::uint32_t first_normal = mesh.normal_indices[face * 3];
+            const glm::vec3 normal = first_normal != ObjMesh::k_no_index ? mesh.normals[first_normal] : face_normal;
+            triangles_.Set((TriangleIndex)face, points[0], points[1], points[2], normal);
+        });
+
+        // The BVH puts the triangles in its leaf order; everything else kept per triangle is
+        // numbered the same way from here on.
+        bvh_ = new BVH(triangles_);
+        std::vector<std::uint32_t> position_indices(triangle_count * 3);
+        vertices_.resize(triangle_count * 3);
+        materials_.resize(triangle_count);
+        material_names_ = mesh.material_names;
+        ThreadPool::GetInstance().ParallelFor(0, triangle_count, 4096, [this, &mesh, &get_points, &position_indices](std::size_t triangle) {
+            const std::size_t face = bvh_->GetSourceIndex((TriangleIndex)triangle);
+            glm::vec3 points[3], face_normal;
+            get_points(face, points, face_normal);
+            materials_[triangle] = mesh.materials[face];
+            for (unsigned int corner = 0; corner < 3; ++corner) {
+                position_indices[triangle * 3 + corner] = mesh.position_indices[face * 3 + corner];
+                const std::uint32_t uv = mesh.uv_indices[face * 3 + corner];
+                const std::uint32_t corner_normal = mesh.normal_indices[face * 3 + corner];
+                vertices_[triangle * 3 + corner] = { points[corner],
+                                                     uv != ObjMesh::k_no_index ? mesh.uvs[uv] : glm::vec2(0.0f),
+                                                     corner_normal != ObjMesh::k_no_index ? mesh.normals[corner_normal] : face_normal };
+            }
+        });
+
+        // Merge coplanar neighbours into facets, the reflections are traced per facet.
+        facets_.Build(triangles_, position_indices);
+        std::cout << "Facets: " << facets_.Size() << " from " << triangles_.Size() << " triangles" << std::endl;
+        // Diffracting edges for the knife-edge search.
+        edges_.Build(triangles_, position_indices, facets_);
+        std::cout << "Diffraction edges: " << edges_.Size() << std::endl;
     }
     std::cout << "Min X: " << min_x_ << ", Max X: " << max_x_ << std::endl;
     std::cout << "Min Z: " << min_z_ << ", Max Z: " << max_z_ << std::endl;
     return true;
 }
 
+bool PolygonMesh::LoadScene(const std::string& path, const std::uint64_t source_size, const std::int64_t source_time)
+{
+    // The trees index the triangles that are about to be replaced.
+    delete tree_;
+    delete bvh_;
+    tree_ = nullptr;
+    bvh_ = nullptr;
+    acceleration_ = AccelerationStructure::kBruteForce;
+    if (!scene_file_.Open(path)) {
+        std::cout << "Couldn't open the scene: " << path << std::endl;
+        return false;
+    }
+    SceneReader reader(scene_file_);
+    if (reader.IsGood() && !reader.IsSource(source_size, source_time)) {
+        std::cout << "The scene is out of date, run WCSim compile again: " << path << std::endl;
+        scene_file_.Close();
+        return false;
+    }
+    BVH* bvh = new BVH();
+    const char* names = nullptr;
+    std::size_t names_size = 0;
+    const bool is_read = reader.ReadValue(min_x_) && reader.ReadValue(max_x_) &&
+                         reader.ReadValue(min_z_) && reader.ReadValue(max_z_) &&
+                         triangles_.Read(reader) && reader.Read(materials_) && reader.Read(names, names_size) &&
+                         facets_.Read(reader, triangles_.Size()) && edges_.Read(reader) && height_map_.Read(reader) &&
+                         bvh->Read(reader, triangles_) && reader.Read(vertices_) && reader.IsAtEnd() &&
+                         materials_.size() == triangles_.Size() && vertices_.size() == (std::size_t)triangles_.Size() * 3;
+    if (!is_read) {
+        std::cout << "Couldn't read the scene, it is damaged or of another version: " << path << std::endl;
+        delete bvh;
+        min_x_ = max_x_ = min_z_ = max_z_ = 0.0f;
+        triangles_.Clear();
+        materials_.clear();
+        facets_.Clear();
+        edges_.Clear();
+        height_map_.Clear();
+        vertices_.clear();
+        scene_file_.Close();
+        return false;
+    }
+    bvh_ = bvh;
+    acceleration_ = AccelerationStructure::kBVH;
+
+    // Names are stored one after the other, each ending with a null character.
+    material_names_.clear();
+    for (const char* name = names; name < names + names_size; name += material_names_.back().size() + 1)
+        material_names_.emplace_back(name, std::find(name, names + names_size, '\0'));
+
+    std::cout << "Scene: " << triangles_.Size() << " triangles, " << facets_.Size() << " facets, "
+              << edges_.Size() << " diffraction edges, " << bvh_->GetNodeCount() << " BVH nodes" << std::endl;
+    return true;
+}
+
+bool PolygonMesh::SaveScene(const std::string& path, const std::uint64_t source_size, const std::int64_t source_time) const
+{
+    if (bvh_ == nullptr) return false;
+    std::string names;
+    for (const auto& name : material_names_) {
+        names += name;
+        names.push_back('\0');
+    }
+    SceneWriter writer;
+    if (!writer.Open(path, source_size, source_time)) return false;
+    writer.WriteValue(min_x_);
+    writer.WriteValue(max_x_);
+    writer.WriteValue(min_z_);
+    writer.WriteValue(max_z_);
+    triangles_.Write(writer);
+    writer.Write(materials_);
+    writer.Write(names.data(), names.size());
+    facets_.Write(writer);
+    edges_.Write(writer);
+    height_map_.Write(writer);
+    bvh_->Write(writer);
+    writer.Write(vertices_);
+    return writer.Close();
+}
+
+bool PolygonMesh::IsCompiled() const
+{
+    return scene_file_.IsOpen();
+}
+
+std::string PolygonMesh::GetScenePath(const std::string& obj_path)
+{
+    return std::filesystem::path(obj_path).replace_extension(SceneWriter::k_extension).string();
+}
+
 void PolygonMesh::SetupMesh()
 {
     glGenVertexArrays(1, &vao_);
@@ -178,7 +300,7 @@ void PolygonMesh::SetupMesh()
 
     glBindVertexArray(vao_);
     glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-    glBufferData(GL_ARRAY_BUFFER, vertices_.size() * sizeof(Vertex), &vertices_[0], GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, vertices_.size() * sizeof(Vertex), vertices_.data(), GL_STATIC_DRAW);
 
 
     glEnableVertexAttribArray(0);
@@ -194,13 +316,18 @@ void PolygonMesh::SetupMesh()
 
 }
 
-bool PolygonMesh::IsHit(Ray &ray, float & t) const
+bool PolygonMesh::IsHit(const TracingRay &ray, float & t) const
 {
+    if (acceleration_ == AccelerationStructure::kBVH) {
+        TriangleIndex hit_triangle;
+        return bvh_->IsClosestHit(ray, t, hit_triangle);
+    }
+    if (acceleration_ == AccelerationStructure::kKDTree)
+        return tree_->IsClosestHit(ray, t);
     float temp_t;
     std::set<float> t_list;
-    //return tree_->IsClosestHit(ray, t); ; /// to implement later, it hits but doesn't give correct t
-    for (auto object : objects_) {
-        if (object->IsHit(ray, temp_t)) {
+    for (TriangleIndex i = 0; i < triangles_.Size(); ++i) {
+        if (triangles_.IsHit(i, ray, temp_t)) {
             t_list.insert(temp_t);
         }
     }
@@ -210,16 +337,18 @@ bool PolygonMesh::IsHit(Ray &ray, float & t) const
     return true;
 }
 
-bool PolygonMesh::IsHit(Ray& ray, float& t, Triangle *& hit_triangle) const
+bool PolygonMesh::IsHit(const TracingRay& ray, float& t, TriangleIndex& hit_triangle) const
 {
+    if (acceleration_ == AccelerationStructure::kBVH)
+        return bvh_->IsClosestHit(ray, t, hit_triangle);
+    if (acceleration_ == AccelerationStructure::kKDTree)
+        return tree_->IsClosestHit(ray, t, hit_triangle);
     float temp_t;
-    std::set<std::pair<float, Triangle *>> t_list;
+    std::set<std::pair<float, TriangleIndex>> t_list;
 
-    //return tree_->IsHit(ray, t); ; /// to implement later, it hits but doesn't give correct t
-    for (auto object : objects_) {
-        Triangle * test_triangle = nullptr;
-        if (object->IsHit(ray, temp_t, test_triangle)) {
-            t_list.insert(std::pair{ temp_t , test_triangle});
+    for (TriangleIndex i = 0; i < triangles_.Size(); ++i) {
+        if (triangles_.IsHit(i, ray, temp_t)) {
+            t_list.insert(std::pair{ temp_t , i });
         }
     }
     if (t_list.size() == 0) return false;
@@ -229,16 +358,17 @@ bool PolygonMesh::IsHit(Ray& ray, float& t, Triangle *& hit_triangle) const
     return true;
 }
 
-bool PolygonMesh::IsHit(Ray& ray, std::set<std::pair<float,const Triangle*>> & hit_triangles) const
+bool PolygonMesh::IsHit(const TracingRay& ray, std::set<std::pair<float, TriangleIndex>> & hit_triangles) const
 {
+    if (acceleration_ == AccelerationStructure::kBVH)
+        return bvh_->IsHit(ray, hit_triangles);
+    if (acceleration_ == AccelerationStructure::kKDTree)
+        return tree_->IsSomeHit(ray, hit_triangles);
     float temp_t;
-    //std::vector<float, Triangle *> hit_list;
 
-    //return tree_->IsHit(ray, t); ; /// to implement later, it hits but doesn't give correct t
-    for (auto object : objects_) {
-        Triangle* test_triangle = nullptr;
-        if (object->IsHit(ray, temp_t, test_triangle)) {
-            hit_triangles.insert(std::pair{ temp_t, test_triangle });
+    for (TriangleIndex i = 0; i < triangles_.Size(); ++i) {
+        if (triangles_.IsHit(i, ray, temp_t)) {
+            hit_triangles.insert(std::pair{ temp_t, i });
         }
     }
     //std::cout << "hit triangles : " << hit_triangles.size() << std::endl;
@@ -246,25 +376,84 @@ bool PolygonMesh::IsHit(Ray& ray, std::set<std::pair<float,const Triangle*>> & h
     return true;
 }
 
-bool PolygonMesh::IsHit(Ray& ray, std::unordered_map<const Triangle*, float> & hit_triangles) const
+bool PolygonMesh::IsHit(const TracingRay& ray, std::unordered_map<TriangleIndex, float> & hit_triangles) const
 {
+    if (acceleration_ == AccelerationStructure::kBVH)
+        return bvh_->IsHit(ray, hit_triangles);
+    if (acceleration_ == AccelerationStructure::kKDTree)
+        return tree_->IsSomeHit(ray, hit_triangles);
     float temp_t;
-    //std::vector<float, Triangle *> hit_list;
 
-    //return tree_->IsHit(ray, t); ; /// to implement kd-tree later, it hits but doesn't give correct t
-    for (auto object : objects_) {
-        Triangle* hit_triangle = nullptr;
-        if (object->IsHit(ray, temp_t, hit_triangle)) {
-            hit_triangles[hit_triangle] = temp_t;
+    for (TriangleIndex i = 0; i < triangles_.Size(); ++i) {
+        if (triangles_.IsHit(i, ray, temp_t)) {
+            hit_triangles[i] = temp_t;
         }
     }
     if (hit_triangles.size() == 0) return false;
     return true;
 }
 
-std::vector<const Triangle*> PolygonMesh::GetObjects()
+bool PolygonMesh::IsAnyHit(const TracingRay& ray) const
+{
+    if (acceleration_ == AccelerationStructure::kBVH)
+        return bvh_->IsAnyHit(ray);
+    if (acceleration_ == AccelerationStructure::kKDTree)
+        return tree_->IsAnyHit(ray);
+    float temp_t;
+    for (TriangleIndex i = 0; i < triangles_.Size(); ++i) {
+        if (triangles_.IsHit(i, ray, temp_t))
+            return true;
+    }
+    return false;
+}
+
+const TriangleBuffer& PolygonMesh::GetTriangles() const
+{
+    return triangles_;
+}
+
+const FacetSet& PolygonMesh::GetFacets() const
+{
+    return facets_;
+}
+
+const EdgeGraph& PolygonMesh::GetEdges() const
+{
+    return edges_;
+}
+
+std::uint32_t PolygonMesh::GetMaterial(TriangleIndex triangle) const
+{
+    return triangle < materials_.size() ? materials_[triangle] : 0;
+}
+
+const std::vector<std::string>& PolygonMesh::GetMaterialNames() const
+{
+    return material_names_;
+}
+
+void PolygonMesh::BuildHeightMap(const float cell_size)
+{
+    height_map_.Build(triangles_, cell_size);
+    std::cout << "Height map: " << height_map_.GetWidth() << " x " << height_map_.GetHeight()
+              << " cells of " << cell_size << " m" << std::endl;
+}
+
+const HeightMap& PolygonMesh::GetHeightMap() const
+{
+    return height_map_;
+}
+
+void PolygonMesh::SetAccelerationStructure(AccelerationStructure acceleration)
+{
+    if (acceleration == AccelerationStructure::kBVH && bvh_ == nullptr) return;
+    if (acceleration == AccelerationStructure::kKDTree && tree_ == nullptr) return;
+    acceleration_ = acceleration;
+}
+
+AccelerationStructure PolygonMesh::GetAccelerationStructure() const
 {
-    return std::vector<const Triangle*>(objects_);
+    return acceleration_;
 }
 
 void PolygonMesh::UpdateTransform(Transform& transform) {
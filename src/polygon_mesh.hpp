@@ -9,12 +9,18 @@
 #include <glm/glm.hpp>
 #include <unordered_map>
 #include "object.hpp"
+#include "mapped_file.hpp"
+#include "mappable_vector.hpp"
+#include "triangle_buffer.hpp"
+#include "facet_set.hpp"
+#include "edge_graph.hpp"
+#include "height_map.hpp"
+#include "tracing_ray.hpp"
 
-class Triangle;
 class Shader;
 class Camera;
 class KDTree;
-class Ray;
+class BVH;
 struct Transform;
 class RadiationPattern;
 
@@ -24,6 +30,12 @@ struct Vertex {
 	glm::vec3 normal;
 };
 
+enum class AccelerationStructure : int {
+	kBruteForce = 0, // linear scan over every triangle, kept for validation
+	kBVH,
+	kKDTree
+};
+
 struct Texture{
 	unsigned int id;
 	std::string type;
@@ -33,34 +45,64 @@ class PolygonMesh : public Object {
 
 public:
 	PolygonMesh(const RadiationPattern& radiation_pattern);
+	// An .obj file; its compiled scene (GetScenePath) is loaded instead while the .obj is unchanged.
 	PolygonMesh(const std::string & path, Shader * shader, bool is_window_on);
+	~PolygonMesh();
 	bool LoadObj(	const std::string& path);
+	// Compiled scene: triangles, materials, facets, edges, height map, BVH and the visual vertices,
+	// stamped with the size and modification time of the .obj. LoadScene refuses a scene with other
+	// stamps, then maps the file read-only and uses it in place, so processes share its pages.
+	bool LoadScene(const std::string& path, std::uint64_t source_size, std::int64_t source_time);
+	bool SaveScene(const std::string& path, std::uint64_t source_size, std::int64_t source_time) const;
+	bool IsCompiled() const; // loaded from a compiled scene
+	static std::string GetScenePath(const std::string& obj_path);
 	virtual void Draw() const;
 	void UpdateTransform(Transform& transform);
 	void SetupMesh();
 	void GetBorders(float & min_x, float & max_x, float & min_z, float & max_z) const;
-	bool IsHit(Ray & ray, float & t) const; // return the nearest hit distance
-	bool IsHit(Ray& ray, float& t, Triangle *& hit_triangle) const; // return the nearest hit triangle
-	bool IsHit(Ray& ray, std::set<std::pair<float, const Triangle *>> & hit_triangles) const; // return the set of hit triangles
-	bool IsHit(Ray& ray, std::unordered_map<const Triangle*, float>& hit_triangles) const;
+	bool IsHit(const TracingRay & ray, float & t) const; // return the nearest hit distance
+	bool IsHit(const TracingRay& ray, float& t, TriangleIndex& hit_triangle) const; // return the nearest hit triangle
+	bool IsHit(const TracingRay& ray, std::set<std::pair<float, TriangleIndex>> & hit_triangles) const; // return the set of hit triangles
+	bool IsHit(const TracingRay& ray, std::unordered_map<TriangleIndex, float>& hit_triangles) const;
+	bool IsAnyHit(const TracingRay& ray) const; // return true on the first hit inside the t range of the ray
 
-	std::vector<const Triangle*> GetObjects();
+	const TriangleBuffer& GetTriangles() const;
+	const FacetSet& GetFacets() const;
+	const EdgeGraph& GetEdges() const;
+	// Index into GetMaterialNames() of the usemtl the triangle was under, 0 for none.
+	std::uint32_t GetMaterial(TriangleIndex triangle) const;
+	const std::vector<std::string>& GetMaterialNames() const;
+	// Optional surface model for fast path profiles, empty until built.
+	void BuildHeightMap(float cell_size = HeightMap::k_default_cell_size);
+	const HeightMap& GetHeightMap() const;
+	void SetAccelerationStructure(AccelerationStructure acceleration);
+	AccelerationStructure GetAccelerationStructure() const;
 
 private:
+	// Compiled scene the arrays below borrow from, released after them.
+	MappedFile scene_file_;
+
 	// For Visualisation
 	std::vector<glm::vec3> full_vertices_, normals_;
 	std::vector<glm::vec2> uvs_;
 	
 	// For Ray Tracer
-	std::vector<const Triangle*> objects_;
+	TriangleBuffer triangles_;
+	MappableVector<std::uint32_t> materials_; // per triangle
+	std::vector<std::string> material_names_;
+	FacetSet facets_;
+	EdgeGraph edges_;
+	HeightMap height_map_;
 
 	KDTree * tree_;
+	BVH * bvh_;
+	AccelerationStructure acceleration_;
 	unsigned int vao_, vbo_;
 
 	float min_x_;
 	float max_x_;
 	float min_z_;
 	float max_z_;
-	std::vector<Vertex> vertices_;
+	MappableVector<Vertex> vertices_;
 };
 #endif // !POLYGON_H
\ No newline at end of file
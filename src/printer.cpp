@@ -4,7 +4,6 @@
 #include <fstream>
 #include <iostream>
 #include <string>
-#include <thread>
 
 #include <chrono> 
 
@@ -14,6 +13,9 @@
 #include "ray_tracer.hpp"
 #include "transmitter.hpp"
 #include "receiver.hpp"
+#include "thread_pool.hpp"
+#include "coverage_engine.hpp"
+#include "image_source_table.hpp"
 
 using namespace std::chrono;
 
@@ -36,12 +38,13 @@ void Printer::Print(const std::string & output_path, glm::vec3 transmitter_locat
 	int z_width = 60;
 	ScanMap(transmitter_location, frequency, scanning_heigh, x_width, z_width);
 
-	output_file << "P3\n" << x_width << " " << z_width << "\n255\n";
-	for (auto& x_row : print_map_)
-		for (auto& result : x_row) {
+	output_file << "P3\n" << print_map_.GetWidth() << " " << print_map_.GetHeight() << "\n255\n";
+	for (unsigned int z = 0; z < print_map_.GetHeight(); ++z)
+		for (unsigned int x = 0; x < print_map_.GetWidth(); ++x) {
+			const float received_power = print_map_.At(x, z);
 			glm::vec3 color;  
-			if (result.is_valid) {
-				color = GetHeatColor(/*min_value_*/ -130.0f, max_value_, result.total_received_power);
+			if (CoverageRaster::IsValidValue(received_power)) {
+				color = GetHeatColor(/*min_value_*/ -130.0f, max_value_, received_power);
 				output_file << int(color.x * 256.0f) << " " << int(color.y * 256.0f) << " " << int(color.z * 256.0f) << "\n";
 			}
 			else {
@@ -87,30 +90,32 @@ void Printer::ScanMap(glm::vec3 transmitter_position, float frequency, float sca
 	const float z_step = (max_z - min_z) / (float)z_resolution;
 	auto print_start = high_resolution_clock::now();
 
-	Transmitter * tx = new Transmitter({transmitter_position, glm::vec3(0.0f),
-                                     glm::vec3(1.0f)}, frequency, 0, ray_tracer_);
-	Receiver * rx = new Receiver({transmitter_position, glm::vec3(0.0f), glm::vec3(1.0) }, ray_tracer_);
-	tx->ConnectAReceiver(rx);
-
-
-	std::vector<std::pair<glm::vec3, std::vector<Record>>> recordss;
-	std::vector<std::thread> threads;
-	for (float z = min_z; z < max_z; z = z + z_step) {
-		for (float x = min_x; x < max_x; x = x + x_step) {
-		        std::vector<Record> records;
-				glm::vec3 receiver_position = glm::vec3(x , scanning_heigh, z );
-
-				std::thread trace_thread(  &RayTracer::Trace, ray_tracer_,
-                                            transmitter_position, receiver_position,
-                                            std::ref(records));
-                threads.push_back(std::move(trace_thread));
-                recordss.emplace_back(receiver_position, records);
-			}
-		}
-	for(auto & thread: threads){
-	    if(thread.joinable()) thread.join();
+	print_map_ = CoverageRaster(min_x, min_z, x_step, z_step,
+	                            (unsigned int)x_resolution, (unsigned int)z_resolution);
+
+	// The transmitter stays put, its images are built once for all cells.
+	ImageSourceTable transmitter_images;
+	ray_tracer_->ComputeImageSources(transmitter_position, transmitter_images);
+
+	// Each cell traces and evaluates its own paths (0 dBm transmit power, isotropic antennas).
+	CoverageEngine coverage(ThreadPool::GetInstance());
+	coverage.Compute(scanning_heigh, [&](const glm::vec3& receiver_position) {
+		std::vector<Record> records;
+		Result result;
+		ray_tracer_->Trace(transmitter_images, receiver_position, records);
+		if (!ray_tracer_->CalculatePathLossMap(transmitter_position, frequency, receiver_position, records, result))
+			return CoverageRaster::k_invalid;
+		return result.total_received_power;
+	}, print_map_);
+
+	for (unsigned int i = 0; i < print_map_.Size(); ++i) {
+		const float received_power = print_map_.GetData()[i];
+		if (!CoverageRaster::IsValidValue(received_power)) continue;
+		min_value_ = std::min(min_value_, received_power);
+		max_value_ = std::max(max_value_, received_power);
 	}
-	/// TODO: Calculate the record.
+	auto print_stop = high_resolution_clock::now();
+	std::cout << "Scanned the map in " << duration_cast<milliseconds>(print_stop - print_start).count() << " ms" << std::endl;
 }
 
 glm::vec3 Printer::GetHeatColor(float min_value, float max_value, float value)
@@ -5,9 +5,10 @@
 #include<string>
 #include<glm/glm.hpp>
 
+#include "coverage_raster.hpp"
+
 class Transmitter;
 class RayTracer;
-struct Result;
 
 class Printer {
 public:
@@ -24,6 +25,6 @@ private:
 	float min_value_;
 	float max_value_;
 	Transmitter* transmitter_;
-	std::vector<std::vector<Result>> print_map_;
+	CoverageRaster print_map_; // received power, NaN where nothing arrives
 };
 #endif
\ No newline at end of file
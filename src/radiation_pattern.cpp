@@ -1,48 +1,289 @@
 #include "radiation_pattern.hpp"
 
 #include<iostream>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <map>
 
 #include<fstream>
 #include <glm/glm.hpp>
 
 #include "transform.hpp"
 #include "polygon_mesh.hpp"
+#include "intersection_kernel.hpp"
+#include "mapped_file.hpp"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define WCSIM_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#define WCSIM_TARGET_AVX2
+#else
+#define WCSIM_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+    constexpr char k_cache_magic[8] = { 'W', 'C', 'S', 'P', 'A', 'T', 'T', 'N' };
+    constexpr std::uint32_t k_cache_version = 1;
+    constexpr unsigned int k_pattern_columns = 9;
+
+    // Header of the grid cache, followed by k_theta_count * k_phi_count gains.
+    struct PatternCacheHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t theta_count;
+        std::uint32_t phi_count;
+        float grid_step;
+        std::uint64_t source_size;
+        std::int64_t source_time;
+        float min_gain;
+        float max_gain;
+    };
+
+    bool IsBlank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == ',';
+    }
+
+    // Numbers of one line, false for comments, blank lines and anything that is not numbers only.
+    // Extra columns past the ones needed are ignored.
+    bool ParseLine(const char* begin, const char* end, float* values, unsigned int count)
+    {
+        while (begin < end && IsBlank(*begin)) ++begin;
+        if (begin == end || *begin == '#' || *begin == '*') return false;
+        for (unsigned int i = 0; i < count; ++i) {
+            while (begin < end && IsBlank(*begin)) ++begin;
+            if (begin < end && *begin == '+') ++begin;
+            const auto result = std::from_chars(begin, end, values[i]);
+            if (result.ec != std::errc()) return false;
+            begin = result.ptr;
+        }
+        return true;
+    }
+
+    constexpr float k_cells_per_radian = 57.29577951308232f / RadiationPattern::k_grid_step;
+    constexpr float k_theta_cells = (float)(RadiationPattern::k_theta_count - 1);
+    constexpr float k_phi_cells = (float)(RadiationPattern::k_phi_count - 1);
+
+    // Keys around x and the weight of the upper one. With wrap the keys are angles around the circle,
+    // otherwise x is clamped to the first and last key.
+    template<typename Map>
+    void Bracket(const Map& samples, float x, bool wrap, typename Map::const_iterator& lower,
+                 typename Map::const_iterator& upper, float& weight)
+    {
+        upper = samples.upper_bound(x);
+        float lower_key, upper_key;
+        if (upper == samples.begin()) {
+            lower = wrap ? std::prev(samples.end()) : upper;
+            lower_key = wrap ? lower->first - 360.0f : upper->first;
+        } else {
+            lower = std::prev(upper);
+            lower_key = lower->first;
+        }
+        if (upper == samples.end()) {
+            upper = wrap ? samples.begin() : lower;
+            upper_key = wrap ? upper->first + 360.0f : lower->first;
+        } else {
+            upper_key = upper->first;
+        }
+        weight = upper_key > lower_key ? (x - lower_key) / (upper_key - lower_key) : 0.0f;
+    }
+
+    float SampleRow(const std::map<float, float>& row, float phi)
+    {
+        std::map<float, float>::const_iterator lower, upper;
+        float weight;
+        Bracket(row, phi, false, lower, upper, weight);
+        return lower->second + (upper->second - lower->second) * weight;
+    }
+
+    // Same operation sequence as the AVX2 lanes, so both give identical gains.
+    float LookUp(const float* gains, float theta, float phi)
+    {
+        float u = theta * k_cells_per_radian;
+        u = u - std::floor(u * (1.0f / k_theta_cells)) * k_theta_cells;
+        u = u > 0.0f ? u : 0.0f;
+        u = u < k_theta_cells ? u : k_theta_cells;
+        float column = std::floor(u);
+        column = column < k_theta_cells - 1.0f ? column : k_theta_cells - 1.0f;
+        const float fu = u - column;
+
+        float v = phi * k_cells_per_radian;
+        v = v > 0.0f ? v : 0.0f;
+        v = v < k_phi_cells ? v : k_phi_cells;
+        float row = std::floor(v);
+        row = row < k_phi_cells - 1.0f ? row : k_phi_cells - 1.0f;
+        const float fv = v - row;
+
+        const int index = (int)(row * (float)RadiationPattern::k_theta_count + column);
+        const float g00 = gains[index], g10 = gains[index + 1];
+        const float g01 = gains[index + RadiationPattern::k_theta_count];
+        const float g11 = gains[index + RadiationPattern::k_theta_count + 1];
+        const float bottom = g00 + (g10 - g00) * fu;
+        const float top = g01 + (g11 - g01) * fu;
+        return bottom + (top - bottom) * fv;
+    }
+
+#ifdef WCSIM_X86
+    WCSIM_TARGET_AVX2
+    void LookUpAVX2(const float* gains, const float* theta, const float* phi, float* out)
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 cells_per_radian = _mm256_set1_ps(k_cells_per_radian);
+        const __m256 theta_cells = _mm256_set1_ps(k_theta_cells);
+        const __m256 phi_cells = _mm256_set1_ps(k_phi_cells);
+
+        __m256 u = _mm256_mul_ps(_mm256_loadu_ps(theta), cells_per_radian);
+        u = _mm256_sub_ps(u, _mm256_mul_ps(_mm256_floor_ps(_mm256_mul_ps(u, _mm256_set1_ps(1.0f / k_theta_cells))), theta_cells));
+        u = _mm256_min_ps(_mm256_max_ps(u, zero), theta_cells);
+        const __m256 column = _mm256_min_ps(_mm256_floor_ps(u), _mm256_set1_ps(k_theta_cells - 1.0f));
+        const __m256 fu = _mm256_sub_ps(u, column);
+
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(phi), cells_per_radian);
+        v = _mm256_min_ps(_mm256_max_ps(v, zero), phi_cells);
+        const __m256 row = _mm256_min_ps(_mm256_floor_ps(v), _mm256_set1_ps(k_phi_cells - 1.0f));
+        const __m256 fv = _mm256_sub_ps(v, row);
+
+        const __m256i index = _mm256_cvttps_epi32(
+            _mm256_add_ps(_mm256_mul_ps(row, _mm256_set1_ps((float)RadiationPattern::k_theta_count)), column));
+        const __m256i next_row = _mm256_add_epi32(index, _mm256_set1_epi32((int)RadiationPattern::k_theta_count));
+        const __m256 g00 = _mm256_i32gather_ps(gains, index, 4);
+        const __m256 g10 = _mm256_i32gather_ps(gains + 1, index, 4);
+        const __m256 g01 = _mm256_i32gather_ps(gains, next_row, 4);
+        const __m256 g11 = _mm256_i32gather_ps(gains + 1, next_row, 4);
+        const __m256 bottom = _mm256_add_ps(g00, _mm256_mul_ps(_mm256_sub_ps(g10, g00), fu));
+        const __m256 top = _mm256_add_ps(g01, _mm256_mul_ps(_mm256_sub_ps(g11, g01), fu));
+        _mm256_storeu_ps(out, _mm256_add_ps(bottom, _mm256_mul_ps(_mm256_sub_ps(top, bottom), fv)));
+    }
+#endif
+}
 
 RadiationPattern::RadiationPattern(std::string pattern_file_path) : min_gain_(0.0f), max_gain_(0.0f), pattern_shape_(nullptr) {
 
-	std::ifstream input_file_stream(pattern_file_path);
-	if (input_file_stream.is_open()) {
-		std::cout << "Reading Radiation Pattern file" << std::endl;
-		std::string line;
-		while(getline(input_file_stream, line)) {
-			if (line[0] == '#' || line[0] == '*')continue;
-			float theta, phi, total_gain;
-			float reeth, imeth, rephi, imphi, gth, gphi;
-			input_file_stream >> phi >> theta >> reeth >> imeth >> rephi >> imphi >> gth >> gphi >> total_gain;
-			pattern_[theta].insert({ phi, total_gain });
+	std::error_code error;
+	const std::uint64_t source_size = std::filesystem::file_size(pattern_file_path, error);
+	if (error) {
+		std::cout << "Couldn't open radiation pattern file." << std::endl;
+		return;
+	}
+	const std::int64_t source_time = std::filesystem::last_write_time(pattern_file_path, error).time_since_epoch().count();
+	const std::string cache_path = pattern_file_path + k_cache_extension;
+	if (LoadCache(cache_path, source_size, source_time)) {
+		std::cout << "Radiation Pattern loaded from cache." << std::endl;
+		return;
+	}
 
+	std::cout << "Reading Radiation Pattern file" << std::endl;
+	if (!ReadPatternFile(pattern_file_path)) {
+		std::cout << "Couldn't read radiation pattern file." << std::endl;
+		return;
+	}
+	std::cout << "Radiation Pattern Reading Completed." << std::endl;
+	SaveCache(cache_path, source_size, source_time);
+}
+
+bool RadiationPattern::ReadPatternFile(const std::string& pattern_file_path)
+{
+	MappedFile file;
+	if (!file.Open(pattern_file_path)) return false;
 
+	// Samples as read, theta -> phi -> total gain.
+	std::map<float, std::map<float, float>> samples;
+	const char* line = file.GetData();
+	const char* const end = line + file.GetSize();
+	while (line < end) {
+		const char* line_end = static_cast<const char*>(std::memchr(line, '\n', end - line));
+		if (line_end == nullptr) line_end = end;
+		float values[k_pattern_columns];
+		if (ParseLine(line, line_end, values, k_pattern_columns)) {
+			const float phi = values[0], theta = values[1], total_gain = values[8];
+			samples[theta].insert({ phi, total_gain });
 			if (total_gain < min_gain_) min_gain_ = total_gain;
 			if (total_gain > max_gain_) max_gain_ = total_gain;
 		}
-		std::cout << "Radiation Pattern Reading Completed." << std::endl;
-		input_file_stream.close();
+		line = line_end + 1;
 	}
-	else {
-		std::cout << "Couldn't open radiation pattern file." << std::endl;
-		return;
+	if (samples.empty()) return false;
+
+	// Resample onto the grid, linear between the samples of the file.
+	gains_.resize((std::size_t)k_theta_count * k_phi_count);
+	for (unsigned int theta = 0; theta < k_theta_count; ++theta) {
+		const float theta_deg = theta < k_theta_count - 1 ? theta * k_grid_step : 0.0f;
+		std::map<float, std::map<float, float>>::const_iterator lower, upper;
+		float weight;
+		Bracket(samples, theta_deg, true, lower, upper, weight);
+		for (unsigned int phi = 0; phi < k_phi_count; ++phi) {
+			const float lower_gain = SampleRow(lower->second, phi * k_grid_step);
+			const float upper_gain = SampleRow(upper->second, phi * k_grid_step);
+			gains_[(std::size_t)phi * k_theta_count + theta] = lower_gain + (upper_gain - lower_gain) * weight;
+		}
 	}
+	return true;
+}
+
+bool RadiationPattern::LoadCache(const std::string& cache_path, const std::uint64_t source_size,
+                                 const std::int64_t source_time)
+{
+	MappedFile file;
+	if (!file.Open(cache_path)) return false;
+	const std::size_t gain_count = (std::size_t)k_theta_count * k_phi_count;
+	if (file.GetSize() != sizeof(PatternCacheHeader) + gain_count * sizeof(float)) return false;
+
+	PatternCacheHeader header;
+	std::memcpy(&header, file.GetData(), sizeof(header));
+	if (std::memcmp(header.magic, k_cache_magic, sizeof(k_cache_magic)) != 0 || header.version != k_cache_version ||
+	    header.theta_count != k_theta_count || header.phi_count != k_phi_count || header.grid_step != k_grid_step ||
+	    header.source_size != source_size || header.source_time != source_time)
+		return false;
 
-	for (int phi = 0; phi < 180; phi += 10) {
-		for (int theta = 0; theta < 360; theta += 10) {
-			float value = pattern_[theta][phi];
+	gains_.resize(gain_count);
+	std::memcpy(gains_.data(), file.GetData() + sizeof(header), gain_count * sizeof(float));
+	min_gain_ = header.min_gain;
+	max_gain_ = header.max_gain;
+	return true;
+}
+
+void RadiationPattern::SaveCache(const std::string& cache_path, const std::uint64_t source_size,
+                                 const std::int64_t source_time) const
+{
+	PatternCacheHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, k_cache_magic, sizeof(k_cache_magic));
+	header.version = k_cache_version;
+	header.theta_count = k_theta_count;
+	header.phi_count = k_phi_count;
+	header.grid_step = k_grid_step;
+	header.source_size = source_size;
+	header.source_time = source_time;
+	header.min_gain = min_gain_;
+	header.max_gain = max_gain_;
+
+	// Written aside and renamed, so a reader never maps half a cache. A failure only costs the next start.
+	const std::string temporary_path = cache_path + ".tmp";
+	{
+		std::ofstream output_file_stream(temporary_path, std::ios::binary | std::ios::trunc);
+		if (!output_file_stream.is_open()) return;
+		output_file_stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		output_file_stream.write(reinterpret_cast<const char*>(gains_.data()), gains_.size() * sizeof(float));
+		if (!output_file_stream) {
+			output_file_stream.close();
+			std::remove(temporary_path.c_str());
+			return;
 		}
 	}
+	std::error_code error;
+	std::filesystem::rename(temporary_path, cache_path, error);
+	if (error) std::filesystem::remove(temporary_path, error);
 }
 
 void RadiationPattern::PrepareVisualPattern()
 {
-	if (pattern_.empty()) return;
+	if (Empty()) return;
 	pattern_shape_ = new PolygonMesh(*this);
 }
 
@@ -54,18 +295,27 @@ void RadiationPattern::DrawPattern(Camera* camera, Transform& transform)
 	pattern_shape_->DrawObject(camera);
 }
 
-float RadiationPattern::GetGain(float theta, float phi)
+bool RadiationPattern::Empty() const
 {
-	//std::cout << "getting gain. " << std::endl;
-	float theta_deg = glm::degrees(theta);
-	float phi_deg = glm::degrees(phi);
-	if (theta_deg >= 359.0f) theta_deg = 0.0f;
-
+	return gains_.empty();
+}
 
-	auto& phi_value = (*pattern_.lower_bound(theta_deg)).second;
-	auto gain = (*phi_value.lower_bound(phi_deg)).second;
-	//std::cout << "theta:" << theta_deg << " phi:" << phi_deg << " total gain: " << gain << std::endl;
+float RadiationPattern::GetGain(float theta, float phi) const
+{
+	if (Empty()) return 0.0f;
+	return LookUp(gains_.data(), theta, phi);
+}
 
-	// Debug the problem
-	return gain;
+void RadiationPattern::GetGains(const float* theta, const float* phi, float* gains, std::size_t n) const
+{
+	if (Empty()) {
+		for (std::size_t i = 0; i < n; ++i) gains[i] = 0.0f;
+		return;
+	}
+	std::size_t i = 0;
+#ifdef WCSIM_X86
+	if (IntersectionKernel::GetInstructionSet() == InstructionSet::kAVX2)
+		for (; i + 8 <= n; i += 8) LookUpAVX2(gains_.data(), theta + i, phi + i, gains + i);
+#endif
+	for (; i < n; ++i) gains[i] = LookUp(gains_.data(), theta[i], phi[i]);
 }
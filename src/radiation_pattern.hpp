@@ -1,28 +1,52 @@
 #ifndef RADIATION_PATTERN_H
 #define RADIATION_PATTERN_H
-#include <map>
-#include <utility>
+#include <cstddef>
+#include <cstdint>
 #include <string>
-#include <set>
+
+#include "aligned_allocator.hpp"
 
 class Pattern;
 class Camera;
 class PolygonMesh;
 struct Transform;
 
+// Total gain (dB) over theta in [0, 360) and phi in [0, 180] degrees. The samples of the file
+// are resampled once into a dense grid of k_grid_step, the gain between grid points is read
+// with bilinear interpolation; theta wraps around, phi is clamped.
+//
+// The grid is cached next to the pattern file (k_cache_extension appended to its name) and
+// reused while the size and modification time of the pattern file match the ones it was made from.
 class RadiationPattern {
 public:
+	static constexpr float k_grid_step = 1.0f; // degrees
+	static constexpr unsigned int k_theta_count = 361; // 0 to 360, the last column repeats the first
+	static constexpr unsigned int k_phi_count = 181; // 0 to 180
+	static constexpr const char* k_cache_extension = ".cache";
+
 	RadiationPattern(std::string pattern_file_path);
 
 	// Visualisaton
 	void PrepareVisualPattern();
 	void DrawPattern(Camera * camera, Transform & transform);
 
-	std::map<float, std::map<float, float>> pattern_;
-	float GetGain(float theta, float phi);
+	bool Empty() const;
+	// theta and phi in radians, 0 dB without a pattern.
+	float GetGain(float theta, float phi) const;
+	// Gains of n directions at once, vectorized with the instruction set of the IntersectionKernel.
+	void GetGains(const float* theta, const float* phi, float* gains, std::size_t n) const;
+
 	float min_gain_;
 	float max_gain_;
 
 	PolygonMesh * pattern_shape_;
+
+private:
+	// NEC style text: phi, theta, re/im e-theta, re/im e-phi, g-theta, g-phi, total gain per line.
+	bool ReadPatternFile(const std::string& pattern_file_path);
+	bool LoadCache(const std::string& cache_path, std::uint64_t source_size, std::int64_t source_time);
+	void SaveCache(const std::string& cache_path, std::uint64_t source_size, std::int64_t source_time) const;
+
+	AlignedVector<float> gains_; // rows of constant phi, k_theta_count * k_phi_count
 };
-#endif // !RADIATION_PATTERN_H
\ No newline at end of file
+#endif // !RADIATION_PATTERN_H
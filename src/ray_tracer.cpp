@@ -6,30 +6,80 @@
 #include <iomanip>
 #include <algorithm>
 #include <cmath>
+#include <cfloat>
 #include <stack>
 #include <queue>
-#include <thread>
 
 #include <glm/gtx/vector_angle.hpp>
 
 #include "object.hpp"
 #include "cube.hpp"
 #include "ray.hpp"
-#include "triangle.hpp"
+#include "tracing_ray.hpp"
 #include "polygon_mesh.hpp"
+#include "image_source_table.hpp"
+#include "image_tree.hpp"
+#include "sbr_tracer.hpp"
+#include "diffraction.hpp"
 
 #include "transmitter.hpp"
 #include "receiver.hpp"
 
 #include "recorder.hpp"
+#include "thread_pool.hpp"
 
-RayTracer::RayTracer(PolygonMesh* map) :map_(map)
+RayTracer::RayTracer(PolygonMesh* map) :map_(map), tracing_mode_(TracingMode::kImage),
+    diffraction_search_(DiffractionSearch::kEdgeGraph), profile_method_(ProfileMethod::kDeygout),
+    sbr_tracer_(new SbrTracer(map)), edge_search_tolerance_(k_default_edge_search_tolerance),
+    max_reflection_path_length_(FLT_MAX)
 {
 }
 
-std::map <Triangle *, bool> RayTracer::ScanHit(const glm::vec3 position) const
+RayTracer::~RayTracer()
 {
-	std::map<Triangle*, bool> hit_triangles;
+    delete sbr_tracer_;
+}
+
+void RayTracer::SetTracingMode(const TracingMode mode)
+{
+    tracing_mode_ = mode;
+}
+
+TracingMode RayTracer::GetTracingMode() const
+{
+    return tracing_mode_;
+}
+
+const SbrTracer * RayTracer::GetSbrTracer() const
+{
+    return sbr_tracer_;
+}
+
+void RayTracer::SetDiffractionSearch(const DiffractionSearch search)
+{
+    // The height map is only built for the mode that reads it; compiled scenes come with one.
+    if (search == DiffractionSearch::kHeightProfile && map_->GetHeightMap().Empty()) map_->BuildHeightMap();
+    diffraction_search_ = search;
+}
+
+DiffractionSearch RayTracer::GetDiffractionSearch() const
+{
+    return diffraction_search_;
+}
+
+void RayTracer::SetProfileMethod(const ProfileMethod method)
+{
+    profile_method_ = method;
+}
+
+ProfileMethod RayTracer::GetProfileMethod() const
+{
+    return profile_method_;
+}
+
+std::map <TriangleIndex, bool> RayTracer::ScanHit(const glm::vec3 position) const
+{
+	std::map<TriangleIndex, bool> hit_triangles;
 	// Approach I: when the triangles are more than the generated scanning rays
 	glm::vec4 direction = { 1.0f , 0.0f, 0.0f, 1.0f }; // initial scan direction
 	float scan_precision = 1.0f;
@@ -40,8 +90,8 @@ std::map <Triangle *, bool> RayTracer::ScanHit(const glm::vec3 position) const
 			auto new_direction = trans_direction * direction;
 			auto i_direction = glm::vec3(new_direction);
 
-			Ray ray{ position, i_direction };
-			Triangle* hit_triangle = nullptr;
+			TracingRay ray{ position, i_direction };
+			TriangleIndex hit_triangle;
 			float hit_distance; // doesnt do anything yet // maybe implement later. 
 			if (map_->IsHit(ray, hit_distance, hit_triangle)) {
 				hit_triangles[hit_triangle] = true;
@@ -50,9 +100,9 @@ std::map <Triangle *, bool> RayTracer::ScanHit(const glm::vec3 position) const
 	return hit_triangles;
 }
 
-std::vector <Triangle*> RayTracer::ScanHitVec(const glm::vec3 position) const
+std::vector <TriangleIndex> RayTracer::ScanHitVec(const glm::vec3 position) const
 {
-	std::vector <Triangle*> hit_triangles;
+	std::vector <TriangleIndex> hit_triangles;
 	// Approach I: when the triangles are more than the generated scanning rays
 	glm::vec4 direction = { 1.0f , 0.0f, 0.0f, 1.0f }; // initial scan direction
 	float scan_precision = 2.0f;
@@ -63,8 +113,8 @@ std::vector <Triangle*> RayTracer::ScanHitVec(const glm::vec3 position) const
 			auto new_direction = trans_direction * direction;
 			auto i_direction = glm::vec3(new_direction);
 
-			Ray ray{ position, i_direction };
-			Triangle* hit_triangle = nullptr;
+			TracingRay ray{ position, i_direction };
+			TriangleIndex hit_triangle;
 			float hit_distance; // doesnt do anything yet // maybe implement later. 
 			if (map_->IsHit(ray, hit_distance, hit_triangle)) {
 				hit_triangles.push_back(hit_triangle);
@@ -88,23 +138,42 @@ void RayTracer::LineTrace(const glm::vec3 start_position,
 
 void RayTracer::ReflectTrace(const glm::vec3 start_position,
                              const glm::vec3 end_position,
-                             std::vector<Record> & records) const {
+                             std::vector<Record> & records,
+                             const unsigned int max_reflection_order) const {
+    if (tracing_mode_ == TracingMode::kSbr) {
+        std::vector<std::vector<Record>> sbr_records(1);
+        sbr_tracer_->Trace(start_position, { end_position }, max_reflection_order, sbr_records);
+        records.insert(records.end(), sbr_records[0].begin(), sbr_records[0].end());
+        return;
+    }
     std::vector<glm::vec3> reflected_points;
     if (IsReflected(start_position, end_position, reflected_points)) {
         records.emplace_back( RecordType::kReflect, reflected_points );
     }
+    if (max_reflection_order < 2) return;
+
+    // Higher orders, one record per path.
+    ImageTree tree(map_->GetTriangles(), map_->GetFacets());
+    ComputeImageTree(start_position, max_reflection_order, tree);
+    std::vector<std::vector<glm::vec3>> paths;
+    if (IsMultipleReflected(tree, end_position, paths)) {
+        for (auto & path : paths) records.emplace_back(RecordType::kMultipleReflect, path);
+    }
 }
 
 void RayTracer::Trace(const glm::vec3 start_position,
                       const glm::vec3 end_position,
-                      std::vector<Record> & records) const
+                      std::vector<Record> & records,
+                      const unsigned int max_reflection_order) const
 {
-	// Multithreading (speed up to 30%)
-    std::thread line_tracer (&RayTracer::LineTrace, this, start_position, end_position, std::ref(records));
-    std::thread reflect_tracer (&RayTracer::ReflectTrace, this, start_position, end_position, std::ref(records));
-
-    line_tracer.join();
-    reflect_tracer.join();
+    // Trace line of sight and reflections side by side, each into its own list so they do not race.
+    std::vector<Record> line_records, reflect_records;
+    ThreadPool::GetInstance().Invoke(
+        [&]() { LineTrace(start_position, end_position, line_records); },
+        [&]() { ReflectTrace(start_position, end_position, reflect_records, max_reflection_order); });
+
+    records.insert(records.end(), line_records.begin(), line_records.end());
+    records.insert(records.end(), reflect_records.begin(), reflect_records.end());
 }
 void RayTracer::TraceMap(   const glm::vec3 tx_position,
                             const glm::vec3 rx_position,
@@ -123,6 +192,67 @@ void RayTracer::TraceMap(   const glm::vec3 tx_position,
     }
 }
 
+void RayTracer::TraceMap(   const glm::vec3 tx_position,
+                            const ImageSourceTable & rx_images,
+                            std::vector<Record> & records) const{
+    const glm::vec3 rx_position = rx_images.GetSource();
+    if(IsDirectHit(tx_position, rx_position)){
+        records.emplace_back(RecordType::kDirect);
+    }else{
+        std::vector<glm::vec3> edges_points;
+        if(IsKnifeEdgeDiffraction(tx_position, rx_position, edges_points))
+            records.emplace_back(RecordType::kEdgeDiffraction, edges_points);
+    }
+
+    // Traced back from the receiver, the specular points are the same.
+    std::vector<glm::vec3> reflected_points;
+    if (IsReflected(rx_images, tx_position, reflected_points)) {
+        records.emplace_back( RecordType::kReflect, reflected_points );
+    }
+}
+
+void RayTracer::Trace(const ImageSourceTable & start_images,
+                      const glm::vec3 end_position,
+                      std::vector<Record> & records) const
+{
+    if (tracing_mode_ == TracingMode::kSbr) {
+        Trace(start_images.GetSource(), end_position, records);
+        return;
+    }
+    LineTrace(start_images.GetSource(), end_position, records);
+    std::vector<glm::vec3> reflected_points;
+    if (IsReflected(start_images, end_position, reflected_points))
+        records.emplace_back(RecordType::kReflect, reflected_points);
+}
+
+void RayTracer::Trace(const ImageSourceTable & start_images,
+                      const std::vector<glm::vec3> & end_positions,
+                      std::vector<std::vector<Record>> & records,
+                      const unsigned int max_reflection_order) const
+{
+    records.assign(end_positions.size(), {});
+    if (tracing_mode_ == TracingMode::kSbr) {
+        // One launch covers every end position, the line of sight is still traced per end position.
+        ThreadPool::GetInstance().ParallelFor(0, end_positions.size(), 1, [&](std::size_t i) {
+            LineTrace(start_images.GetSource(), end_positions[i], records[i]);
+        });
+        sbr_tracer_->Trace(start_images.GetSource(), end_positions, max_reflection_order, records);
+        return;
+    }
+    // Higher order images are shared by all end positions as well.
+    ImageTree tree(map_->GetTriangles(), map_->GetFacets());
+    if (max_reflection_order >= 2) ComputeImageTree(start_images.GetSource(), max_reflection_order, tree);
+
+    // The image tables are read-only here, every end position fills its own record list.
+    ThreadPool::GetInstance().ParallelFor(0, end_positions.size(), 1, [&](std::size_t i) {
+        Trace(start_images, end_positions[i], records[i]);
+        std::vector<std::vector<glm::vec3>> paths;
+        if (max_reflection_order >= 2 && IsMultipleReflected(tree, end_positions[i], paths)) {
+            for (auto & path : paths) records[i].emplace_back(RecordType::kMultipleReflect, path);
+        }
+    });
+}
+
 void RayTracer::GetDrawComponents(const glm::vec3 & start_position, const glm::vec3 & end_position,
                                   std::vector<Record>& records, std::vector<Object*>& objects) const
 {
@@ -152,6 +282,24 @@ void RayTracer::GetDrawComponents(const glm::vec3 & start_position, const glm::v
 			}
 			break;
 		}
+		case RecordType::kMultipleReflect: {
+			// One polyline through all bounce points.
+			glm::vec3 previous_position = start_position;
+			for (auto reflected_position : record.data) {
+				Cube* reflected_point = new Cube(Transform{ reflected_position, glm::vec3(0.2f, 0.2f, 0.2f), glm::vec3(0.0f) });
+				Ray* leg_ray = new Ray(previous_position, glm::normalize(reflected_position - previous_position));
+				leg_ray->InitializeRay(glm::distance(previous_position, reflected_position));
+				leg_ray->SetRayColor(glm::vec4(1.0f, 0.5f, 0.0f, 1.0f));
+				objects.push_back(reflected_point);
+				objects.push_back(leg_ray);
+				previous_position = reflected_position;
+			}
+			Ray* last_ray = new Ray(previous_position, glm::normalize(end_position - previous_position));
+			last_ray->InitializeRay(glm::distance(previous_position, end_position));
+			last_ray->SetRayColor(glm::vec4(1.0f, 0.5f, 0.0f, 1.0f));
+			objects.push_back(last_ray);
+			break;
+		}
 		case RecordType::kEdgeDiffraction: {
 
 			auto edges_points = record.data;
@@ -249,37 +397,60 @@ bool RayTracer::CalculatePathLoss(Transmitter* transmitter, Receiver * receiver,
     result.diffraction.diffraction_loss = 0.0f;
     result.diffraction.delay = 0.0f;
 
-    // Prepare Threads
-    std::vector<std::thread> threads;
-    for (auto &record: records) {
+    // Fork one task per record, each one fills its own partial result.
+    std::vector<Result> partials(records.size());
+    TaskGroup tasks;
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        const Record & record = records[i];
+        Result & partial = partials[i];
         switch (record.type) {
             case RecordType::kDirect: {
-                std::thread direct_thread(&RayTracer::CalculateDirectPath, this,
-                                          record, std::ref(result),
-                                          transmitter, receiver);
-                threads.push_back(std::move(direct_thread));
+                tasks.Run([this, &record, &partial, transmitter, receiver]() {
+                    CalculateDirectPath(record, partial, transmitter, receiver);
+                });
             }
                 break;
             case RecordType::kReflect: {
-                std::thread reflect_thread(&RayTracer::CalculateReflections, this,
-                                           record, std::ref(result),
-                                           transmitter, receiver);
-                threads.push_back(std::move(reflect_thread));
+                tasks.Run([this, &record, &partial, transmitter, receiver]() {
+                    CalculateReflections(record, partial, transmitter, receiver);
+                });
             }
                 break;
             case RecordType::kEdgeDiffraction: {
-                std::thread diffract_thread(&RayTracer::CalculateDiffraction, this,
-                                            record, std::ref(result),
-                                            transmitter, receiver);
-                threads.push_back(std::move(diffract_thread));
+                tasks.Run([this, &record, &partial, transmitter, receiver]() {
+                    CalculateDiffraction(record, partial, transmitter, receiver);
+                });
+            } break;
+            case RecordType::kMultipleReflect: {
+                tasks.Run([this, &record, &partial, transmitter, receiver]() {
+                    CalculateMultipleReflection(record, partial, transmitter, receiver);
+                });
             } break;
         }
 
     }
 
-    // Join all threads.
-    for (std::thread &thread: threads) {
-        if (thread.joinable()) thread.join();
+    // Join all tasks.
+    tasks.Wait();
+
+    // Merge in record order, so the result does not depend on which task finished first.
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        Result & partial = partials[i];
+        switch (records[i].type) {
+            case RecordType::kDirect:
+                result.is_los = true;
+                result.direct = partial.direct;
+                break;
+            case RecordType::kReflect:
+            case RecordType::kMultipleReflect:
+                result.reflections.insert(result.reflections.end(),
+                                          partial.reflections.begin(), partial.reflections.end());
+                break;
+            case RecordType::kEdgeDiffraction:
+                result.is_los = false;
+                result.diffraction = partial.diffraction;
+                break;
+        }
     }
 
     // Summary All Results.
@@ -353,128 +524,24 @@ bool RayTracer::CalculatePathLossMap(const glm::vec3 tx_position,  const float t
 
                 }
 
+            }
+                break;
+            case RecordType::kMultipleReflect: {
+                float delay;
+                float reflection_loss = CalculateMultipleReflectionLoss(tx_position, rx_position, record.data,
+                                                                        tx_frequency, delay);
+                result.reflections.push_back(ReflectionResult{reflection_loss, delay, 0, 0});
             }
                 break;
             case RecordType::kEdgeDiffraction: {
                 float distance = glm::distance(tx_position, rx_position);
                 float free_space_loss = 20 * log10(distance) + 20 * log10(tx_frequency) - 147.55f;
 
-                if (record.data.size() == 1) {
-                    // Get Edge Position from Record.
-                    const glm::vec3 edge_position = record.data[0];
-
-                    // Calculate V
-                    float v = CalculateVOfEdge(tx_position, edge_position, rx_position, tx_frequency);
-
-                    // Calculate Diffraction Loss from V and FSPL.
-                    float diff_loss = free_space_loss + CalculateDiffractionByV(v);
-
-                    // Calculate the receive power
-                    result.diffraction.diffraction_loss = diff_loss;
-
-                    // Calculate Delay
-                    float distance = glm::distance(edge_position, tx_position) +
-                                     glm::distance(edge_position, rx_position);
-
-                    result.diffraction.delay = distance / LIGHT_SPEED;
-                }
-                else if (record.data.size() == 2) {
-                    // Copy Edges to stack.
-                    std::vector<glm::vec3> edges = record.data;
-                    const glm::vec3 nearest_tx_edge = NearestEdgeFromPoint(tx_position, edges);
-                    const glm::vec3 nearest_rx_edge = NearestEdgeFromPoint(rx_position, edges);
-
-                    // Find the max V as single edge V
-                    const float v1 = CalculateVOfEdge(tx_position, nearest_tx_edge, rx_position, tx_frequency);
-                    const float v2 = CalculateVOfEdge(tx_position, nearest_rx_edge, rx_position, tx_frequency);
-                    const float max_v = std::max({v1, v2});
-                    float diff_loss = free_space_loss + CalculateDiffractionByV(max_v);
-
-                    // Calculate Receive Power
-                    result.diffraction.diffraction_loss = diff_loss;
-
-                    // Calculate Delay
-                    float distance = glm::distance(tx_position, nearest_tx_edge) + glm::distance(nearest_tx_edge, nearest_rx_edge)
-                                     + glm::distance(nearest_rx_edge, rx_position);
-                    result.diffraction.delay = distance / LIGHT_SPEED;
-                }
-                else if (record.data.size() == 3) {
-                    // Copy Edges to find edge positions.
-                    std::vector<glm::vec3> edges = record.data;
-                    glm::vec3 near_tx_pos = NearestEdgeFromPoint(tx_position, edges);
-                    glm::vec3 center_pos = NearestEdgeFromPoint(near_tx_pos, edges);
-                    glm::vec3 near_rx_pos = NearestEdgeFromPoint(rx_position, edges);
-
-
-                    // Calculate C1, C2, and C3.
-                    float c1 = CalculateSingleKnifeEdge(tx_position, near_tx_pos, center_pos, tx_frequency);
-                    float c2 = CalculateSingleKnifeEdge(tx_position, center_pos, rx_position, tx_frequency);
-                    float c3 = CalculateSingleKnifeEdge(center_pos, near_rx_pos, rx_position, tx_frequency);
-
-                    // Calculate Corrections.
-                    std::pair<float, float> correction_cosines;
-                    CalculateCorrectionCosines(tx_position, record.data, rx_position, correction_cosines);
-                    float c_1_cap = (6.0f - c2 + c1) * correction_cosines.first;
-                    float c_2_cap = (6.0f - c2 + c3) * correction_cosines.second;
-
-                    // Calculate Diffraction Loss
-                    float diffraction_loss = free_space_loss + (c2 + c1 + c3 - c_1_cap - c_2_cap);
-
-                    // Calculate Received Power
-                    result.diffraction.diffraction_loss = diffraction_loss;
-
-                    // Calculate Delay
-                    float d1 = glm::distance(tx_position, near_tx_pos);
-                    float d2 = glm::distance(near_tx_pos, center_pos);
-                    float d3 = glm::distance(center_pos, near_rx_pos);
-                    float d4 = glm::distance(near_rx_pos, rx_position);
-                    float total_distance = d1 + d2 + d3 + d4;
-                    result.diffraction.delay = total_distance / LIGHT_SPEED;
-                }
-                else {
-                    // Find highest Vs in the edges
-                    std::set<float> highest_v;
-                    std::map<float, glm::vec3> edges_dict;
-                    for (auto edge : record.data) {
-                        float temp_v = CalculateVOfEdge(tx_position, edge, rx_position, tx_frequency);
-                        edges_dict[temp_v] = edge;
-                        highest_v.insert(temp_v);
-                    }
-                    std::vector<glm::vec3> edges;
-                    int i = 0;
-                    // choose the highest v from the highest_v
-                    for (auto ritr = highest_v.rbegin(); ritr != highest_v.rend(); ++ritr) {
-                        edges.push_back(edges_dict[*ritr]);
-                        if (i++ == 2) break;
-                    }
-                    glm::vec3 near_tx_pos = NearestEdgeFromPoint(tx_position, edges);
-                    glm::vec3 center_pos = NearestEdgeFromPoint(near_tx_pos, edges);
-                    glm::vec3 near_rx_pos = NearestEdgeFromPoint(rx_position, edges);
-
-                    // Calculate C1, C2, and C3.
-                    float c1 = CalculateSingleKnifeEdge(tx_position, near_tx_pos, center_pos, tx_frequency);
-                    float c2 = CalculateSingleKnifeEdge(tx_position, center_pos, rx_position, tx_frequency);
-                    float c3 = CalculateSingleKnifeEdge(center_pos, near_rx_pos, rx_position, tx_frequency);
-
-                    // Calculate Corrections.
-                    std::pair<float, float> correction_cosines;
-                    CalculateCorrectionCosines(tx_position, record.data, rx_position, correction_cosines);
-                    float c_1_cap = (6.0f - c2 + c1) * correction_cosines.first;
-                    float c_2_cap = (6.0f - c2 + c3) * correction_cosines.second;
-
-                    // Calculate Diffraction Loss
-                    float diffraction_loss = free_space_loss + (c2 + c1 + c3 - c_1_cap - c_2_cap);
-
-                    // Calculate Received Power
-                    result.diffraction.diffraction_loss = diffraction_loss;
-
-                    // Calculate Delay
-                    float d1 = glm::distance(tx_position, near_tx_pos);
-                    float d2 = glm::distance(near_tx_pos, center_pos);
-                    float d3 = glm::distance(center_pos, near_rx_pos);
-                    float d4 = glm::distance(near_rx_pos, rx_position);
-                    float total_distance = d1 + d2 + d3 + d4;
-                    result.diffraction.delay = total_distance / LIGHT_SPEED;
+                DiffractionPath path;
+                if (DiffractionKernel::Evaluate(tx_position, rx_position, record.data.data(), record.data.size(),
+                                                tx_frequency, DiffractionKernel::ThreeEdgeLoss::kSubPaths, path)) {
+                    result.diffraction.diffraction_loss = free_space_loss + path.excess_loss;
+                    result.diffraction.delay = path.length / LIGHT_SPEED;
                 }
             } break;
         }
@@ -559,63 +626,56 @@ bool RayTracer::IsDirectHit(glm::vec3 start_position,glm::vec3 end_position) con
 	// get direction from start point to end point
 	glm::vec3 direction = glm::normalize(end_position - start_position);
 	float start_to_end_distance = glm::distance(start_position, end_position);
-	Ray ray{ start_position, direction };
-	float distance = FLT_MAX;
-	// trace the ray on this direction 
-	// check if the direction hit something and the t is not between start_point to end_point length
-	if (map_->IsHit(ray, distance) && distance < start_to_end_distance)
-		return false;
-
-	return true;
+	TracingRay ray{ start_position, direction, start_to_end_distance };
+	// blocked when anything is hit between start_point and end_point
+	return !map_->IsAnyHit(ray);
 }
 
 bool RayTracer::IsReflected(const glm::vec3 start_position, const glm::vec3 end_position, std::vector<glm::vec3>& reflected_points) const
 {
-	// Match the co-exist triangles between two points
-	std::vector<const Triangle*> check_triangles;
-
-	// Searching for check triangles
-	/*if (map_->GetObjects().size() > 129600) {
-		// scan hit_triangles
-		std::map<Triangle *, bool> start_hits = ScanHit(start_position); // it won't scan if the point is already checked
-		std::map<Triangle*, bool> end_hits = ScanHit(end_position);
-		for (auto const& [triangle, exist_value] : start_hits)
-			if (end_hits[triangle]) check_triangles.push_back(triangle);
-	}
-	else {
-		check_triangles = map_->GetObjects();
-	}*/
-    check_triangles = map_->GetObjects();
-	// check the reflections points on matches triangles
-
-	for (const Triangle * matched_triangle : check_triangles) {
-		// reflect one of the point on the triangle plane
-		glm::vec3 reflected_position = ReflectedPointOnTriangle(matched_triangle, start_position);
+	ImageSourceTable start_images;
+	ComputeImageSources(start_position, start_images);
+	return IsReflected(start_images, end_position, reflected_points);
+}
 
-		// Trace from the reflected point
+bool RayTracer::IsReflected(const ImageSourceTable& start_images, const glm::vec3 end_position, std::vector<glm::vec3>& reflected_points) const
+{
+	const glm::vec3 start_position = start_images.GetSource();
+
+	// Only the triangles that pass the geometric pre-filter are traced.
+	std::vector<TriangleIndex> candidates;
+	ReflectionCullStats cull_stats;
+	ReflectionFilter::Filter(map_->GetTriangles(), start_images, end_position, max_reflection_path_length_,
+	                         candidates, cull_stats);
+	cull_stats_.Add(cull_stats);
+
+	// Check the remaining triangles facet by facet: a facet is one mirror, so once the specular
+	// point is found on one of its triangles the others are skipped.
+	const TriangleBuffer& triangles = map_->GetTriangles();
+	const FacetSet& facets = map_->GetFacets();
+	const bool has_facets = !facets.Empty();
+	std::vector<FacetIndex> resolved_facets;
+	for (TriangleIndex matched_triangle : candidates) {
+		if (has_facets && std::find(resolved_facets.begin(), resolved_facets.end(),
+		                            facets.GetFacet(matched_triangle)) != resolved_facets.end())
+			continue;
+		// the start point mirrored on the triangle plane
+		glm::vec3 reflected_position = start_images.GetImage(matched_triangle);
+
+		// The specular point is where the segment from the image to the end crosses the triangle,
+		// solved directly on that triangle (plane intersection plus barycentric test).
 		glm::vec3 ref_to_end_direction = glm::normalize(end_position - reflected_position);
-
-		Ray ref_to_end_ray{ reflected_position, ref_to_end_direction };
-        // hit triangles from reflected_position to end_position
-		std::unordered_map<const Triangle *, float > hit_triangles; 
-
-		if (map_->IsHit(ref_to_end_ray, hit_triangles) && hit_triangles.find(matched_triangle) != hit_triangles.end()) {
-			/*for (auto const [triangle, distance] : hit_triangles) {
-				if (triangle == matched_triangle) {
-					reflection_point_position = reflected_position + ref_to_end_direction * (distance + 0.001f);
-					if (IsDirectHit(reflection_point_position, end_position) &&
-						IsDirectHit(reflection_point_position, start_position))
-						reflected_points.push_back(reflection_point_position);
-					break;
-				}
-			}*/
-            float distance = hit_triangles.find(matched_triangle)->second;
-            // add small value to move the point to surface.
-            glm::vec3 reflection_point_position = reflected_position + ref_to_end_direction * (distance + 0.001f);
-            if (IsDirectHit(reflection_point_position, end_position) &&
-                IsDirectHit(reflection_point_position, start_position))
-                reflected_points.push_back(reflection_point_position);
-		}
+		TracingRay ref_to_end_ray{ reflected_position, ref_to_end_direction, glm::distance(reflected_position, end_position) };
+		float distance;
+		if (!triangles.IsHit(matched_triangle, ref_to_end_ray, distance)) continue;
+		if (has_facets) resolved_facets.push_back(facets.GetFacet(matched_triangle));
+
+		// add small value to move the point to surface.
+		glm::vec3 reflection_point_position = reflected_position + ref_to_end_direction * (distance + 0.001f);
+		// Both legs must be free, each is an early-exit occlusion query.
+		if (IsDirectHit(reflection_point_position, end_position) &&
+		    IsDirectHit(reflection_point_position, start_position))
+			reflected_points.push_back(reflection_point_position);
 	}
 	if (reflected_points.empty()) return false;
 	return true;
@@ -658,19 +718,68 @@ float RayTracer::CalculateReflectionCoefficient(glm::vec3 start_position, glm::v
 }
 
 
-glm::vec3 RayTracer::ReflectedPointOnTriangle(const Triangle* triangle, glm::vec3 points)
+void RayTracer::ComputeImageSources(const glm::vec3 position, ImageSourceTable& images) const
 {
-	/// The reflections point on the triangle plane can be calculated as following:
+	images.Build(map_->GetTriangles(), position);
+}
 
-	// 1. construct the plane from 3 points (non-collinear points)
-	auto triangle_points = triangle->GetPoints();
-	const glm::vec3 & p_0 = triangle_points[0];
-    const glm::vec3 & p_1 = triangle_points[1];
-    const glm::vec3 & p_2 = triangle_points[2];
+bool RayTracer::ComputeImageTree(const glm::vec3 position, const unsigned int max_order, ImageTree& tree) const
+{
+	if (tree.Build(position, max_order)) return true;
+	std::cout << "Image tree cut at " << ImageTree::k_max_nodes << " images, paths of order up to "
+	          << max_order << " are incomplete" << std::endl;
+	return false;
+}
+
+bool RayTracer::IsMultipleReflected(const ImageTree& tree, const glm::vec3 end_position,
+                                    std::vector<std::vector<glm::vec3>>& paths) const
+{
+	const glm::vec3 start_position = tree.GetSource();
+	const auto& nodes = tree.GetNodes();
+	std::vector<glm::vec3> bounce_positions;
+	for (std::uint32_t node = 0; node < nodes.size(); ++node) {
+		// First order is done by IsReflected.
+		if (nodes[node].order < 2) continue;
+		if (!tree.GetPath(node, end_position, bounce_positions)) continue;
+
+		// Every leg must be free, each one an early-exit occlusion query.
+		bool is_clear = IsDirectHit(start_position, bounce_positions.front()) &&
+		                IsDirectHit(bounce_positions.back(), end_position);
+		for (std::size_t i = 1; i < bounce_positions.size() && is_clear; ++i)
+			is_clear = IsDirectHit(bounce_positions[i - 1], bounce_positions[i]);
+		if (is_clear) paths.push_back(bounce_positions);
+	}
+	return !paths.empty();
+}
+
+void RayTracer::SetMaxReflectionPathLength(const float max_path_length)
+{
+	max_reflection_path_length_ = max_path_length;
+}
+
+float RayTracer::GetMaxReflectionPathLength() const
+{
+	return max_reflection_path_length_;
+}
 
-	glm::vec3 n = triangle->GetNormal();
+ReflectionCullStats RayTracer::GetReflectionCullStats() const
+{
+	return cull_stats_.Load();
+}
 
-	float b = (n.x * p_1.x) + (n.y * p_1.y) + (n.z * p_1.z);
+void RayTracer::ResetReflectionCullStats()
+{
+	cull_stats_.Reset();
+}
+
+glm::vec3 RayTracer::ReflectedPointOnTriangle(const TriangleBuffer& triangles, TriangleIndex triangle, glm::vec3 points)
+{
+	/// The reflections point on the triangle plane can be calculated as following:
+
+	// 1. the plane n . x = b is stored with the triangle
+	glm::vec3 n = triangles.GetNormal(triangle);
+
+	float b = triangles.GetPlaneOffset(triangle);
 	// 2. mirror the point from the plane
 	float t = (b - (points.x * n.x + points.y * n.y + points.z * n.z)) / (n.x * n.x + n.y * n.y + n.z * n.z); //distance from point to plane
 	
@@ -682,6 +791,16 @@ glm::vec3 RayTracer::ReflectedPointOnTriangle(const Triangle* triangle, glm::vec
 
 bool RayTracer::IsKnifeEdgeDiffraction( const glm::vec3 start_position, const glm::vec3 end_position, std::vector<glm::vec3>& edges_points) const
 {
+	// The edge graph and the height map answer with one query; maps without them fall back to the sweeps.
+	if (diffraction_search_ == DiffractionSearch::kHeightProfile && !map_->GetHeightMap().Empty()) {
+		if (IsDirectHit(start_position, end_position)) return false;
+		return map_->GetHeightMap().GetKnifeEdges(start_position, end_position, profile_method_, edges_points);
+	}
+	if (diffraction_search_ == DiffractionSearch::kEdgeGraph && !map_->GetEdges().Empty()) {
+		if (IsDirectHit(start_position, end_position)) return false;
+		return map_->GetEdges().GetKnifeEdges(start_position, end_position, edges_points);
+	}
+
 	const unsigned int max_scan = 10; // Maximum Scan
 	unsigned int current_scan = 0;
 
@@ -719,48 +838,74 @@ bool RayTracer::IsKnifeEdgeDiffraction( const glm::vec3 start_position, const gl
 bool RayTracer::FindEdge(const glm::vec3 start_position,const glm::vec3 end_position, glm::vec3& edge_position) const
 {
 	const glm::vec3 up_direction = glm::vec3(0.0f, 1.0f, 0.0f);
-	const float scan_precision = .5f;
-	glm::vec3 start_end_direction = glm::normalize(end_position - start_position);
+	const float coarse_step = glm::radians(k_edge_search_step);
+	const glm::vec3 start_end_direction = glm::normalize(end_position - start_position);
 
 	const float min_x = std::min(end_position.x, start_position.x);
 	const float max_x = std::max(end_position.x, start_position.x);
 	const float min_z = std::min(end_position.z, start_position.z);
 	const float max_z = std::max(end_position.z, start_position.z);
 
-	glm::vec3 latest_hit_position;
-	float latest_hit_distance = -1.0f;
-	glm::vec3 latest_hit_direction;
-	glm::vec3 scan_direction;
-	float scan_hit_distance;
-
-	const glm::vec3 start_cross_direction = glm::cross(-up_direction, start_end_direction);
-	for (float current_angle = 0.0f; current_angle < 180.0f; current_angle += scan_precision) {
-		glm::mat3 direction_trans = glm::rotate(glm::mat4(1.0f), glm::radians(current_angle), start_cross_direction);
-		scan_direction = glm::normalize(glm::vec3(direction_trans * start_end_direction));
-		// if scan_direction is near almost equal to up_direction, then we stop scanning
-		if (glm::degrees(glm::angle(scan_direction, up_direction)) < 1.0f) return false;
-
-		Ray scan_ray{ start_position, scan_direction }; //implement to heap later
-
-		if (map_->IsHit(scan_ray, scan_hit_distance)) {
-			latest_hit_position = start_position + scan_direction * scan_hit_distance;
-			// latest_hit_position should be in between start_positon and end_position in xz plane
-			if (latest_hit_position.x < min_x || latest_hit_position.x > max_x ||
-				latest_hit_position.z < min_z || latest_hit_position.z > max_z) {
-				break;
-			}
-			latest_hit_distance = scan_hit_distance;
-			latest_hit_direction = scan_direction;
+	// The scan turns start_end_direction up in its vertical plane; the axis is perpendicular to it,
+	// so a turn by a is cos(a) * direction + sin(a) * (axis x direction).
+	const glm::vec3 axis = glm::normalize(glm::cross(-up_direction, start_end_direction));
+	const glm::vec3 upward_direction = glm::cross(axis, start_end_direction);
+	const auto direction_at = [&](float angle) {
+		return glm::normalize(std::cos(angle) * start_end_direction + std::sin(angle) * upward_direction);
+	};
+	// Stop 1 degree short of straight up, as there is no edge to find beyond.
+	const float max_angle = glm::angle(start_end_direction, up_direction) - glm::radians(1.0f);
+
+	// A ray is blocked when it hits between start_position and end_position in the xz plane.
+	const auto is_blocked = [&](const glm::vec3& direction, float& hit_distance) {
+		if (!map_->IsHit(TracingRay{ start_position, direction }, hit_distance)) return false;
+		const glm::vec3 hit_position = start_position + direction * hit_distance;
+		return hit_position.x >= min_x && hit_position.x <= max_x &&
+		       hit_position.z >= min_z && hit_position.z <= max_z;
+	};
+
+	// Coarse steps up to the first clear ray, the direction turned incrementally.
+	float blocked_angle = 0.0f, blocked_distance = 0.0f;
+	glm::vec3 blocked_direction = start_end_direction;
+	if (max_angle <= 0.0f || !is_blocked(blocked_direction, blocked_distance)) return false;
+	const float step_cos = std::cos(coarse_step), step_sin = std::sin(coarse_step);
+	glm::vec3 scan_direction = blocked_direction;
+	float clear_angle = 0.0f;
+	for (float current_angle = coarse_step;; current_angle += coarse_step) {
+		float hit_distance;
+		if (current_angle >= max_angle) {
+			if (is_blocked(direction_at(max_angle), hit_distance)) return false;
+			clear_angle = max_angle;
+			break;
 		}
-		else {
-			if (latest_hit_distance == -1.0f) return false;
+		scan_direction = glm::normalize(step_cos * scan_direction + step_sin * glm::cross(axis, scan_direction));
+		if (!is_blocked(scan_direction, hit_distance)) {
+			clear_angle = current_angle;
 			break;
 		}
+		blocked_angle = current_angle;
+		blocked_distance = hit_distance;
+		blocked_direction = scan_direction;
+	}
+
+	// Bisect between the last blocked and the first clear ray.
+	while (clear_angle - blocked_angle > glm::radians(edge_search_tolerance_)) {
+		const float middle_angle = 0.5f * (blocked_angle + clear_angle);
+		const glm::vec3 middle_direction = direction_at(middle_angle);
+		float hit_distance;
+		if (is_blocked(middle_direction, hit_distance)) {
+			blocked_angle = middle_angle;
+			blocked_distance = hit_distance;
+			blocked_direction = middle_direction;
+		} else {
+			clear_angle = middle_angle;
+		}
 	}
+	scan_direction = direction_at(clear_angle);
 
 	glm::vec3 start_end_on_xz_direction = glm::normalize(glm::vec3(start_end_direction.x, 0.0f, start_end_direction.z));
-	float start_end_to_on_xz_angle = glm::angle(latest_hit_direction, start_end_on_xz_direction);
-	float distance_on_xz = latest_hit_distance * cos(start_end_to_on_xz_angle);
+	float start_end_to_on_xz_angle = glm::angle(blocked_direction, start_end_on_xz_direction);
+	float distance_on_xz = blocked_distance * cos(start_end_to_on_xz_angle);
 	float start_edge_angle = glm::angle(start_end_on_xz_direction, scan_direction);
 	float distance_to_edge = distance_on_xz / cos(start_edge_angle);
 
@@ -769,16 +914,32 @@ bool RayTracer::FindEdge(const glm::vec3 start_position,const glm::vec3 end_posi
 	return true;
 }
 
+void RayTracer::SetEdgeSearchTolerance(const float tolerance)
+{
+	edge_search_tolerance_ = tolerance;
+}
+
+float RayTracer::GetEdgeSearchTolerance() const
+{
+	return edge_search_tolerance_;
+}
+
 glm::vec3 RayTracer::NearestEdgeFromPoint(glm::vec3 point_position, std::vector<glm::vec3>& edges_points)
 {
-	std::map<float, glm::vec3> distance_from_point;
-	for (auto edge_point : edges_points) { // implemenet to function
-		glm::vec3 point_position_on_xz = glm::vec3(point_position.x, 0.0f, point_position.z);
-		glm::vec3 edge_point_on_xz = glm::vec3(edge_point.x, 0.0f, edge_point.z);
-		distance_from_point[glm::distance(edge_point_on_xz, point_position_on_xz)] = edge_point;
+	// Nearest on the xz plane; on a tie the later edge wins.
+	std::size_t nearest = 0;
+	float nearest_distance = FLT_MAX;
+	for (std::size_t i = 0; i < edges_points.size(); ++i) {
+		const float distance = glm::distance(glm::vec2(edges_points[i].x, edges_points[i].z),
+		                                     glm::vec2(point_position.x, point_position.z));
+		if (distance <= nearest_distance) {
+			nearest = i;
+			nearest_distance = distance;
+		}
 	}
-	edges_points.erase(std::remove(edges_points.begin(), edges_points.end(), distance_from_point.begin()->second), edges_points.end());
-	return glm::vec3(distance_from_point.begin()->second);
+	const glm::vec3 nearest_edge = edges_points[nearest];
+	edges_points.erase(std::remove(edges_points.begin(), edges_points.end(), nearest_edge), edges_points.end());
+	return nearest_edge;
 }
 
 void RayTracer::CleanEdgePoints(const glm::vec3 start_position, const glm::vec3 end_position, std::vector<glm::vec3>& edges_points) const
@@ -855,47 +1016,20 @@ float RayTracer::CalculateSingleKnifeEdge(glm::vec3 start_position, glm::vec3 ed
 }
 
 float RayTracer::CalculateDiffractionByV(float v) {
-	return 6.9f + 20.0 * log10(sqrt(pow(v - 0.1, 2) + 1) + v - 0.1);
+	return DiffractionKernel::CalculateLossByV(v);
 }
 
 float RayTracer::CalculateVOfEdge(glm::vec3 start_position, glm::vec3 edge_position,
                                   glm::vec3 end_position, float frequency) {
-	
-	float wave_length = 3e8 / (frequency);
-	glm::vec3 start_to_end_direction = glm::normalize(end_position - start_position);
-
-	glm::vec3 start_to_edge_direction = glm::normalize(edge_position - start_position);
-	glm::vec3 end_to_edge_direction = glm::normalize(edge_position - end_position);
-
-	float angle_1 = glm::angle(start_to_edge_direction, start_to_end_direction);
-	float angle_2 = glm::angle(end_to_edge_direction, -start_to_end_direction);
-	float r1 = glm::distance(start_position, edge_position);
-	float r2 = glm::distance(end_position, edge_position);
-	float s1 = r1 * cos(angle_1);
-	float s2 = r2 * cos(angle_2);
-	float h = sin(angle_1) * r1;
-	float v = h * sqrt((2.0f / wave_length) * (s1 + s2) / (r1 * r2));
-
-	return v;
+	return DiffractionKernel::CalculateV(start_position, edge_position, end_position, frequency);
 }
 
-void RayTracer::CalculateCorrectionCosines(	glm::vec3 start_position, std::vector<glm::vec3> edges,
+void RayTracer::CalculateCorrectionCosines(	glm::vec3 start_position, const std::vector<glm::vec3> & edges,
 											glm::vec3 end_position, std::pair<float, float>& calculated_cosines)
 {
-	glm::vec3 p1 = start_position;
-	glm::vec3 p2 = NearestEdgeFromPoint(p1, edges);
-	glm::vec3 p3 = NearestEdgeFromPoint(p2, edges);
-	glm::vec3 p4 = NearestEdgeFromPoint(p3, edges);
-	glm::vec3 p5 = end_position;
-
-	float d1 = glm::distance(glm::vec2(p1.x, p1.z), glm::vec2(p2.x, p2.z));
-	float d2 = glm::distance(glm::vec2(p2.x, p2.z), glm::vec2(p3.x, p3.z));
-	float d3 = glm::distance(glm::vec2(p3.x, p3.z), glm::vec2(p4.x, p4.z));
-	float d4 = glm::distance(glm::vec2(p4.x, p4.z), glm::vec2(p5.x, p5.z));
-
-	calculated_cosines.first = sqrt((d1 * (d3 + d4)) / ((d1 + d2) * (d2 + d3 + d4)));
-	calculated_cosines.second = sqrt((d4 * (d1 + d2)) / ((d3 + d4) * (d1 + d2 + d3)));
-	return;
+	// The first three edges of the nearest edge chain from the start.
+	DiffractionKernel::CalculateCorrectionCosines(start_position, edges.data(), edges.size(), end_position,
+	                                              calculated_cosines.first, calculated_cosines.second);
 }
 
 void RayTracer::CalculateDirectPath(const Record &record, Result &result, Transmitter *transmitter, Receiver *receiver) const {
@@ -930,22 +1064,27 @@ void RayTracer::CalculateReflections(const Record &record, Result &result, Trans
     // Get Receiver's Info
     const auto & rx_pos = receiver->GetPosition();
 
-    // Prepare Threads
-    std::vector<std::thread> threads;
-    for (auto & reflect_position : record.data) {
+    // One slot per reflection point, every task writes only its own.
+    result.reflections.resize(record.data.size());
+    // Transmitter gains towards all reflection points in one batch.
+    std::vector<float> tx_gains(record.data.size());
+    transmitter->GetTransmitterGains(record.data.data(), record.data.size(), tx_gains.data());
+
+    // Fork one task per reflection point.
+    TaskGroup tasks;
+    for (std::size_t i = 0; i < record.data.size(); ++i) {
+        const glm::vec3 & reflect_position = record.data[i];
+        ReflectionResult & reflection = result.reflections[i];
         // Get gains before compute.
-        float tx_gain = transmitter->GetTransmitterGain(reflect_position);
+        float tx_gain = tx_gains[i];
         float rx_gain = receiver->GetReceiverGain(reflect_position);
-        // construct a thread.
-        std::thread reflection_thread(&RayTracer::CalculateReflection, this,
-                                      tx_pos, rx_pos, tx_freq, tx_gain,
-                                      rx_gain, tx_power, reflect_position, std::ref(result));
-        threads.push_back(std::move(reflection_thread));
+        tasks.Run([=, &reflect_position, &reflection]() {
+            CalculateReflection(tx_pos, rx_pos, tx_freq, tx_gain, rx_gain, tx_power, reflect_position, reflection);
+        });
     }
 
-    // Run Threads
-    for (std::thread & thread: threads)
-        if (thread.joinable()) thread.join();
+    // Join all tasks.
+    tasks.Wait();
 }
 
 void RayTracer::CalculateDiffraction(const Record &record, Result &result, Transmitter *transmitter, Receiver *receiver) const {
@@ -953,7 +1092,6 @@ void RayTracer::CalculateDiffraction(const Record &record, Result &result, Trans
     // Get Transmitter's Info
     const auto &tx_pos = transmitter->GetPosition();
     const auto &tx_freq = transmitter->GetFrequency();
-    const auto &tx_power = transmitter->GetTransmitPower();
     // Get Receiver's Info
     const auto &rx_pos = receiver->GetPosition();
 
@@ -961,153 +1099,63 @@ void RayTracer::CalculateDiffraction(const Record &record, Result &result, Trans
     const float distance = glm::distance(tx_pos, rx_pos);
     float free_space_loss = 20 * log10(distance) + 20 * log10(tx_freq) - 147.55f;
 
-    if (record.data.size() == 1) {
-        // Get Edge Position from Record.
-        const glm::vec3 edge_position = record.data[0];
-
-        // Calculate the gain.
-        const auto &tx_gain = transmitter->GetTransmitterGain(edge_position);
-        const auto &rx_gain = receiver->GetReceiverGain(edge_position);
-        result.diffraction.tx_gain = tx_gain;
-        result.diffraction.rx_gain = rx_gain;
-
-        // Calculate V
-        float v = CalculateVOfEdge(tx_pos, edge_position, rx_pos, tx_freq);
-
-        // Calculate Diffraction Loss from V and FSPL.
-        float diff_loss = free_space_loss + CalculateDiffractionByV(v);
-
-        // Calculate the receive power
-        result.diffraction.diffraction_loss = diff_loss;
-
-        // Calculate Delay
-        float distance = glm::distance(edge_position, tx_pos) +
-                         glm::distance(edge_position, rx_pos);
-
-        result.diffraction.delay = distance / LIGHT_SPEED;
-    } 
-    else if (record.data.size() == 2) {
-        // Copy Edges to stack.
-        std::vector<glm::vec3> edges = record.data;
-        const glm::vec3 nearest_tx_edge = NearestEdgeFromPoint(tx_pos, edges);
-        const glm::vec3 nearest_rx_edge = NearestEdgeFromPoint(rx_pos, edges);
-        // Calculate tx, rx gains
-        const float &tx_gain = transmitter->GetTransmitterGain(nearest_tx_edge);
-        const float &rx_gain = receiver->GetReceiverGain(nearest_rx_edge);
-        result.diffraction.tx_gain = tx_gain;
-        result.diffraction.rx_gain = rx_gain;
-        // Find the max V as single edge V
-        glm::vec3 edge_posiiton;
-        const float v1 = CalculateVOfEdge(tx_pos, nearest_tx_edge, rx_pos, tx_freq);
-        const float v2 = CalculateVOfEdge(tx_pos, nearest_rx_edge, rx_pos, tx_freq);
-        const float max_v = std::max({v1, v2});
-        float diff_loss = free_space_loss + CalculateDiffractionByV(max_v);
-
-        // Calculate Receive Power
-        result.diffraction.diffraction_loss = diff_loss;
-
-        // Calculate Delay
-        float distance = glm::distance(tx_pos, nearest_tx_edge) + glm::distance(nearest_tx_edge, nearest_rx_edge)
-                         + glm::distance(nearest_rx_edge, rx_pos);
-        result.diffraction.delay = distance / LIGHT_SPEED;
-    } 
-    else if (record.data.size() == 3) {
-        // Copy Edges to find edge positions.
-        std::vector<glm::vec3> edges = record.data;
-        glm::vec3 near_tx_pos = NearestEdgeFromPoint(tx_pos, edges);
-        glm::vec3 center_pos = NearestEdgeFromPoint(near_tx_pos, edges);
-        glm::vec3 near_rx_pos = NearestEdgeFromPoint(rx_pos, edges);
-
-        // Calculate tx and rx gain.
-        const float &tx_gain = transmitter->GetTransmitterGain(near_tx_pos);
-        const float &rx_gain = receiver->GetReceiverGain(near_rx_pos);
-
-        result.diffraction.tx_gain = tx_gain;
-        result.diffraction.rx_gain = rx_gain;
-
-        // Calculate C1, C2, and C3.
-        float c1 = CalculateSingleKnifeEdge(tx_pos, near_tx_pos, rx_pos, tx_freq);
-        float c2 = CalculateSingleKnifeEdge(tx_pos, center_pos, rx_pos, tx_freq);
-        float c3 = CalculateSingleKnifeEdge(tx_pos, near_rx_pos, rx_pos, tx_freq);
-
-        // Calculate Corrections.
-        std::pair<float, float> correction_cosines;
-        CalculateCorrectionCosines(tx_pos, record.data, rx_pos, correction_cosines);
-        float c_1_cap = (6.0f - c2 + c1) * correction_cosines.first;
-        float c_2_cap = (6.0f - c2 + c3) * correction_cosines.second;
-
-        // Calculate Diffraction Loss
-        float diffraction_loss = free_space_loss + (c2 + c1 + c3 - c_1_cap - c_2_cap);
-
-        // Calculate Received Power
-        result.diffraction.diffraction_loss = diffraction_loss;
-
-        // Calculate Delay
-        float d1 = glm::distance(tx_pos, near_tx_pos);
-        float d2 = glm::distance(near_tx_pos, center_pos);
-        float d3 = glm::distance(center_pos, near_rx_pos);
-        float d4 = glm::distance(near_rx_pos, rx_pos);
-        float total_distance = d1 + d2 + d3 + d4;
-        result.diffraction.delay = total_distance / LIGHT_SPEED;
-    } 
-    else {
-        // Find highest Vs in the edges
-        std::set<float> highest_v;
-        std::map<float, glm::vec3> edges_dict;
-        for (auto edge : record.data) {
-            float temp_v = CalculateVOfEdge(tx_pos, edge, rx_pos, tx_freq);
-            edges_dict[temp_v] = edge;
-            highest_v.insert(temp_v);
-        }
-        std::vector<glm::vec3> edges;
-        int i = 0;
-        // choose the highest v from the highest_v
-        for (auto ritr = highest_v.rbegin(); ritr != highest_v.rend(); ++ritr) {
-            edges.push_back(edges_dict[*ritr]);
-            if (i++ == 2) break;
-        }
-        glm::vec3 near_tx_pos = NearestEdgeFromPoint(tx_pos, edges);
-        glm::vec3 center_pos = NearestEdgeFromPoint(near_tx_pos, edges);
-        glm::vec3 near_rx_pos = NearestEdgeFromPoint(rx_pos, edges);
-
-        // Calculate tx and rx gain.
-        const float &tx_gain = transmitter->GetTransmitterGain(near_tx_pos);
-        const float &rx_gain = receiver->GetReceiverGain(near_rx_pos);
-        result.diffraction.tx_gain = tx_gain;
-        result.diffraction.rx_gain = rx_gain;
-
-
-        // Calculate C1, C2, and C3.
-        float c1 = CalculateSingleKnifeEdge(tx_pos, near_tx_pos, center_pos, tx_freq);
-        float c2 = CalculateSingleKnifeEdge(tx_pos, center_pos, rx_pos, tx_freq);
-        float c3 = CalculateSingleKnifeEdge(center_pos, near_rx_pos, rx_pos, tx_freq);
-
-        // Calculate Corrections.
-        std::pair<float, float> correction_cosines;
-        CalculateCorrectionCosines(tx_pos, record.data, rx_pos, correction_cosines);
-        float c_1_cap = (6.0f - c2 + c1) * correction_cosines.first;
-        float c_2_cap = (6.0f - c2 + c3) * correction_cosines.second;
-
-        // Calculate Diffraction Loss
-        float diffraction_loss = free_space_loss + (c2 + c1 + c3 - c_1_cap - c_2_cap);
-
-        // Calculate Received Power
-        result.diffraction.diffraction_loss = diffraction_loss;
-
-        // Calculate Delay
-        float d1 = glm::distance(tx_pos, near_tx_pos);
-        float d2 = glm::distance(near_tx_pos, center_pos);
-        float d3 = glm::distance(center_pos, near_rx_pos);
-        float d4 = glm::distance(near_rx_pos, rx_pos);
-        float total_distance = d1 + d2 + d3 + d4;
-        result.diffraction.delay = total_distance / LIGHT_SPEED;
+    // Edges picked and ordered along the path, no allocation.
+    DiffractionPath path;
+    if (!DiffractionKernel::Evaluate(tx_pos, rx_pos, record.data.data(), record.data.size(), tx_freq,
+                                     DiffractionKernel::ThreeEdgeLoss::kDirectPath, path))
+        return;
+
+    // Calculate tx and rx gain towards the edges they see.
+    result.diffraction.tx_gain = transmitter->GetTransmitterGain(path.tx_edge);
+    result.diffraction.rx_gain = receiver->GetReceiverGain(path.rx_edge);
+
+    // Calculate Diffraction Loss and Delay
+    result.diffraction.diffraction_loss = free_space_loss + path.excess_loss;
+    result.diffraction.delay = path.length / LIGHT_SPEED;
+}
+
+float RayTracer::CalculateMultipleReflectionLoss(const glm::vec3 start_position, const glm::vec3 end_position,
+                                                 const std::vector<glm::vec3> & bounce_positions,
+                                                 const float frequency, float & delay)
+{
+    // Free space loss over the unfolded path plus the loss of every bounce.
+    constexpr Polarization polar = TE;
+    float total_distance = 0.0f;
+    float coefficients_loss = 0.0f;
+    glm::vec3 previous_position = start_position;
+    for (std::size_t i = 0; i < bounce_positions.size(); ++i) {
+        const glm::vec3 next_position = i + 1 < bounce_positions.size() ? bounce_positions[i + 1] : end_position;
+        const float ref_coe = CalculateReflectionCoefficient(previous_position, next_position,
+                                                             bounce_positions[i], polar);
+        coefficients_loss -= 20*log10(abs(ref_coe));
+        total_distance += glm::distance(previous_position, bounce_positions[i]);
+        previous_position = bounce_positions[i];
     }
+    total_distance += glm::distance(previous_position, end_position);
+
+    delay = total_distance/LIGHT_SPEED;
+    return 20*log10(total_distance) + 20*log10(frequency) + coefficients_loss - 147.55f;
+}
+
+void RayTracer::CalculateMultipleReflection(const Record &record, Result &result, Transmitter *transmitter, Receiver *receiver) const {
+    // Get Transmitter's and Receiver's Info.
+    const auto tx_pos = transmitter->GetPosition();
+    const auto tx_freq = transmitter->GetFrequency();
+    const auto rx_pos = receiver->GetPosition();
+
+    // Gains towards the first and the last bounce.
+    float tx_gain = transmitter->GetTransmitterGain(record.data.front());
+    float rx_gain = receiver->GetReceiverGain(record.data.back());
+
+    float delay;
+    float reflection_loss = CalculateMultipleReflectionLoss(tx_pos, rx_pos, record.data, tx_freq, delay);
+    result.reflections.push_back(ReflectionResult{reflection_loss, delay, tx_gain, rx_gain});
 }
 
 void RayTracer::CalculateReflection( const glm::vec3 & tx_position, const glm::vec3 & rx_position,
                                      const float & tx_freq, const float & tx_gain,
                                      const float & rx_gain, const float & tx_power,
-                                     const glm::vec3 & ref_position, Result & result) const {
+                                     const glm::vec3 & ref_position, ReflectionResult & reflection) const {
 
     // Get distances.
     float d1 = glm::distance(tx_position, ref_position);
@@ -1124,8 +1172,8 @@ void RayTracer::CalculateReflection( const glm::vec3 & tx_position, const glm::v
     // Calculate delay.
     float delay = total_distance/LIGHT_SPEED;
 
-    // Store the values in result.
-    result.reflections.push_back(ReflectionResult{reflection_loss, delay, tx_gain, rx_gain});
+    // Store the values in the slot of this reflection.
+    reflection = ReflectionResult{reflection_loss, delay, tx_gain, rx_gain};
 }
 
 void RayTracer::GetMapBorder(float &min_x, float &max_x, float & min_z, float & max_z) const {
@@ -17,17 +17,22 @@
 #include <glm/glm.hpp>
 
 #include "record.hpp"
+#include "triangle_buffer.hpp"
+#include "reflection_filter.hpp"
+#include "height_map.hpp"
 
 class Shader;
 class PolygonMesh;
 class Ray;
-class Triangle;
 class Shader;
 class Object;
 class Camera;
 class Transmitter;
 class Receiver;
 class Recorder;
+class ImageSourceTable;
+class ImageTree;
+class SbrTracer;
 
 struct Record;
 struct Point;
@@ -38,17 +43,61 @@ enum Polarization : bool {
 	TE = false
 };
 
+// How reflections are found; the line of sight and diffraction are traced the same way in both.
+enum class TracingMode : int {
+	kImage = 0, // exact image method per transmitter and receiver pair
+	kSbr // shooting and bouncing rays, all receivers of a transmitter in one launch
+};
+
+// How the knife edges of a blocked path are found.
+enum class DiffractionSearch : int {
+	kScan = 0, // angular ray sweeps from both ends
+	kEdgeGraph, // crossings of the precomputed edges with the vertical plane of the path
+	kHeightProfile // profile from the height map of the mesh, fast but bounded by its cell size
+};
+
 class RayTracer {
 public:
+	static constexpr float k_edge_search_step = 8.0f; // degrees between the coarse rays of FindEdge
+	static constexpr float k_default_edge_search_tolerance = 0.1f; // degrees
+	static constexpr unsigned int k_max_reflection_order = 3; // the image tree outgrows its node cap past this
 	RayTracer(PolygonMesh * map);
+	~RayTracer();
+	RayTracer(const RayTracer&) = delete;
+	RayTracer& operator=(const RayTracer&) = delete;
+
+	void SetTracingMode(TracingMode mode);
+	TracingMode GetTracingMode() const;
+	const SbrTracer * GetSbrTracer() const;
+	// kHeightProfile builds the height map of the mesh when it has none yet.
+	void SetDiffractionSearch(DiffractionSearch search);
+	DiffractionSearch GetDiffractionSearch() const;
+	// Edge selection on the profile for kHeightProfile.
+	void SetProfileMethod(ProfileMethod method);
+	ProfileMethod GetProfileMethod() const;
 	
 	// Ray Tracing Part
+	// Reflections of order 2 up to max_reflection_order come as kMultipleReflect records.
 	void Trace( glm::vec3 start_position,
                 glm::vec3 end_position,
-                std::vector<Record> & records) const;
+                std::vector<Record> & records,
+                unsigned int max_reflection_order = 1) const;
     void TraceMap(glm::vec3 tx_position,
                   glm::vec3 rx_position,
                   std::vector<Record> &records) const;
+    // Same as TraceMap, the reflections come from the images of the receiver (paths are reciprocal).
+    void TraceMap(glm::vec3 tx_position,
+                  const ImageSourceTable & rx_images,
+                  std::vector<Record> &records) const;
+    // Same as Trace up to the first order, with the images of the start position built beforehand.
+    void Trace( const ImageSourceTable & start_images,
+                glm::vec3 end_position,
+                std::vector<Record> & records) const;
+    // One start position, many end positions: records[i] gets the paths to end_positions[i].
+    void Trace( const ImageSourceTable & start_images,
+                const std::vector<glm::vec3> & end_positions,
+                std::vector<std::vector<Record>> & records,
+                unsigned int max_reflection_order = 1) const;
 
 	void LineTrace(  glm::vec3 start_position,
                      glm::vec3 end_position,
@@ -57,22 +106,43 @@ public:
 
     void ReflectTrace(glm::vec3 start_position,
                       glm::vec3 end_position,
-                      std::vector<Record> &records) const;
+                      std::vector<Record> &records,
+                      unsigned int max_reflection_order = 1) const;
 
     void GetMapBorder(float & min_x, float & max_x, float & min_z, float & max_z) const;
 	// Line of Sight
 	bool IsDirectHit( glm::vec3 start_position, glm::vec3 end_position) const;
 	
 	// Reflection
-	std::map<Triangle *, bool> ScanHit(glm::vec3 position) const;
-	std::vector <Triangle*> ScanHitVec(glm::vec3 position) const;
+	std::map<TriangleIndex, bool> ScanHit(glm::vec3 position) const;
+	std::vector <TriangleIndex> ScanHitVec(glm::vec3 position) const;
 	bool IsReflected(glm::vec3 start_position, glm::vec3 end_position, std::vector<glm::vec3> & reflected_points) const;
+	bool IsReflected(const ImageSourceTable & start_images, glm::vec3 end_position, std::vector<glm::vec3> & reflected_points) const;
+	void ComputeImageSources(glm::vec3 position, ImageSourceTable & images) const;
+	// Paths of order 2 and up through the image tree, each leg checked for occlusion.
+	bool IsMultipleReflected(const ImageTree & tree, glm::vec3 end_position,
+	                         std::vector<std::vector<glm::vec3>> & paths) const;
+	// False when the tree was cut at ImageTree::k_max_nodes.
+	bool ComputeImageTree(glm::vec3 position, unsigned int max_order, ImageTree & tree) const;
+	static float CalculateMultipleReflectionLoss(glm::vec3 start_position, glm::vec3 end_position,
+	                                             const std::vector<glm::vec3> & bounce_positions,
+	                                             float frequency, float & delay);
+	// Reflections with a longer path are not traced (default: no limit).
+	void SetMaxReflectionPathLength(float max_path_length);
+	float GetMaxReflectionPathLength() const;
+	// Totals of the reflection pre-filter over all IsReflected calls since the last reset.
+	ReflectionCullStats GetReflectionCullStats() const;
+	void ResetReflectionCullStats();
 	static float CalculateReflectionCoefficient(glm::vec3 start_position, glm::vec3 end_position, glm::vec3 reflection_position, Polarization polar) ;
-	static glm::vec3 ReflectedPointOnTriangle(const Triangle * triangle, glm::vec3 point) ;
+	static glm::vec3 ReflectedPointOnTriangle(const TriangleBuffer& triangles, TriangleIndex triangle, glm::vec3 point) ;
 
 	// Diffraction
 	bool IsKnifeEdgeDiffraction(glm::vec3 start_point, glm::vec3 end_point, std::vector<glm::vec3> & edges_points) const;
+	// Turns the ray from start towards end upwards in coarse steps until it clears, then bisects.
 	bool FindEdge(glm::vec3 start_position, glm::vec3 end_position, glm::vec3 & edge_position) const;
+	// Angular tolerance of the bisection in FindEdge, degrees.
+	void SetEdgeSearchTolerance(float tolerance);
+	float GetEdgeSearchTolerance() const;
 	static glm::vec3 NearestEdgeFromPoint(glm::vec3 point_position, std::vector<glm::vec3> & edges_points ) ;
 	void CleanEdgePoints(glm::vec3 start_position, glm::vec3 end_position, std::vector<glm::vec3> & edges_points) const;
 	float GetHighestPoint(std::vector<glm::vec3> edges) const;
@@ -81,7 +151,7 @@ public:
 	float CalculateSingleKnifeEdge(glm::vec3 start_position, glm::vec3 edge_position, glm::vec3 end_position, float frequency) const;
 	static float CalculateDiffractionByV(float v) ;
 	static float CalculateVOfEdge(glm::vec3 start_position, glm::vec3 edge_position, glm::vec3 end_position, float frequency) ;
-	static void CalculateCorrectionCosines(glm::vec3 start_position, std::vector<glm::vec3> edges, glm::vec3 end_position,
+	static void CalculateCorrectionCosines(glm::vec3 start_position, const std::vector<glm::vec3> & edges, glm::vec3 end_position,
                                             std::pair<float, float> & calculated_cosines) ;
 
 	void CalculateDirectPath(const Record & record, Result & result, Transmitter * transmitter,
@@ -91,9 +161,11 @@ public:
     void CalculateReflection( const glm::vec3 & tx_position, const glm::vec3 & rx_position,
                               const float & tx_freq, const float & tx_gain,
                               const float & rx_gain, const float & tx_power,
-                              const glm::vec3 & ref_position, Result & result) const;
+                              const glm::vec3 & ref_position, ReflectionResult & reflection) const;
     void CalculateDiffraction(const Record & record, Result & result,
                               Transmitter * transmitter, Receiver * receiver) const;
+    void CalculateMultipleReflection(const Record & record, Result & result,
+                                     Transmitter * transmitter, Receiver * receiver) const;
     bool CalculatePathLoss(Transmitter* transmitter, Receiver * receiver,
                            const std::vector<Record>& records,
                            Result& result) const;
@@ -112,5 +184,12 @@ public:
 
 private:
 	PolygonMesh * map_;
+	TracingMode tracing_mode_;
+	DiffractionSearch diffraction_search_;
+	ProfileMethod profile_method_;
+	SbrTracer * sbr_tracer_;
+	float edge_search_tolerance_;
+	float max_reflection_path_length_;
+	mutable SharedReflectionCullStats cull_stats_;
 };
 #endif // !RAY_TRACER_H
\ No newline at end of file
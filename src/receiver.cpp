@@ -75,6 +75,13 @@ void Receiver::UpdateResult()
 	ray_tracer_->Trace(tx_pos, rx_pos, records_);
 	ray_tracer_->CalculatePathLoss( transmitter_, this, records_, result_);
 }
+
+void Receiver::UpdateResult(const std::vector<Record>& records)
+{
+	if (transmitter_ == nullptr) return;
+	records_ = records;
+	ray_tracer_->CalculatePathLoss( transmitter_, this, records_, result_);
+}
 void Receiver::UpdateVisualRayComponents()
 {
     Clear();
@@ -41,6 +41,7 @@ public:
 
 	// Visualization
 	void UpdateResult();
+	void UpdateResult(const std::vector<Record>& records); // records already traced from the transmitter
 	void Reset();
 	// Visualisation
 	std::vector<Object*> rays_;
@@ -9,12 +9,12 @@
 #include <unordered_map>
 #include <map>
 
-class Triangle;
 
 enum class RecordType : int {
 	kDirect = 0,
 	kReflect,
-	kEdgeDiffraction
+	kEdgeDiffraction,
+	kMultipleReflect // one path of two or more bounces, data holds the bounce points in order
 };
 
 struct DirectResult{
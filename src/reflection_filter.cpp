@@ -0,0 +1,135 @@
+#include "reflection_filter.hpp"
+
+#include "image_source_table.hpp"
+
+namespace {
+    constexpr unsigned int k_block = 64; // triangles tested per block
+
+    enum CullCode : unsigned char {
+        kPassed = 0,
+        kSide,
+        kProjection,
+        kLength
+    };
+}
+
+void ReflectionCullStats::Add(const ReflectionCullStats& other)
+{
+    candidates += other.candidates;
+    culled_by_side += other.culled_by_side;
+    culled_by_projection += other.culled_by_projection;
+    culled_by_length += other.culled_by_length;
+    passed += other.passed;
+}
+
+void SharedReflectionCullStats::Add(const ReflectionCullStats& stats)
+{
+    candidates.fetch_add(stats.candidates, std::memory_order_relaxed);
+    culled_by_side.fetch_add(stats.culled_by_side, std::memory_order_relaxed);
+    culled_by_projection.fetch_add(stats.culled_by_projection, std::memory_order_relaxed);
+    culled_by_length.fetch_add(stats.culled_by_length, std::memory_order_relaxed);
+    passed.fetch_add(stats.passed, std::memory_order_relaxed);
+}
+
+ReflectionCullStats SharedReflectionCullStats::Load() const
+{
+    ReflectionCullStats stats;
+    stats.candidates = candidates.load(std::memory_order_relaxed);
+    stats.culled_by_side = culled_by_side.load(std::memory_order_relaxed);
+    stats.culled_by_projection = culled_by_projection.load(std::memory_order_relaxed);
+    stats.culled_by_length = culled_by_length.load(std::memory_order_relaxed);
+    stats.passed = passed.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void SharedReflectionCullStats::Reset()
+{
+    candidates.store(0, std::memory_order_relaxed);
+    culled_by_side.store(0, std::memory_order_relaxed);
+    culled_by_projection.store(0, std::memory_order_relaxed);
+    culled_by_length.store(0, std::memory_order_relaxed);
+    passed.store(0, std::memory_order_relaxed);
+}
+
+void ReflectionFilter::Filter(const TriangleBuffer& triangles, const ImageSourceTable& start_images,
+                              const glm::vec3& end_position, const float max_path_length,
+                              std::vector<TriangleIndex>& candidates, ReflectionCullStats& stats)
+{
+    const TriangleIndex count = triangles.Size();
+    const glm::vec3 start_position = start_images.GetSource();
+    const float max_squared_length = max_path_length * max_path_length;
+
+    const float* v0_x = triangles.v0_x_.data();
+    const float* v0_y = triangles.v0_y_.data();
+    const float* v0_z = triangles.v0_z_.data();
+    const float* edge1_x = triangles.edge1_x_.data();
+    const float* edge1_y = triangles.edge1_y_.data();
+    const float* edge1_z = triangles.edge1_z_.data();
+    const float* edge2_x = triangles.edge2_x_.data();
+    const float* edge2_y = triangles.edge2_y_.data();
+    const float* edge2_z = triangles.edge2_z_.data();
+    const float* normal_x = triangles.normal_x_.data();
+    const float* normal_y = triangles.normal_y_.data();
+    const float* normal_z = triangles.normal_z_.data();
+    const float* plane_offset = triangles.plane_offset_.data();
+    const float* image_x = start_images.GetImagesX();
+    const float* image_y = start_images.GetImagesY();
+    const float* image_z = start_images.GetImagesZ();
+
+    unsigned char codes[k_block];
+    for (TriangleIndex first = 0; first < count; first += k_block) {
+        const unsigned int lanes = count - first < k_block ? count - first : k_block;
+
+        for (unsigned int lane = 0; lane < lanes; ++lane) {
+            const TriangleIndex i = first + lane;
+            // 1. signed distances of both end points to the plane n . x = b
+            const float start_distance = normal_x[i] * start_position.x + normal_y[i] * start_position.y +
+                                         normal_z[i] * start_position.z - plane_offset[i];
+            const float end_distance = normal_x[i] * end_position.x + normal_y[i] * end_position.y +
+                                       normal_z[i] * end_position.z - plane_offset[i];
+            const bool is_same_side = start_distance * end_distance > 0.0f;
+
+            // 2. Moller-Trumbore from the image towards the end position, the direction is not
+            // normalized (u and v do not depend on its length).
+            const float direction_x = end_position.x - image_x[i];
+            const float direction_y = end_position.y - image_y[i];
+            const float direction_z = end_position.z - image_z[i];
+            const float h_x = direction_y * edge2_z[i] - direction_z * edge2_y[i];
+            const float h_y = direction_z * edge2_x[i] - direction_x * edge2_z[i];
+            const float h_z = direction_x * edge2_y[i] - direction_y * edge2_x[i];
+            const float a = edge1_x[i] * h_x + edge1_y[i] * h_y + edge1_z[i] * h_z;
+            const float f = 1.0f / a;
+            const float s_x = image_x[i] - v0_x[i];
+            const float s_y = image_y[i] - v0_y[i];
+            const float s_z = image_z[i] - v0_z[i];
+            const float u = f * (s_x * h_x + s_y * h_y + s_z * h_z);
+            const float q_x = s_y * edge1_z[i] - s_z * edge1_y[i];
+            const float q_y = s_z * edge1_x[i] - s_x * edge1_z[i];
+            const float q_z = s_x * edge1_y[i] - s_y * edge1_x[i];
+            const float v = f * (direction_x * q_x + direction_y * q_y + direction_z * q_z);
+            const float t = f * (edge2_x[i] * q_x + edge2_y[i] * q_y + edge2_z[i] * q_z);
+            // Written so NaN (a parallel or degenerate triangle) fails.
+            const bool is_inside = u >= -k_slack && u <= 1.0f + k_slack &&
+                                   v >= -k_slack && u + v <= 1.0f + k_slack && t > 0.0f;
+
+            // 3. the reflected path is as long as the line from the image to the end position
+            const float squared_length = direction_x * direction_x + direction_y * direction_y + direction_z * direction_z;
+            const bool is_short = squared_length <= max_squared_length;
+
+            codes[lane] = !is_same_side ? kSide : (!is_inside ? kProjection : (!is_short ? kLength : kPassed));
+        }
+
+        for (unsigned int lane = 0; lane < lanes; ++lane) {
+            switch (codes[lane]) {
+            case kPassed:
+                candidates.push_back(first + lane);
+                ++stats.passed;
+                break;
+            case kSide: ++stats.culled_by_side; break;
+            case kProjection: ++stats.culled_by_projection; break;
+            case kLength: ++stats.culled_by_length; break;
+            }
+        }
+    }
+    stats.candidates += count;
+}
@@ -0,0 +1,58 @@
+#ifndef REFLECTION_FILTER_H
+#define REFLECTION_FILTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "triangle_buffer.hpp"
+
+class ImageSourceTable;
+
+// How many reflection candidates each test of the filter removed (counted by the first test
+// that fails), and how many were left for tracing.
+struct ReflectionCullStats {
+	std::uint64_t candidates = 0;
+	std::uint64_t culled_by_side = 0; // start and end not on the same side of the plane
+	std::uint64_t culled_by_projection = 0; // specular point off the triangle
+	std::uint64_t culled_by_length = 0; // path longer than the maximum
+	std::uint64_t passed = 0;
+
+	void Add(const ReflectionCullStats& other);
+};
+
+// Totals of ReflectionCullStats that the tracing threads add to without a lock. Every counter
+// is added on its own, so a Load while tracing runs may see one filter call only in part.
+struct SharedReflectionCullStats {
+	std::atomic<std::uint64_t> candidates{ 0 };
+	std::atomic<std::uint64_t> culled_by_side{ 0 };
+	std::atomic<std::uint64_t> culled_by_projection{ 0 };
+	std::atomic<std::uint64_t> culled_by_length{ 0 };
+	std::atomic<std::uint64_t> passed{ 0 };
+
+	void Add(const ReflectionCullStats& stats);
+	ReflectionCullStats Load() const;
+	void Reset();
+};
+
+// Cheap geometric tests that decide, before any ray is cast, which triangles can carry a single
+// reflection from the source of an image table to an end position:
+//  1. both end points lie strictly on the same side of the triangle plane. The normals of the
+//     map are not oriented consistently, so the side itself is not checked;
+//  2. the line from the image to the end position crosses the triangle (Moller-Trumbore with a
+//     small slack, so nothing the exact test in RayTracer::IsReflected accepts is lost);
+//  3. the path length, |image - end|, is within the maximum.
+// The tests run branch-free over blocks of the SoA data, so the compiler can vectorize them.
+class ReflectionFilter {
+public:
+	static constexpr float k_slack = 1e-4f; // barycentric slack of test 2
+
+	// Appends the triangles that pass all tests to candidates, in index order.
+	static void Filter(const TriangleBuffer& triangles, const ImageSourceTable& start_images,
+	                   const glm::vec3& end_position, float max_path_length,
+	                   std::vector<TriangleIndex>& candidates, ReflectionCullStats& stats);
+};
+
+#endif // !REFLECTION_FILTER_H
@@ -0,0 +1,281 @@
+#include "sbr_tracer.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+#include "polygon_mesh.hpp"
+#include "facet_set.hpp"
+#include "image_tree.hpp"
+#include "thread_pool.hpp"
+#include "tracing_ray.hpp"
+
+namespace {
+    constexpr float k_surface_offset = 0.001f; // bounced rays start this far off the surface
+    constexpr float k_cell_size = 8.0f; // receiver hash cell, meters
+    constexpr std::size_t k_rays_per_batch = 256;
+    const float k_reception_factor = 1.0f / std::sqrt(3.0f); // reception sphere radius per unit spacing and length
+
+    // Edge midpoints shared by neighbouring faces so every vertex exists once.
+    std::uint32_t GetMidpoint(std::vector<glm::vec3>& vertices,
+                              std::map<std::pair<std::uint32_t, std::uint32_t>, std::uint32_t>& midpoints,
+                              std::uint32_t a, std::uint32_t b)
+    {
+        const auto key = std::make_pair(std::min(a, b), std::max(a, b));
+        const auto found = midpoints.find(key);
+        if (found != midpoints.end()) return found->second;
+        const std::uint32_t index = (std::uint32_t)vertices.size();
+        vertices.push_back(glm::normalize(vertices[a] + vertices[b]));
+        midpoints.emplace(key, index);
+        return index;
+    }
+}
+
+// Uniform grid of receivers, only cells that hold a receiver are stored.
+class SbrTracer::ReceiverHash {
+public:
+    explicit ReceiverHash(const std::vector<glm::vec3>& positions) :
+        positions_(positions), min_(FLT_MAX), max_(-FLT_MAX)
+    {
+        for (std::uint32_t i = 0; i < positions.size(); ++i) {
+            cells_[GetKey(GetCell(positions[i]))].push_back(i);
+            min_ = glm::min(min_, positions[i]);
+            max_ = glm::max(max_, positions[i]);
+        }
+    }
+
+    // Receivers inside the reception sphere of the segment from origin along direction (unit) for
+    // length, the ray having travelled start_distance before origin.
+    void Query(const glm::vec3& origin, const glm::vec3& direction, float length, float start_distance,
+               float spacing, std::vector<std::pair<std::uint32_t, float>>& found) const
+    {
+        if (positions_.empty()) return;
+        // Only the part of the segment near the receivers matters, a missed ray goes to infinity.
+        // No receiver lies further along the ray than the farthest corner of their bounds.
+        const glm::vec3 farthest = glm::max(glm::abs(min_ - origin), glm::abs(max_ - origin));
+        length = std::min(length, glm::length(farthest));
+        const float max_radius = spacing * k_reception_factor * (start_distance + length);
+        float t_start = 0.0f, t_end = length;
+        for (int axis = 0; axis < 3; ++axis) {
+            const float low = min_[axis] - max_radius, high = max_[axis] + max_radius;
+            if (direction[axis] == 0.0f) {
+                if (origin[axis] < low || origin[axis] > high) return;
+                continue;
+            }
+            float t0 = (low - origin[axis]) / direction[axis];
+            float t1 = (high - origin[axis]) / direction[axis];
+            if (t0 > t1) std::swap(t0, t1);
+            t_start = std::max(t_start, t0);
+            t_end = std::min(t_end, t1);
+            if (t_start > t_end) return;
+        }
+
+        // Walk the segment a cell at a time, checking the cells the reception sphere can reach.
+        // When that visits more cells than there are receivers, testing them all is cheaper.
+        const float search_radius = spacing * k_reception_factor * (start_distance + t_end) + 0.5f * k_cell_size;
+        const int reach = (int)std::ceil(search_radius / k_cell_size);
+        const float step_count = std::floor((t_end - t_start) / k_cell_size) + 1.0f;
+        const float width = (float)(2 * reach + 1);
+        std::vector<std::uint32_t> candidates;
+        if (step_count * width * width * width >= (float)positions_.size()) {
+            candidates.resize(positions_.size());
+            for (std::uint32_t i = 0; i < candidates.size(); ++i) candidates[i] = i;
+        } else {
+            for (float t = t_start;; t += k_cell_size) {
+                const glm::ivec3 center = GetCell(origin + direction * std::min(t, t_end));
+                for (int x = -reach; x <= reach; ++x)
+                    for (int y = -reach; y <= reach; ++y)
+                        for (int z = -reach; z <= reach; ++z) {
+                            const auto cell = cells_.find(GetKey(center + glm::ivec3(x, y, z)));
+                            if (cell == cells_.end()) continue;
+                            for (auto receiver : cell->second)
+                                if (std::find(candidates.begin(), candidates.end(), receiver) == candidates.end())
+                                    candidates.push_back(receiver);
+                        }
+                if (t >= t_end) break;
+            }
+        }
+
+        for (auto receiver : candidates) {
+            const glm::vec3 to_receiver = positions_[receiver] - origin;
+            const float along = std::clamp(glm::dot(to_receiver, direction), 0.0f, length);
+            const float miss_distance = glm::length(to_receiver - direction * along);
+            if (miss_distance <= spacing * k_reception_factor * (start_distance + along))
+                found.emplace_back(receiver, miss_distance);
+        }
+    }
+
+private:
+    static glm::ivec3 GetCell(const glm::vec3& position)
+    {
+        return glm::ivec3(glm::floor(position / k_cell_size));
+    }
+    static std::uint64_t GetKey(const glm::ivec3& cell)
+    {
+        // 21 bits per axis, enough for +-8000 km at this cell size.
+        const std::uint64_t mask = (1u << 21) - 1;
+        return ((std::uint64_t)(cell.x & mask) << 42) | ((std::uint64_t)(cell.y & mask) << 21) | (std::uint64_t)(cell.z & mask);
+    }
+
+    const std::vector<glm::vec3>& positions_;
+    std::unordered_map<std::uint64_t, std::vector<std::uint32_t>> cells_;
+    glm::vec3 min_, max_;
+};
+
+SbrTracer::SbrTracer(const PolygonMesh* map) : map_(map), ray_spacing_(0.0f)
+{
+    SetSubdivision(k_default_subdivision);
+}
+
+void SbrTracer::SetSubdivision(const unsigned int subdivision)
+{
+    // Icosahedron, every face split in four per subdivision and pushed back onto the sphere.
+    const float p = (1.0f + std::sqrt(5.0f)) / 2.0f;
+    std::vector<glm::vec3> vertices = {
+        { -1, p, 0 }, { 1, p, 0 }, { -1, -p, 0 }, { 1, -p, 0 },
+        { 0, -1, p }, { 0, 1, p }, { 0, -1, -p }, { 0, 1, -p },
+        { p, 0, -1 }, { p, 0, 1 }, { -p, 0, -1 }, { -p, 0, 1 } };
+    for (auto& vertex : vertices) vertex = glm::normalize(vertex);
+    std::vector<glm::uvec3> faces = {
+        { 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+        { 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+        { 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+        { 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 } };
+
+    for (unsigned int level = 0; level < subdivision; ++level) {
+        std::map<std::pair<std::uint32_t, std::uint32_t>, std::uint32_t> midpoints;
+        std::vector<glm::uvec3> next_faces;
+        next_faces.reserve(faces.size() * 4);
+        for (const auto& face : faces) {
+            const std::uint32_t a = GetMidpoint(vertices, midpoints, face.x, face.y);
+            const std::uint32_t b = GetMidpoint(vertices, midpoints, face.y, face.z);
+            const std::uint32_t c = GetMidpoint(vertices, midpoints, face.z, face.x);
+            next_faces.emplace_back(face.x, a, c);
+            next_faces.emplace_back(face.y, b, a);
+            next_faces.emplace_back(face.z, c, b);
+            next_faces.emplace_back(a, b, c);
+        }
+        faces.swap(next_faces);
+    }
+
+    // Every edge is shared by two faces, so the mean over all face edges is the mean edge angle.
+    double angle_sum = 0.0;
+    for (const auto& face : faces) {
+        for (int i = 0; i < 3; ++i) {
+            const float cosine = glm::dot(vertices[face[i]], vertices[face[(i + 1) % 3]]);
+            angle_sum += std::acos(std::clamp(cosine, -1.0f, 1.0f));
+        }
+    }
+    ray_spacing_ = (float)(angle_sum / (3.0 * faces.size()));
+    directions_.swap(vertices);
+}
+
+unsigned int SbrTracer::GetRayCount() const
+{
+    return (unsigned int)directions_.size();
+}
+
+void SbrTracer::Trace(const glm::vec3& tx_position, const std::vector<glm::vec3>& rx_positions,
+                      const unsigned int max_bounces, std::vector<std::vector<Record>>& records) const
+{
+    if (max_bounces == 0 || rx_positions.empty()) return;
+    const ReceiverHash receivers(rx_positions);
+
+    // Every batch of rays writes its own captures, joined in batch order so the result does not
+    // depend on the scheduling.
+    const std::size_t batch_count = (directions_.size() + k_rays_per_batch - 1) / k_rays_per_batch;
+    std::vector<std::vector<Capture>> batch_captures(batch_count);
+    ThreadPool::GetInstance().ParallelFor(0, batch_count, 1, [&](std::size_t batch) {
+        const std::size_t end = std::min(directions_.size(), (batch + 1) * k_rays_per_batch);
+        for (std::size_t i = batch * k_rays_per_batch; i < end; ++i)
+            TraceTube(tx_position, directions_[i], max_bounces, receivers, batch_captures[batch]);
+    });
+
+    // One path per receiver and facet sequence, from the tube passing closest to the receiver.
+    std::map<std::pair<std::uint32_t, std::vector<std::uint32_t>>, const Capture*> paths;
+    for (const auto& captures : batch_captures) {
+        for (const auto& capture : captures) {
+            auto& kept = paths[std::make_pair(capture.receiver, capture.facets)];
+            if (kept == nullptr || capture.miss_distance < kept->miss_distance) kept = &capture;
+        }
+    }
+
+    // The map keeps them ordered by receiver, then by facet sequence, single bounces first.
+    std::vector<std::vector<glm::vec3>> single_points(rx_positions.size());
+    std::vector<std::vector<std::vector<glm::vec3>>> multiple_paths(rx_positions.size());
+    std::vector<glm::vec3> points;
+    for (const auto& path : paths) {
+        const Capture& capture = *path.second;
+        const glm::vec3& rx_position = rx_positions[capture.receiver];
+        if (!map_->GetFacets().Empty()) {
+            if (!SolvePath(tx_position, rx_position, capture.facets, points)) continue;
+        } else {
+            points = capture.ray_points;
+        }
+
+        bool is_clear = IsClear(tx_position, points.front()) && IsClear(points.back(), rx_position);
+        for (std::size_t i = 1; i < points.size() && is_clear; ++i)
+            is_clear = IsClear(points[i - 1], points[i]);
+        if (!is_clear) continue;
+
+        if (points.size() == 1) single_points[capture.receiver].push_back(points.front());
+        else multiple_paths[capture.receiver].push_back(points);
+    }
+
+    for (std::size_t i = 0; i < rx_positions.size(); ++i) {
+        if (!single_points[i].empty()) records[i].emplace_back(RecordType::kReflect, single_points[i]);
+        for (auto& path : multiple_paths[i]) records[i].emplace_back(RecordType::kMultipleReflect, path);
+    }
+}
+
+void SbrTracer::TraceTube(const glm::vec3& tx_position, const glm::vec3& direction, const unsigned int max_bounces,
+                          const ReceiverHash& receivers, std::vector<Capture>& captures) const
+{
+    const TriangleBuffer& triangles = map_->GetTriangles();
+    const FacetSet& facets = map_->GetFacets();
+    glm::vec3 origin = tx_position;
+    glm::vec3 ray_direction = direction;
+    float travelled = 0.0f;
+    std::vector<std::uint32_t> hit_facets;
+    std::vector<glm::vec3> hit_points;
+    std::vector<std::pair<std::uint32_t, float>> found;
+
+    for (unsigned int bounce = 0;; ++bounce) {
+        float t = FLT_MAX;
+        TriangleIndex triangle = 0;
+        const bool is_hit = map_->IsHit(TracingRay{ origin, ray_direction }, t, triangle);
+
+        // The direct leg is left to the line of sight tracing.
+        if (bounce > 0) {
+            found.clear();
+            receivers.Query(origin, ray_direction, is_hit ? t : FLT_MAX, travelled, ray_spacing_, found);
+            for (const auto& receiver : found)
+                captures.push_back(Capture{ receiver.first, hit_facets, receiver.second, hit_points });
+        }
+        if (!is_hit || bounce == max_bounces) break;
+
+        const glm::vec3 hit_point = origin + ray_direction * t;
+        glm::vec3 normal = triangles.GetNormal(triangle);
+        if (glm::dot(ray_direction, normal) > 0.0f) normal = -normal;
+        ray_direction = glm::normalize(ray_direction - 2.0f * glm::dot(ray_direction, normal) * normal);
+        origin = hit_point + normal * k_surface_offset;
+        travelled += t;
+        hit_facets.push_back(facets.Empty() ? triangle : facets.GetFacet(triangle));
+        hit_points.push_back(hit_point);
+    }
+}
+
+bool SbrTracer::SolvePath(const glm::vec3& tx_position, const glm::vec3& rx_position,
+                          const std::vector<std::uint32_t>& facets, std::vector<glm::vec3>& points) const
+{
+    return ImageTree::SolvePath(map_->GetTriangles(), map_->GetFacets(), tx_position, facets, rx_position, points);
+}
+
+bool SbrTracer::IsClear(const glm::vec3& start_position, const glm::vec3& end_position) const
+{
+    const glm::vec3 direction = glm::normalize(end_position - start_position);
+    return !map_->IsAnyHit(TracingRay{ start_position, direction, glm::distance(start_position, end_position) });
+}
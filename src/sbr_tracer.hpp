@@ -0,0 +1,61 @@
+#ifndef SBR_TRACER_H
+#define SBR_TRACER_H
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "record.hpp"
+
+class PolygonMesh;
+
+// Shooting and bouncing rays: one launch of ray tubes from the transmitter over a geodesic
+// sphere resolves the reflections to all receivers at once. Every tube is bounced through the
+// map up to the maximum number of bounces; a receiver catches a tube when it lies inside the
+// reception sphere around the ray, whose radius grows with the unfolded path length. Receivers
+// are looked up in a spatial hash.
+//
+// Tubes that catch the same receiver over the same sequence of facets describe the same path,
+// so only one is kept. Its bounce points are then solved exactly with the image method over
+// that facet sequence and every leg is checked for occlusion, so the records match what the
+// image method would report for the same path.
+class SbrTracer {
+public:
+	static constexpr unsigned int k_default_subdivision = 6; // 40962 rays, about 1.1 degrees apart
+	static constexpr unsigned int k_default_max_bounces = 2;
+
+	explicit SbrTracer(const PolygonMesh* map);
+
+	// Rays of the geodesic sphere: 10 * 4^subdivision + 2.
+	void SetSubdivision(unsigned int subdivision);
+	unsigned int GetRayCount() const;
+
+	// Appends the reflections to each receiver to records[i]: one kReflect record with all single
+	// bounce points and one kMultipleReflect record per path of two or more bounces.
+	// records must have one entry per receiver.
+	void Trace(const glm::vec3& tx_position, const std::vector<glm::vec3>& rx_positions,
+	           unsigned int max_bounces, std::vector<std::vector<Record>>& records) const;
+
+private:
+	struct Capture {
+		std::uint32_t receiver;
+		std::vector<std::uint32_t> facets; // one per bounce, in order
+		float miss_distance; // receiver to ray, the tube closest to the receiver is kept
+		std::vector<glm::vec3> ray_points; // where the tube hit, used when there are no facets
+	};
+
+	class ReceiverHash;
+
+	void TraceTube(const glm::vec3& tx_position, const glm::vec3& direction, unsigned int max_bounces,
+	               const ReceiverHash& receivers, std::vector<Capture>& captures) const;
+	bool SolvePath(const glm::vec3& tx_position, const glm::vec3& rx_position,
+	               const std::vector<std::uint32_t>& facets, std::vector<glm::vec3>& points) const;
+	bool IsClear(const glm::vec3& start_position, const glm::vec3& end_position) const;
+
+	const PolygonMesh* map_;
+	std::vector<glm::vec3> directions_;
+	float ray_spacing_; // mean angle between neighbouring rays, radians
+};
+
+#endif // !SBR_TRACER_H
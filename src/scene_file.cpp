@@ -0,0 +1,160 @@
+#include "scene_file.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "mapped_file.hpp"
+
+namespace {
+    constexpr char k_magic[8] = { 'W', 'C', 'S', 'S', 'C', 'E', 'N', 'E' };
+    constexpr std::uint32_t k_byte_order = 0x01020304; // reads back swapped on the other endianness
+
+    struct SceneHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::uint64_t file_size;
+        std::uint64_t directory_offset;
+        std::uint32_t array_count;
+        std::uint32_t alignment;
+        std::uint64_t source_size;
+        std::int64_t source_time;
+    };
+
+    std::size_t AlignUp(std::size_t position)
+    {
+        return (position + SceneWriter::k_alignment - 1) / SceneWriter::k_alignment * SceneWriter::k_alignment;
+    }
+}
+
+SceneWriter::SceneWriter() : position_(0), source_size_(0), source_time_(0)
+{
+}
+
+bool SceneWriter::Open(const std::string& path, const std::uint64_t source_size, const std::int64_t source_time)
+{
+    path_ = path;
+    source_size_ = source_size;
+    source_time_ = source_time;
+    temporary_path_ = path + ".tmp";
+    stream_.open(temporary_path_, std::ios::binary | std::ios::trunc);
+    if (!stream_.is_open()) return false;
+    // Room for the header, filled in on Close.
+    const char zeros[sizeof(SceneHeader)] = {};
+    stream_.write(zeros, sizeof(zeros));
+    position_ = sizeof(SceneHeader);
+    entries_.clear();
+    return (bool)stream_;
+}
+
+bool SceneWriter::Close()
+{
+    if (!stream_.is_open()) return false;
+    Pad();
+    const std::uint64_t directory_offset = position_;
+    for (std::size_t i = 0; i < entries_.size(); ++i)
+        if (entries_[i].is_inline)
+            entries_[i].offset = directory_offset + i * sizeof(Entry) + offsetof(Entry, values);
+    if (!entries_.empty())
+        stream_.write(reinterpret_cast<const char*>(entries_.data()), entries_.size() * sizeof(Entry));
+    position_ += entries_.size() * sizeof(Entry);
+
+    SceneHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, k_magic, sizeof(k_magic));
+    header.version = k_version;
+    header.byte_order = k_byte_order;
+    header.file_size = position_;
+    header.directory_offset = directory_offset;
+    header.array_count = (std::uint32_t)entries_.size();
+    header.alignment = (std::uint32_t)k_alignment;
+    header.source_size = source_size_;
+    header.source_time = source_time_;
+    stream_.seekp(0);
+    stream_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    const bool is_written = (bool)stream_;
+    stream_.close();
+    entries_.clear();
+
+    std::error_code error;
+    if (is_written) std::filesystem::rename(temporary_path_, path_, error);
+    if (!is_written || error) {
+        std::remove(temporary_path_.c_str());
+        return false;
+    }
+    return true;
+}
+
+void SceneWriter::WriteBytes(const void* data, std::uint32_t element_size, std::uint64_t count)
+{
+    Entry entry;
+    std::memset(&entry, 0, sizeof(entry));
+    entry.count = count;
+    entry.element_size = element_size;
+    const std::uint64_t size = count * element_size;
+    if (size <= sizeof(entry.values)) {
+        entry.is_inline = 1;
+        if (size > 0) std::memcpy(entry.values, data, size);
+    } else {
+        Pad();
+        entry.offset = position_;
+        stream_.write(static_cast<const char*>(data), size);
+        position_ += size;
+    }
+    entries_.push_back(entry);
+}
+
+void SceneWriter::Pad()
+{
+    static const char zeros[k_alignment] = {};
+    const std::size_t aligned = AlignUp(position_);
+    stream_.write(zeros, aligned - position_);
+    position_ = aligned;
+}
+
+SceneReader::SceneReader(const MappedFile& file) : data_(file.GetData()), size_(file.GetSize()), source_size_(0),
+                                                    source_time_(0), entries_(nullptr),
+                                                    entry_count_(0), next_entry_(0), is_good_(false)
+{
+    if (data_ == nullptr || size_ < sizeof(SceneHeader)) return;
+    SceneHeader header;
+    std::memcpy(&header, data_, sizeof(header));
+    is_good_ = std::memcmp(header.magic, k_magic, sizeof(k_magic)) == 0 && header.version == SceneWriter::k_version &&
+               header.byte_order == k_byte_order && header.file_size == size_ && header.alignment == SceneWriter::k_alignment &&
+               header.directory_offset % SceneWriter::k_alignment == 0 && header.directory_offset <= size_ &&
+               (size_ - header.directory_offset) == (std::uint64_t)header.array_count * sizeof(SceneWriter::Entry);
+    if (!is_good_) return;
+    source_size_ = header.source_size;
+    source_time_ = header.source_time;
+    entries_ = reinterpret_cast<const SceneWriter::Entry*>(data_ + header.directory_offset);
+    entry_count_ = header.array_count;
+}
+
+bool SceneReader::IsGood() const
+{
+    return is_good_;
+}
+
+bool SceneReader::IsAtEnd() const
+{
+    return is_good_ && next_entry_ == entry_count_;
+}
+
+bool SceneReader::IsSource(const std::uint64_t source_size, const std::int64_t source_time) const
+{
+    return is_good_ && source_size_ == source_size && source_time_ == source_time;
+}
+
+bool SceneReader::ReadBytes(std::uint32_t element_size, const void*& data, std::size_t& count)
+{
+    if (!is_good_) return false;
+    if (next_entry_ == entry_count_) return is_good_ = false;
+    const SceneWriter::Entry& entry = entries_[next_entry_++];
+    if (entry.element_size != element_size || entry.offset % alignof(std::uint64_t) != 0 || entry.offset > size_ ||
+        entry.count > (size_ - entry.offset) / element_size)
+        return is_good_ = false;
+    data = data_ + entry.offset;
+    count = (std::size_t)entry.count;
+    return true;
+}
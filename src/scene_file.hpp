@@ -0,0 +1,135 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "mappable_vector.hpp"
+
+class MappedFile;
+
+// Compiled scene: a header, the arrays one after the other, each aligned to k_alignment, then a
+// directory with the offset, element size and count of every array. Arrays of a few bytes are
+// kept in their directory entry, so opening a scene touches the first and last pages and none
+// of the data until it is used. Nothing holds an address: the file is used in place wherever it
+// is mapped, and the reader borrows the arrays.
+//
+// The order of the arrays is the format. Change k_version with any change to it, or to the
+// layout of an element, and old files are refused instead of misread.
+class SceneWriter {
+public:
+	static constexpr std::uint32_t k_version = 3;
+	static constexpr std::size_t k_alignment = 64;
+	static constexpr const char* k_extension = ".wcscene";
+
+	SceneWriter();
+
+	// Written aside and renamed on Close, so a reader never maps half a scene. The size and
+	// modification time of the file the scene was compiled from go into the header.
+	bool Open(const std::string& path, std::uint64_t source_size, std::int64_t source_time);
+	bool Close();
+
+	template<typename T>
+	void Write(const T* data, std::size_t count);
+	template<typename T, typename Allocator>
+	void Write(const MappableVector<T, Allocator>& array) { Write(array.data(), array.size()); }
+	template<typename T, typename Allocator>
+	void Write(const std::vector<T, Allocator>& array) { Write(array.data(), array.size()); }
+	template<typename T>
+	void WriteValue(const T& value) { Write(&value, 1); }
+
+private:
+	struct Entry {
+		std::uint64_t offset; // from the start of the file, or of its values when inline
+		std::uint64_t count;
+		std::uint32_t element_size;
+		std::uint32_t is_inline;
+		alignas(8) char values[24];
+	};
+
+	void WriteBytes(const void* data, std::uint32_t element_size, std::uint64_t count);
+	void Pad();
+
+	std::ofstream stream_;
+	std::string path_;
+	std::string temporary_path_;
+	std::uint64_t position_;
+	std::uint64_t source_size_;
+	std::int64_t source_time_;
+	std::vector<Entry> entries_;
+
+	friend class SceneReader;
+};
+
+class SceneReader {
+public:
+	// Checks the header of an open mapping; reading fails from then on if it does not match.
+	explicit SceneReader(const MappedFile& file);
+
+	bool IsGood() const;
+	bool IsAtEnd() const;
+	// False when the source file changed since the scene was compiled.
+	bool IsSource(std::uint64_t source_size, std::int64_t source_time) const;
+
+	template<typename T>
+	bool Read(const T*& data, std::size_t& count);
+	template<typename T, typename Allocator>
+	bool Read(MappableVector<T, Allocator>& array);
+	template<typename T>
+	bool ReadValue(T& value);
+
+private:
+	bool ReadBytes(std::uint32_t element_size, const void*& data, std::size_t& count);
+
+	const char* data_;
+	std::size_t size_;
+	std::uint64_t source_size_;
+	std::int64_t source_time_;
+	const SceneWriter::Entry* entries_;
+	std::size_t entry_count_;
+	std::size_t next_entry_;
+	bool is_good_;
+};
+
+template<typename T>
+void SceneWriter::Write(const T* data, std::size_t count)
+{
+	static_assert(std::is_trivially_copyable<T>::value, "scene arrays are copied byte for byte");
+	WriteBytes(data, sizeof(T), count);
+}
+
+template<typename T>
+bool SceneReader::Read(const T*& data, std::size_t& count)
+{
+	static_assert(std::is_trivially_copyable<T>::value, "scene arrays are copied byte for byte");
+	const void* bytes;
+	if (!ReadBytes(sizeof(T), bytes, count)) return false;
+	data = static_cast<const T*>(bytes);
+	return true;
+}
+
+template<typename T, typename Allocator>
+bool SceneReader::Read(MappableVector<T, Allocator>& array)
+{
+	const T* data;
+	std::size_t count;
+	if (!Read(data, count)) return false;
+	array.Borrow(data, count);
+	return true;
+}
+
+template<typename T>
+bool SceneReader::ReadValue(T& value)
+{
+	const T* data;
+	std::size_t count;
+	if (!Read(data, count) || count != 1) return is_good_ = false;
+	value = *data;
+	return true;
+}
+
+#endif // !SCENE_FILE_H
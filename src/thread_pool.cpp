@@ -0,0 +1,184 @@
+#include "thread_pool.hpp"
+
+namespace {
+    // Set on the worker threads so tasks they fork go to their own deque.
+    thread_local const ThreadPool* t_pool = nullptr;
+    thread_local unsigned int t_worker_index = 0;
+}
+
+ThreadPool::ThreadPool(unsigned int thread_count) : thread_count_(1),
+                                                    queued_count_(0),
+                                                    next_queue_(0),
+                                                    is_stopping_(false)
+{
+    Start(thread_count);
+}
+
+ThreadPool::~ThreadPool()
+{
+    Stop();
+}
+
+ThreadPool& ThreadPool::GetInstance()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::SetThreadCount(unsigned int thread_count)
+{
+    Stop();
+    Start(thread_count);
+}
+
+unsigned int ThreadPool::GetThreadCount() const
+{
+    return thread_count_;
+}
+
+bool ThreadPool::IsSingleThreaded() const
+{
+    return workers_.empty();
+}
+
+void ThreadPool::Start(unsigned int thread_count)
+{
+    if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+    if (thread_count == 0) thread_count = 1;
+    thread_count_ = thread_count;
+
+    // The thread that waits on a group works too, so one worker less than the thread count.
+    const unsigned int worker_count = thread_count_ - 1;
+    for (unsigned int i = 0; i < worker_count; ++i)
+        queues_.push_back(std::make_unique<Queue>());
+    for (unsigned int i = 0; i < worker_count; ++i)
+        workers_.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+void ThreadPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        is_stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_)
+        if (worker.joinable()) worker.join();
+    workers_.clear();
+    queues_.clear();
+    queued_count_ = 0;
+    is_stopping_ = false;
+}
+
+void ThreadPool::Push(Task task)
+{
+    const unsigned int queue_index = t_pool == this ? t_worker_index
+                                                    : next_queue_.fetch_add(1) % (unsigned int)queues_.size();
+    {
+        std::lock_guard<std::mutex> lock(queues_[queue_index]->mutex);
+        queues_[queue_index]->tasks.push_back(std::move(task));
+    }
+    queued_count_.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+    }
+    wake_.notify_one();
+}
+
+bool ThreadPool::TryPop(Task& task)
+{
+    const unsigned int queue_count = (unsigned int)queues_.size();
+    if (queue_count == 0 || queued_count_.load() == 0) return false;
+
+    // Newest task of the own deque first, it is the one most likely still in cache.
+    const bool is_worker = t_pool == this;
+    if (is_worker) {
+        Queue& queue = *queues_[t_worker_index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            queued_count_.fetch_sub(1);
+            return true;
+        }
+    }
+    // Steal the oldest task of another deque, those are the biggest pieces of work.
+    const unsigned int start = is_worker ? t_worker_index + 1 : next_queue_.load();
+    for (unsigned int i = 0; i < queue_count; ++i) {
+        Queue& queue = *queues_[(start + i) % queue_count];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            queued_count_.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::TryRunOne()
+{
+    Task task;
+    if (!TryPop(task)) return false;
+    TaskGroup* group = task.group;
+    group->Execute(task.function);
+    // The waiting thread may destroy the group as soon as this reaches zero.
+    group->pending_.fetch_sub(1);
+    return true;
+}
+
+void ThreadPool::WorkerLoop(unsigned int index)
+{
+    t_pool = this;
+    t_worker_index = index;
+    while (true) {
+        if (TryRunOne()) continue;
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        wake_.wait(lock, [this]() { return is_stopping_.load() || queued_count_.load() != 0; });
+        if (is_stopping_) break;
+    }
+    t_pool = nullptr;
+}
+
+TaskGroup::TaskGroup(ThreadPool& pool) : pool_(pool), pending_(0)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    while (pending_.load() != 0)
+        if (!pool_.TryRunOne()) std::this_thread::yield();
+}
+
+void TaskGroup::Run(std::function<void()> function)
+{
+    if (pool_.IsSingleThreaded()) {
+        Execute(function);
+        return;
+    }
+    pending_.fetch_add(1);
+    pool_.Push(ThreadPool::Task{ std::move(function), this });
+}
+
+void TaskGroup::Wait()
+{
+    while (pending_.load() != 0)
+        if (!pool_.TryRunOne()) std::this_thread::yield();
+    std::exception_ptr exception;
+    {
+        std::lock_guard<std::mutex> lock(exception_mutex_);
+        std::swap(exception, exception_);
+    }
+    if (exception) std::rethrow_exception(exception);
+}
+
+void TaskGroup::Execute(const std::function<void()>& function)
+{
+    try {
+        function();
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(exception_mutex_);
+        if (!exception_) exception_ = std::current_exception();
+    }
+}
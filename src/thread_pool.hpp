@@ -0,0 +1,128 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskGroup;
+
+// Process-wide pool of worker threads. Every worker owns a task deque: it pushes and pops its own
+// tasks at the back and steals from the front of the others when it runs dry. A thread waiting on
+// a TaskGroup runs queued tasks in the meantime, so nested fork/join never blocks the pool.
+//
+// With a thread count of 1 there are no workers and every task runs inline on the caller, in
+// submission order, which keeps results reproducible while debugging.
+class ThreadPool {
+public:
+	explicit ThreadPool(unsigned int thread_count = 0); // 0 = std::thread::hardware_concurrency()
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	static ThreadPool& GetInstance();
+
+	// Only call while the pool is idle.
+	void SetThreadCount(unsigned int thread_count);
+	unsigned int GetThreadCount() const;
+	bool IsSingleThreaded() const;
+
+	// Calls body(i) for every i in [begin, end), in chunks of grain indices.
+	template<typename Body>
+	void ParallelFor(std::size_t begin, std::size_t end, std::size_t grain, Body&& body);
+	// Runs both functions, possibly at the same time, and returns when both are done.
+	template<typename First, typename Second>
+	void Invoke(First&& first, Second&& second);
+
+private:
+	friend class TaskGroup;
+
+	struct Task {
+		std::function<void()> function;
+		TaskGroup* group;
+	};
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	void Start(unsigned int thread_count);
+	void Stop();
+	void Push(Task task);
+	bool TryRunOne();
+	bool TryPop(Task& task);
+	void WorkerLoop(unsigned int index);
+
+	unsigned int thread_count_;
+	std::vector<std::unique_ptr<Queue>> queues_;
+	std::vector<std::thread> workers_;
+	std::atomic<unsigned int> queued_count_;
+	std::atomic<unsigned int> next_queue_;
+	std::atomic<bool> is_stopping_;
+	std::mutex sleep_mutex_;
+	std::condition_variable wake_;
+};
+
+// Fork/join scope: Run() forks a task on the pool, Wait() joins all of them. Wait rethrows the
+// first exception a task threw. The destructor waits as well.
+class TaskGroup {
+public:
+	explicit TaskGroup(ThreadPool& pool = ThreadPool::GetInstance());
+	~TaskGroup();
+	TaskGroup(const TaskGroup&) = delete;
+	TaskGroup& operator=(const TaskGroup&) = delete;
+
+	void Run(std::function<void()> function);
+	void Wait();
+
+private:
+	friend class ThreadPool;
+	void Execute(const std::function<void()>& function);
+
+	ThreadPool& pool_;
+	std::atomic<unsigned int> pending_;
+	std::mutex exception_mutex_;
+	std::exception_ptr exception_;
+};
+
+template<typename Body>
+void ThreadPool::ParallelFor(std::size_t begin, std::size_t end, std::size_t grain, Body&& body)
+{
+	if (begin >= end) return;
+	if (grain == 0) grain = 1;
+	if (IsSingleThreaded() || end - begin <= grain) {
+		for (std::size_t i = begin; i < end; ++i) body(i);
+		return;
+	}
+	TaskGroup group(*this);
+	for (std::size_t chunk_begin = begin; chunk_begin < end; chunk_begin += grain) {
+		const std::size_t chunk_end = end - chunk_begin > grain ? chunk_begin + grain : end;
+		group.Run([&body, chunk_begin, chunk_end]() {
+			for (std::size_t i = chunk_begin; i < chunk_end; ++i) body(i);
+		});
+	}
+	group.Wait();
+}
+
+template<typename First, typename Second>
+void ThreadPool::Invoke(First&& first, Second&& second)
+{
+	if (IsSingleThreaded()) {
+		first();
+		second();
+		return;
+	}
+	TaskGroup group(*this);
+	group.Run([&second]() { second(); });
+	first();
+	group.Wait();
+}
+
+#endif // !THREAD_POOL_H
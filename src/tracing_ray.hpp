@@ -0,0 +1,35 @@
+#ifndef TRACING_RAY_H
+#define TRACING_RAY_H
+
+#include <cfloat>
+#include <type_traits>
+
+#include <glm/glm.hpp>
+
+// Plain ray used by the tracer and the acceleration structures. Hits count only for
+// t_min < t < t_max. The renderable Ray object is for visualisation only.
+struct TracingRay {
+	glm::vec3 origin;
+	float t_min;
+	glm::vec3 direction;
+	float t_max;
+	glm::vec3 inverse_direction;
+	unsigned int sign; // bit i is set when the ray goes towards -axis i
+
+	TracingRay() = default;
+	TracingRay(const glm::vec3& ray_origin, const glm::vec3& ray_direction, float max_t = FLT_MAX, float min_t = 0.0f) :
+		origin(ray_origin), t_min(min_t), direction(ray_direction), t_max(max_t),
+		inverse_direction(1.0f / ray_direction)
+	{
+		// Taken from the reciprocal so -0 counts as negative, like the infinity it produces.
+		sign = (inverse_direction.x < 0.0f ? 1u : 0u) |
+		       (inverse_direction.y < 0.0f ? 2u : 0u) |
+		       (inverse_direction.z < 0.0f ? 4u : 0u);
+	}
+
+	glm::vec3 PointAtLength(float length) const { return origin + direction * length; }
+};
+
+static_assert(std::is_trivially_copyable<TracingRay>::value, "TracingRay must stay a plain value type");
+
+#endif // !TRACING_RAY_H
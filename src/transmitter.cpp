@@ -2,7 +2,6 @@
 
 #include <iostream>
 
-#include "triangle.hpp"
 #include "object.hpp"
 #include "ray.hpp"
 #include "line.hpp"
@@ -16,11 +15,38 @@
 
 
 #include <math.h>
+#include <cmath>
 
 #include <glm/gtx/vector_angle.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/string_cast.hpp>
 
+namespace {
+	constexpr float k_pi = 3.14159265358979f;
+	constexpr std::size_t k_gain_batch = 64;
+
+	// atan2 with a minimax polynomial on [0, 1], within 2e-5 rad; 0 for the zero vector.
+	float FastAtan2(float y, float x)
+	{
+		const float abs_x = std::fabs(x), abs_y = std::fabs(y);
+		const float max_xy = abs_x > abs_y ? abs_x : abs_y;
+		if (max_xy == 0.0f) return 0.0f;
+		const float a = (abs_x < abs_y ? abs_x : abs_y) / max_xy;
+		const float s = a * a;
+		float angle = a * (0.9998660f + s * (-0.3302995f + s * (0.1801410f + s * (-0.0851330f + s * 0.0208351f))));
+		if (abs_y > abs_x) angle = 0.5f * k_pi - angle;
+		if (x < 0.0f) angle = k_pi - angle;
+		return y < 0.0f ? -angle : angle;
+	}
+
+	// acos, clamped like glm::angle.
+	float FastAcos(float cosine)
+	{
+		cosine = cosine < -1.0f ? -1.0f : (cosine > 1.0f ? 1.0f : cosine);
+		return FastAtan2(std::sqrt(1.0f - cosine * cosine), cosine);
+	}
+}
+
 unsigned int Transmitter::global_id_ = 0;
 
 Transmitter::Transmitter(Transform transform,
@@ -54,16 +80,29 @@ void Transmitter::UpdateResult()
 {
 
 	if (receivers_.empty()) return;
+	// Trace to all receivers in one pass that shares the image sources of this transmitter.
+	std::vector<Receiver*> receivers;
+	std::vector<glm::vec3> rx_positions;
 	for (auto itr = receivers_.begin(); itr != receivers_.end(); ++itr) {
-		itr->second->UpdateResult();
+		if (itr->second->GetTransmitter() != this) {
+			itr->second->UpdateResult();
+			continue;
+		}
+		receivers.push_back(itr->second);
+		rx_positions.push_back(itr->second->GetPosition());
+	}
+	std::vector<std::vector<Record>> records;
+	ray_tracer_->Trace(GetImageSources(), rx_positions, records);
+	for (std::size_t i = 0; i < receivers.size(); ++i) {
+		receivers[i]->UpdateResult(records[i]);
 	}
 }
 
 void Transmitter::UpdateResultWithVisual()
 {
 	if (receivers_.empty()) return;
+	UpdateResult();
 	for (auto itr = receivers_.begin(); itr != receivers_.end(); ++itr) {
-		itr->second->UpdateResult();
 		itr->second->VisualUpdate();
 	}
 }
@@ -73,6 +112,7 @@ void Transmitter::Reset()
 	rotation_speed_ = .5f;
 	move_speed_ = 10.0f;
 	transform_.rotation = glm::vec3(0.0f, 0.0f, 0.0f);
+	UpdateFrame();
 }
 
 void Transmitter::DrawObject(Camera* camera)
@@ -101,11 +141,13 @@ void Transmitter::AssignRadiationPattern(RadiationPattern* pattern)
 void Transmitter::MoveTo(glm::vec3 position)
 {
 	transform_.position = position;
+	image_sources_.Clear();
 }
 
 void Transmitter::RotateTo(glm::vec3 rotation)
 {
 	transform_.rotation = rotation;
+	UpdateFrame();
 	//std::cout << "rotated!\n";
 }
 
@@ -119,46 +161,51 @@ float Transmitter::GetFrequency() const
 	return frequency_;
 }
 
-float Transmitter::GetTransmitterGain(glm::vec3 near_tx_position)
+float Transmitter::GetTransmitterGain(glm::vec3 near_tx_position) const
 {
 	if (current_pattern_== nullptr) return 0.0f;
+	float theta, phi;
+	GetPatternAngles(near_tx_position, theta, phi);
+	return current_pattern_->GetGain(theta, phi);
+}
 
-	glm::vec3 tx_position = transform_.position;
-	float tx_theta = transform_.rotation.x;
-	float tx_phi = transform_.rotation.y;
-
-	glm::mat4 trans = glm::rotate(glm::mat4(1.0f), -tx_theta, glm::vec3(0.0f, 1.0f, 0.0f));
-	trans = glm::rotate(trans, -tx_phi, glm::vec3(0.0f, 0.0f, 1.0f));
-	glm::vec3 front_direction = glm::vec3(trans * glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
-	glm::vec3 up_direction = glm::vec3(trans * glm::vec4(0.0f, 1.0f, 0.0f, 1.0f));
-
-	glm::vec2 tx_on_xz = glm::vec2(tx_position.x, tx_position.z);
-	glm::vec2 near_tx_on_xz = glm::vec2(near_tx_position.x, near_tx_position.z);
-	glm::vec2 to_near_tx_on_xz_direction = glm::normalize(near_tx_on_xz - tx_on_xz);
-	glm::vec2 front_on_xz_direction = glm::vec2(front_direction.x, front_direction.z);
-	float angle_on_front = glm::angle(front_on_xz_direction, to_near_tx_on_xz_direction);
-	
-	glm::vec2 tx_on_xy = glm::vec2(tx_position.x, tx_position.y);
-	glm::vec2 near_tx_on_xy = glm::vec2(near_tx_position.x, near_tx_position.y);
-	glm::vec2 to_near_tx_on_xy_direction = glm::normalize(near_tx_on_xy - tx_on_xy);
-	glm::vec2 up_on_xy_direction = glm::vec2(up_direction.x, up_direction.y);
-	float phi = glm::angle(up_on_xy_direction, to_near_tx_on_xy_direction);
-
-	glm::vec3 left_direction = glm::cross(front_direction, up_direction);
-	glm::vec3 tx_to_near_direction = glm::normalize(near_tx_position - tx_position);
-	float angle_to_left = glm::degrees(glm::angle(left_direction, tx_to_near_direction));
-	float theta;
-	if (angle_to_left <= 90.0f) {
-		theta = glm::radians(360.0f - glm::degrees(angle_on_front));
+void Transmitter::GetTransmitterGains(const glm::vec3* near_tx_positions, std::size_t n, float* gains) const
+{
+	if (current_pattern_ == nullptr) {
+		for (std::size_t i = 0; i < n; ++i) gains[i] = 0.0f;
+		return;
 	}
-	else {
-		theta = angle_on_front;
+	alignas(32) float theta[k_gain_batch];
+	alignas(32) float phi[k_gain_batch];
+	for (std::size_t first = 0; first < n; first += k_gain_batch) {
+		const std::size_t count = n - first < k_gain_batch ? n - first : k_gain_batch;
+		for (std::size_t i = 0; i < count; ++i) GetPatternAngles(near_tx_positions[first + i], theta[i], phi[i]);
+		current_pattern_->GetGains(theta, phi, gains + first, count);
 	}
+}
 
-	// std::cout << "theta: " << glm::degrees(theta) << ", phi: " << glm::degrees(phi);
-	float tx_gain = current_pattern_->GetGain(theta, phi);
-	// std::cout << " total gain: " << tx_gain << std::endl;
-	return tx_gain;
+void Transmitter::UpdateFrame()
+{
+	// Columns of rotate(-rotation.x, y axis) * rotate(-rotation.y, z axis), the pattern's x and y axes.
+	const float cos_yaw = std::cos(transform_.rotation.x), sin_yaw = std::sin(transform_.rotation.x);
+	const float cos_pitch = std::cos(transform_.rotation.y), sin_pitch = std::sin(transform_.rotation.y);
+	front_direction_ = glm::vec3(cos_pitch * cos_yaw, -sin_pitch, cos_pitch * sin_yaw);
+	up_direction_ = glm::vec3(sin_pitch * cos_yaw, cos_pitch, sin_pitch * sin_yaw);
+	side_direction_ = glm::cross(front_direction_, up_direction_);
+}
+
+void Transmitter::GetPatternAngles(const glm::vec3& near_tx_position, float& theta, float& phi) const
+{
+	// Theta is the angle to front on the x-z plane, measured away from the side vector; phi is the
+	// angle to up on the x-y plane. The projections of front and up are not normalized.
+	const glm::vec3 direction = near_tx_position - transform_.position;
+	const float xz_length = std::sqrt(direction.x * direction.x + direction.z * direction.z);
+	const float xy_length = std::sqrt(direction.x * direction.x + direction.y * direction.y);
+	const float front_cosine = xz_length > 0.0f ? (front_direction_.x * direction.x + front_direction_.z * direction.z) / xz_length : 0.0f;
+	const float up_cosine = xy_length > 0.0f ? (up_direction_.x * direction.x + up_direction_.y * direction.y) / xy_length : 0.0f;
+	const float angle_on_front = FastAcos(front_cosine);
+	theta = glm::dot(direction, side_direction_) >= 0.0f ? 2.0f * k_pi - angle_on_front : angle_on_front;
+	phi = FastAcos(up_cosine);
 }
 
 std::unordered_map<unsigned int, Receiver*>& Transmitter::GetReceivers()
@@ -184,51 +231,38 @@ glm::vec3 Transmitter::GetPosition()
 	return glm::vec3(transform_.position);
 }
 
+const ImageSourceTable& Transmitter::GetImageSources()
+{
+	if (!image_sources_.IsBuiltFor(transform_.position))
+		ray_tracer_->ComputeImageSources(transform_.position, image_sources_);
+	return image_sources_;
+}
+
 void Transmitter::Move(const Direction direction, float delta_time)
 {
 	float distance = delta_time * move_speed_;
-	glm::vec3 & rotation = transform_.rotation;
-
-	glm::mat4 trans = glm::rotate(glm::mat4(1.0f), -transform_.rotation.x, glm::vec3(0.0f, 1.0f, 0.0f));
-	trans = glm::rotate(trans, -transform_.rotation.y, glm::vec3(0.0f, 0.0f, 1.0f));
-	
-	glm::vec3 front_direction;  
-	glm::vec3 up_direction;
-	glm::vec3 right_direction;
-
-	constexpr glm::vec3 x_axis = glm::vec3(1.0f, 0.0f, 0.0f);
-	constexpr glm::vec3 y_axis = glm::vec3(0.0f, 1.0f, 0.0f);
 
 	switch (direction) {
 	case (Direction::kForward):{
-		front_direction = glm::vec3(trans * glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
-		transform_.position += front_direction * distance;
+		transform_.position += front_direction_ * distance;
 	}	break;
 	case (Direction::kBackward):{
-		front_direction = glm::vec3(trans * glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
-		transform_.position -= front_direction * distance;
+		transform_.position -= front_direction_ * distance;
 	}	break;
 	case (Direction::kRight):{
-		front_direction = glm::vec3(trans * glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
-		up_direction = glm::vec3(trans * glm::vec4(0.0f, 1.0f, 0.0f, 1.0f));
-		right_direction = glm::cross(front_direction, up_direction);
-		transform_.position += right_direction * distance;
+		transform_.position += side_direction_ * distance;
 	}	break;
 	case (Direction::kLeft): {
-		front_direction = glm::vec3(trans * glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
-		up_direction = glm::vec3(trans * glm::vec4(0.0f, 1.0f, 0.0f, 1.0f));
-		right_direction = glm::cross(front_direction, up_direction);
-		transform_.position -= right_direction * distance;
+		transform_.position -= side_direction_ * distance;
 	}	break;
 	case (Direction::kUp): {
-		up_direction = glm::vec3(trans * glm::vec4(0.0f, 1.0f, 0.0f, 1.0f));
-		transform_.position += up_direction * distance;
+		transform_.position += up_direction_ * distance;
 	}	break;
 	case (Direction::kDown): {
-		up_direction = glm::vec3(trans * glm::vec4(0.0f, 1.0f, 0.0f, 1.0f));
-		transform_.position -= up_direction * distance;
+		transform_.position -= up_direction_ * distance;
 	}	break;
 	}
+	image_sources_.Clear();
 	UpdateResultWithVisual();
 	VisualUpdate();
 }
@@ -250,6 +284,7 @@ void Transmitter::Rotate(const Direction rotation, float delta_time)
 		transform_.rotation.y += angular;
 	}break;
 	}
+	UpdateFrame();
 	UpdateResult();
 }
 
@@ -7,6 +7,7 @@
 #include "transform.hpp"
 #include <glm/matrix.hpp>
 #include "camera.hpp"
+#include "image_source_table.hpp"
 
 class Camera;
 class Ray;
@@ -14,7 +15,6 @@ class RadiationPattern;
 class RayTracer;
 class Object;
 class Receiver;
-class Triangle;
 class Shader;
 
 struct Result;
@@ -36,11 +36,15 @@ public:
 	Transform GetTransform() const;
 	float GetFrequency() const;
 	float GetTransmitPower() const;
-	float GetTransmitterGain(glm::vec3 near_tx_position);
+	float GetTransmitterGain(glm::vec3 near_tx_position) const;
+	// Gains towards n positions, the pattern is read in one batch.
+	void GetTransmitterGains(const glm::vec3* near_tx_positions, std::size_t n, float* gains) const;
 	std::unordered_map<unsigned int, Receiver* >& GetReceivers();
 
 	std::string GetReceiversIDs();
 	glm::vec3 GetPosition();
+	// Images of the transmitter in every map plane, rebuilt on first use after a move.
+	const ImageSourceTable& GetImageSources();
 	// Movement
 	void Move(Direction direction, float delta_time);
 	void Rotate(Direction rotation, float delta_time);
@@ -65,7 +69,11 @@ public:
     // Global Variables
     static unsigned int global_id_;
 private:
-	
+	// Rebuilds the antenna frame from transform_.rotation.
+	void UpdateFrame();
+	// Angles of the pattern towards a position: theta from front on the x-z plane, phi from up on the x-y plane.
+	void GetPatternAngles(const glm::vec3& near_tx_position, float& theta, float& phi) const;
+
 	// Variables
 	unsigned int id_;
 	float transmit_power_;
@@ -75,8 +83,13 @@ private:
 	float rotation_speed_; // for controller
 
 	Transform transform_;
+	// Antenna frame, orthonormal, follows the rotation.
+	glm::vec3 front_direction_;
+	glm::vec3 up_direction_;
+	glm::vec3 side_direction_; // cross(front, up)
 	RadiationPattern * current_pattern_;
 	RayTracer* ray_tracer_;
+	ImageSourceTable image_sources_;
 
 };
 
@@ -0,0 +1,151 @@
+#include "triangle_buffer.hpp"
+
+#include "scene_file.hpp"
+
+#include <algorithm>
+
+TriangleBuffer::TriangleBuffer()
+{
+}
+
+void TriangleBuffer::Resize(std::size_t count)
+{
+    for (auto* component : { &v0_x_, &v0_y_, &v0_z_, &edge1_x_, &edge1_y_, &edge1_z_,
+                             &edge2_x_, &edge2_y_, &edge2_z_, &normal_x_, &normal_y_, &normal_z_,
+                             &plane_offset_ })
+        component->resize(count);
+}
+
+void TriangleBuffer::Set(TriangleIndex index, const glm::vec3& point_0, const glm::vec3& point_1,
+                         const glm::vec3& point_2, const glm::vec3& normal)
+{
+    const glm::vec3 edge_1 = point_1 - point_0;
+    const glm::vec3 edge_2 = point_2 - point_0;
+    v0_x_[index] = point_0.x;
+    v0_y_[index] = point_0.y;
+    v0_z_[index] = point_0.z;
+    edge1_x_[index] = edge_1.x;
+    edge1_y_[index] = edge_1.y;
+    edge1_z_[index] = edge_1.z;
+    edge2_x_[index] = edge_2.x;
+    edge2_y_[index] = edge_2.y;
+    edge2_z_[index] = edge_2.z;
+    normal_x_[index] = normal.x;
+    normal_y_[index] = normal.y;
+    normal_z_[index] = normal.z;
+    plane_offset_[index] = glm::dot(normal, point_0);
+}
+
+void TriangleBuffer::Reorder(const TriangleIndex* order)
+{
+    // One component at a time, so the extra memory is a single array.
+    AlignedVector<float> reordered(Size());
+    for (auto* component : { &v0_x_, &v0_y_, &v0_z_, &edge1_x_, &edge1_y_, &edge1_z_,
+                             &edge2_x_, &edge2_y_, &edge2_z_, &normal_x_, &normal_y_, &normal_z_,
+                             &plane_offset_ }) {
+        const float* source = component->data();
+        for (std::size_t i = 0; i < reordered.size(); ++i) reordered[i] = source[order[i]];
+        std::copy(reordered.begin(), reordered.end(), component->begin());
+    }
+}
+
+void TriangleBuffer::Clear()
+{
+    for (auto* component : { &v0_x_, &v0_y_, &v0_z_, &edge1_x_, &edge1_y_, &edge1_z_,
+                             &edge2_x_, &edge2_y_, &edge2_z_, &normal_x_, &normal_y_, &normal_z_,
+                             &plane_offset_ })
+        component->clear();
+}
+
+TriangleIndex TriangleBuffer::Size() const
+{
+    return (TriangleIndex)v0_x_.size();
+}
+
+bool TriangleBuffer::Empty() const
+{
+    return v0_x_.empty();
+}
+
+glm::vec3 TriangleBuffer::GetVertex(TriangleIndex index, unsigned int corner) const
+{
+    switch (corner) {
+    case 1: return GetV0(index) + GetEdge1(index);
+    case 2: return GetV0(index) + GetEdge2(index);
+    default: return GetV0(index);
+    }
+}
+
+glm::vec3 TriangleBuffer::GetV0(TriangleIndex index) const
+{
+    return glm::vec3(v0_x_[index], v0_y_[index], v0_z_[index]);
+}
+
+glm::vec3 TriangleBuffer::GetEdge1(TriangleIndex index) const
+{
+    return glm::vec3(edge1_x_[index], edge1_y_[index], edge1_z_[index]);
+}
+
+glm::vec3 TriangleBuffer::GetEdge2(TriangleIndex index) const
+{
+    return glm::vec3(edge2_x_[index], edge2_y_[index], edge2_z_[index]);
+}
+
+glm::vec3 TriangleBuffer::GetNormal(TriangleIndex index) const
+{
+    return glm::vec3(normal_x_[index], normal_y_[index], normal_z_[index]);
+}
+
+float TriangleBuffer::GetPlaneOffset(TriangleIndex index) const
+{
+    return plane_offset_[index];
+}
+
+glm::vec3 TriangleBuffer::GetCentroid(TriangleIndex index) const
+{
+    return GetV0(index) + (GetEdge1(index) + GetEdge2(index)) / 3.0f;
+}
+
+bool TriangleBuffer::IsHit(TriangleIndex index, const TracingRay& ray, float& t) const
+{
+    return IsHit(index, ray.origin, ray.direction, t) && t > ray.t_min && t < ray.t_max;
+}
+
+bool TriangleBuffer::IsHit(TriangleIndex index, const glm::vec3& origin, const glm::vec3& direction, float& t) const
+{
+    const float k_epsilon = 0.00000001f;
+
+    const glm::vec3 edge_1 = GetEdge1(index);
+    const glm::vec3 edge_2 = GetEdge2(index);
+    const glm::vec3 h = glm::cross(direction, edge_2);
+    const float a = glm::dot(edge_1, h);
+
+    // Both sides of the triangle count as a hit.
+    const float f = 1.0f / a;
+    const glm::vec3 s = origin - GetV0(index);
+    const float u = f * glm::dot(s, h);
+    if (u < 0.0f || u > 1.0f) return false;
+    const glm::vec3 q = glm::cross(s, edge_1);
+    const float v = f * glm::dot(direction, q);
+    if (v < 0.0f || u + v > 1.0f) return false;
+
+    t = f * glm::dot(edge_2, q);
+    return t > k_epsilon;
+}
+
+void TriangleBuffer::Write(SceneWriter& writer) const
+{
+    for (const auto* component : { &v0_x_, &v0_y_, &v0_z_, &edge1_x_, &edge1_y_, &edge1_z_,
+                                   &edge2_x_, &edge2_y_, &edge2_z_, &normal_x_, &normal_y_, &normal_z_,
+                                   &plane_offset_ })
+        writer.Write(*component);
+}
+
+bool TriangleBuffer::Read(SceneReader& reader)
+{
+    for (auto* component : { &v0_x_, &v0_y_, &v0_z_, &edge1_x_, &edge1_y_, &edge1_z_,
+                             &edge2_x_, &edge2_y_, &edge2_z_, &normal_x_, &normal_y_, &normal_z_,
+                             &plane_offset_ })
+        if (!reader.Read(*component) || component->size() != v0_x_.size()) return false;
+    return true;
+}
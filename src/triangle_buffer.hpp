@@ -0,0 +1,54 @@
+#ifndef TRIANGLE_BUFFER_H
+#define TRIANGLE_BUFFER_H
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "mappable_vector.hpp"
+#include "tracing_ray.hpp"
+
+typedef std::uint32_t TriangleIndex;
+
+class SceneWriter;
+class SceneReader;
+
+// Structure-of-arrays store of the map triangles with the data the intersection tests need
+// already computed: the first vertex, both edges, the normal and the plane offset (n . v0).
+class TriangleBuffer {
+public:
+	TriangleBuffer();
+
+	// Resize and then Set from several threads at once, each index written by one thread only.
+	void Resize(std::size_t count);
+	void Set(TriangleIndex index, const glm::vec3& point_0, const glm::vec3& point_1, const glm::vec3& point_2,
+	         const glm::vec3& normal);
+	// Triangle i becomes the former triangle order[i]; order holds every index once.
+	void Reorder(const TriangleIndex* order);
+	void Clear();
+	TriangleIndex Size() const;
+	bool Empty() const;
+
+	glm::vec3 GetVertex(TriangleIndex index, unsigned int corner) const;
+	glm::vec3 GetV0(TriangleIndex index) const;
+	glm::vec3 GetEdge1(TriangleIndex index) const;
+	glm::vec3 GetEdge2(TriangleIndex index) const;
+	glm::vec3 GetNormal(TriangleIndex index) const;
+	float GetPlaneOffset(TriangleIndex index) const;
+	glm::vec3 GetCentroid(TriangleIndex index) const;
+
+	bool IsHit(TriangleIndex index, const TracingRay& ray, float& t) const; // hit inside the t range of the ray
+	bool IsHit(TriangleIndex index, const glm::vec3& origin, const glm::vec3& direction, float& t) const; // Moller-Trumbore, both faces
+
+	void Write(SceneWriter& writer) const;
+	bool Read(SceneReader& reader); // borrows the arrays from the scene file
+
+	// Component arrays, each aligned to a cache line.
+	AlignedMappableVector<float> v0_x_, v0_y_, v0_z_;
+	AlignedMappableVector<float> edge1_x_, edge1_y_, edge1_z_;
+	AlignedMappableVector<float> edge2_x_, edge2_y_, edge2_z_;
+	AlignedMappableVector<float> normal_x_, normal_y_, normal_z_;
+	AlignedMappableVector<float> plane_offset_;
+};
+
+#endif // !TRIANGLE_BUFFER_H